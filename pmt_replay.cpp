@@ -0,0 +1,134 @@
+/*******************************************************************************
+ * File: PMTReplay.cpp
+ *
+ * Description:
+ *    pmt-replay, the command line tool that sends a file with MPEG-2
+ *    Transport Stream over UDP or RTP at the given bitrate (see
+ *    CTSReplayer). Together with "pmt-scan udp://..." it tests the live
+ *    input on one machine.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "src/packet.h"
+#include "src/ts_file.h"
+#include "src/ts_replayer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void PrintUsage(void)
+{
+    printf("Usage: pmt-replay [options] FILE ADDRESS\n"
+           "Sends MPEG-2 Transport Stream file to udp://host:port (or rtp://host:port\n"
+           "with RTP headers), 7 packets per datagram.\n"
+           "\n"
+           "  -b, --bitrate BPS   bitrate of TS in bits per second, k, M and G suffixes\n"
+           "                      are allowed; 0 sends as fast as possible (required)\n"
+           "  -n, --loops N       send the file N times, 0 for endless (default: 1)\n"
+           "  -h, --help          show this help\n");
+}
+
+//
+// ParseBitrate
+//
+// Parses bits per second with an optional k, M or G suffix. Returns false if
+// the value is wrong.
+static bool ParseBitrate(const char* psz, uint64_t* puBitrate)
+{
+    char* pszEnd = NULL;
+    double dValue = strtod(psz, &pszEnd);
+    if (pszEnd == psz || dValue < 0)
+        return false;
+
+    switch (*pszEnd) {
+    case 'k':
+        dValue *= 1e3;
+        pszEnd++;
+        break;
+    case 'M':
+        dValue *= 1e6;
+        pszEnd++;
+        break;
+    case 'G':
+        dValue *= 1e9;
+        pszEnd++;
+        break;
+    }
+
+    if (*pszEnd != '\0')
+        return false;
+
+    *puBitrate = (uint64_t)dValue;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    bool fBitrate = false;
+    uint64_t uBitrate = 0;
+    unsigned int uLoops = 1;
+    const char* pszFile = NULL;
+    const char* pszAddress = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* pszArg = argv[i];
+
+        if (strcmp(pszArg, "-h") == 0 || strcmp(pszArg, "--help") == 0) {
+            PrintUsage();
+            return 0;
+        } else if ((strcmp(pszArg, "-b") == 0 || strcmp(pszArg, "--bitrate") == 0) && i + 1 < argc) {
+            fBitrate = ParseBitrate(argv[++i], &uBitrate);
+            if (!fBitrate) {
+                PrintUsage();
+                return 2;
+            }
+        } else if ((strcmp(pszArg, "-n") == 0 || strcmp(pszArg, "--loops") == 0) && i + 1 < argc) {
+            uLoops = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (pszFile == NULL) {
+            pszFile = pszArg;
+        } else if (pszAddress == NULL) {
+            pszAddress = pszArg;
+        } else {
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (!fBitrate || pszFile == NULL || pszAddress == NULL) {
+        PrintUsage();
+        return 2;
+    }
+
+    CTSFile file;
+    if (!file.Open(pszFile)) {
+        fprintf(stderr, "pmt-replay: can't open %s\n", pszFile);
+        return 1;
+    }
+
+    CTSReplayer replayer;
+    if (!replayer.Open(pszAddress)) {
+        fprintf(stderr, "pmt-replay: can't send to %s\n", pszAddress);
+        return 1;
+    }
+
+    file.Advise(CTSFile::sequential);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool fResult = replayer.Send(file, uBitrate, uLoops);
+    double dTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%llu packets in %llu datagrams, %.3f s, %.2f Mbit/s\n", (unsigned long long)replayer.GetPacketsCount(),
+        (unsigned long long)replayer.GetDatagramsCount(), dTime,
+        (dTime > 0) ? replayer.GetPacketsCount() * CPacket::PACKET_SIZE * 8 / dTime / 1e6 : 0.0);
+
+    if (!fResult) {
+        fprintf(stderr, "pmt-replay: %s isn't MPEG-2 TS or sending failed\n", pszFile);
+        return 1;
+    }
+
+    return 0;
+}
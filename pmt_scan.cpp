@@ -0,0 +1,438 @@
+/*******************************************************************************
+ * File: PMTScan.cpp
+ *
+ * Description:
+ *    pmt-scan, the command line tool for headless machines and batch jobs.
+ *    It indexes MPEG-2 TS files (or reads streams from pipes, standard input
+ *    and UDP) and prints a summary of each one; PM Sections can be listed
+ *    too. It uses only pmtcore, so it starts without loading Qt.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "src/transport_stream.h"
+#include "src/ts_stream.h"
+
+#include <bitset>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// the most indexing threads accepted by -j; more than the chunks of a file
+// are never started anyway
+static const unsigned long MAX_THREADS = 1024;
+
+// command line options
+struct OPTIONS {
+    bool fList = false; // list PM Sections
+    bool fChanges = false; // list PM Sections where programs change
+    int iProgram = -1; // program_number whose PM Sections are listed, -1 for all
+    bool fStats = false; // print statistics of PIDs
+    bool fErrors = false; // list errors found in TS
+    bool fPCR = false; // print the PCR index
+    bool fCache = true; // load and save the index (see CIndexCache)
+    unsigned int uThreads = 0; // indexing threads, 0 for all cores
+    int iTimeout = -1; // milliseconds without datagrams that end UDP input
+    std::vector<std::string> inputs;
+};
+
+// summary of one input
+struct SUMMARY {
+    const char* pszStatus = "ok";
+    size_t uPacketSize = 0;
+    uint64_t uBytes = 0;
+    uint64_t uPackets = 0;
+    uint64_t uSyncLossCount = 0;
+    uint64_t uPASCount = 0;
+    uint64_t uPMSCount = 0;
+    uint64_t uProgramsCount = 0;
+    double dTime = 0; // milliseconds
+};
+
+static void PrintUsage(void)
+{
+    printf("Usage: pmt-scan [options] FILE...\n"
+           "Indexes MPEG-2 Transport Stream files and prints a summary of each one.\n"
+           "FILE can also be \"-\" (standard input), a pipe or udp://[source@]host:port\n"
+           "(rtp://... for RTP); these are read forward only.\n"
+           "\n"
+           "  -l, --list          list PM Sections\n"
+           "  -c, --changes       list only PM Sections where programs change: PID,\n"
+           "                      version_number or CRC_32 differs (files only)\n"
+           "  -P, --program N     list PM Sections of program_number N only (files only)\n"
+           "  -s, --stats         print packets and bitrates of each PID (files only)\n"
+           "  -e, --errors        list TS errors: sync loss, CC, TEI, PAT/PMT (files only)\n"
+           "  -p, --pcr           print the PCR index of each PCR PID: time, packet and\n"
+           "                      bitrate about each second (files only)\n"
+           "  -j, --threads N     indexing threads (default: one per core)\n"
+           "  -n, --no-cache      don't load or save the index of files\n"
+           "  -t, --timeout MS    end UDP input after MS milliseconds without data\n"
+           "  -h, --help          show this help\n"
+           "\n"
+           "Summary columns: file, packet size, bytes, packets, sync losses, PATs,\n"
+           "PM Sections, programs, time in ms, status.\n");
+}
+
+//
+// ParseOptions
+//
+// Returns false if the command line is wrong.
+static bool ParseOptions(int argc, char* argv[], OPTIONS* pOptions)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* pszArg = argv[i];
+
+        if (strcmp(pszArg, "-l") == 0 || strcmp(pszArg, "--list") == 0) {
+            pOptions->fList = true;
+        } else if (strcmp(pszArg, "-c") == 0 || strcmp(pszArg, "--changes") == 0) {
+            pOptions->fChanges = true;
+        } else if (strcmp(pszArg, "-P") == 0 || strcmp(pszArg, "--program") == 0) {
+            if (++i == argc)
+                return false;
+
+            char* pszEnd = NULL;
+            unsigned long uProgram = strtoul(argv[i], &pszEnd, 0);
+            if (*argv[i] == '\0' || *pszEnd != '\0' || uProgram > 0xFFFF)
+                return false;
+
+            pOptions->iProgram = (int)uProgram;
+        } else if (strcmp(pszArg, "-s") == 0 || strcmp(pszArg, "--stats") == 0) {
+            pOptions->fStats = true;
+        } else if (strcmp(pszArg, "-e") == 0 || strcmp(pszArg, "--errors") == 0) {
+            pOptions->fErrors = true;
+        } else if (strcmp(pszArg, "-p") == 0 || strcmp(pszArg, "--pcr") == 0) {
+            pOptions->fPCR = true;
+        } else if (strcmp(pszArg, "-n") == 0 || strcmp(pszArg, "--no-cache") == 0) {
+            pOptions->fCache = false;
+        } else if (strcmp(pszArg, "-j") == 0 || strcmp(pszArg, "--threads") == 0) {
+            if (++i == argc)
+                return false;
+
+            char* pszEnd = NULL;
+            unsigned long uThreads = strtoul(argv[i], &pszEnd, 10);
+            if (*argv[i] == '\0' || *pszEnd != '\0' || uThreads > MAX_THREADS)
+                return false;
+
+            pOptions->uThreads = (unsigned int)uThreads;
+        } else if (strcmp(pszArg, "-t") == 0 || strcmp(pszArg, "--timeout") == 0) {
+            if (++i == argc)
+                return false;
+
+            char* pszEnd = NULL;
+            long iTimeout = strtol(argv[i], &pszEnd, 10);
+            if (*argv[i] == '\0' || *pszEnd != '\0' || iTimeout < 0 || iTimeout > INT_MAX)
+                return false;
+
+            pOptions->iTimeout = (int)iTimeout;
+        } else if (pszArg[0] == '-' && pszArg[1] != '\0') {
+            return false;
+        } else {
+            pOptions->inputs.push_back(pszArg);
+        }
+    }
+
+    return !pOptions->inputs.empty();
+}
+
+//
+// IsStream
+//
+// Returns true if the input can be read only forward (see CTSStream).
+static bool IsStream(const std::string& szName)
+{
+    if (szName == "-" || CUDPSource::IsAddress(szName))
+        return true;
+
+#ifndef _WIN32
+    struct stat st;
+    if (stat(szName.c_str(), &st) == 0 && !S_ISREG(st.st_mode))
+        return true;
+#endif
+
+    return false;
+}
+
+//
+// FormatTime
+//
+// Formats ticks of PCR clock as h:mm:ss.mmm.
+static std::string FormatTime(uint64_t uTime)
+{
+    uint64_t uMs = uTime / (CPacket::PCR_CLOCK / 1000);
+
+    char sz[32];
+    snprintf(sz, sizeof(sz), "%llu:%02u:%02u.%03u", (unsigned long long)(uMs / 3600000), (unsigned int)(uMs / 60000 % 60),
+        (unsigned int)(uMs / 1000 % 60), (unsigned int)(uMs % 1000));
+    return sz;
+}
+
+// pszTime is the time of PM Section or NULL if it's unknown (a stream, or
+// there are no PCRs)
+static void PrintPMS(const std::string& szName, uint64_t uNum, const PMS_INDEX_ENTRY& entry, const char* pszTime = NULL)
+{
+    printf("  %s\t#%llu\tpacket %llu\toffset %llu\tPID 0x%04X\tprogram %u\tversion %u\tCRC_32 0x%08X",
+        szName.c_str(), (unsigned long long)uNum, (unsigned long long)entry.uPacketNum + 1,
+        (unsigned long long)entry.uOffset, entry.PID, entry.program_number, entry.version_number, entry.CRC_32);
+    if (pszTime != NULL)
+        printf("\ttime %s", pszTime);
+    printf("\n");
+}
+
+//
+// PrintChanges
+//
+// Prints PM Sections where programs (or program iProgram) change; the
+// sections that repeat them are skipped by the index.
+static void PrintChanges(const std::string& szName, const CTSIndex& index, int iProgram)
+{
+    uint64_t uCount = index.GetPMSChangesCount(iProgram);
+    for (uint64_t i = 0; i < uCount; i++) {
+        uint64_t uPMS = 0;
+        PMS_INDEX_ENTRY entry;
+        if (!index.GetPMSChange(i, &uPMS, iProgram) || !index.GetPMSection(uPMS, &entry))
+            break;
+
+        uint64_t uTime = 0;
+        if (index.GetPacketTime(entry.uPacketNum, &uTime))
+            PrintPMS(szName, uPMS + 1, entry, FormatTime(uTime).c_str());
+        else
+            PrintPMS(szName, uPMS + 1, entry);
+    }
+}
+
+//
+// PrintPIDStats
+//
+// Prints a line for each PID: packets, their percent, average and peak
+// bitrate in kbit/s ("-" if TS bitrate is unknown).
+static void PrintPIDStats(const std::string& szName, const CTSIndex& index)
+{
+    uint64_t uPacketsCount = index.GetPacketsCount();
+    bool fBitrate = (index.GetBitrate() != 0);
+
+    std::vector<PID_STATS> stats;
+    index.GetPIDStats(&stats);
+
+    for (size_t i = 0; i < stats.size(); i++) {
+        const PID_STATS& s = stats[i];
+
+        printf("  %s\tPID 0x%04X\tpackets %llu\t%.2f%%", szName.c_str(), s.PID, (unsigned long long)s.uPacketsCount,
+            s.uPacketsCount * 100.0 / uPacketsCount);
+        if (fBitrate)
+            printf("\taverage %.1f kbit/s\tpeak %.1f kbit/s\n", s.uBitrate / 1000.0, s.uPeakBitrate / 1000.0);
+        else
+            printf("\taverage -\tpeak -\n");
+    }
+}
+
+//
+// PrintErrors
+//
+// Prints the number of errors of each type found in TS, then each error whose
+// location is kept (see CTSIndex::GetErrorsCount). Timeouts aren't checked
+// without the bitrate, so their number is unknown then.
+static void PrintErrors(const std::string& szName, const CTSIndex& index)
+{
+    bool fBitrate = index.GetBitrate() != 0;
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++) {
+        if (!fBitrate && (i == TS_ERROR::patTimeout || i == TS_ERROR::pmtTimeout))
+            printf("  %s\t%s\tunknown\n", szName.c_str(), CTSChecker::GetTypeName(i));
+        else
+            printf("  %s\t%s\t%llu\n", szName.c_str(), CTSChecker::GetTypeName(i), (unsigned long long)index.GetErrorsCount(i));
+    }
+
+    uint64_t uCount = index.GetKeptErrorsCount();
+    for (uint64_t i = 0; i < uCount; i++) {
+        TS_ERROR error;
+        if (!index.GetError(i, &error))
+            break;
+
+        printf("  %s\tpacket %llu\toffset %llu\tPID 0x%04X\t%s\t%u\n", szName.c_str(), (unsigned long long)error.uPacketNum + 1,
+            (unsigned long long)error.uOffset, error.PID, CTSChecker::GetTypeName(error.type), error.uDetail);
+    }
+
+    if (uCount < index.GetErrorsCount())
+        printf("  %s\t%llu more errors aren't listed\n", szName.c_str(), (unsigned long long)(index.GetErrorsCount() - uCount));
+}
+
+//
+// PrintPCRIndex
+//
+// Prints the PCR index of each PCR PID: a line for each entry with its time,
+// packet, PCR as is and the bitrate of TS up to the next entry.
+static void PrintPCRIndex(const std::string& szName, const CTSIndex& index)
+{
+    std::vector<uint16_t> PIDs;
+    index.GetPCRPIDs(&PIDs);
+
+    for (size_t i = 0; i < PIDs.size(); i++) {
+        std::vector<PCR_INDEX_ENTRY> entries;
+        index.GetPCRIndex(PIDs[i], &entries);
+
+        for (size_t j = 0; j < entries.size(); j++) {
+            const PCR_INDEX_ENTRY& entry = entries[j];
+
+            printf("  %s\tPCR PID 0x%04X\ttime %s\tpacket %llu\toffset %llu\tPCR %llu", szName.c_str(), PIDs[i],
+                FormatTime(entry.uTime).c_str(), (unsigned long long)entry.uPacketNum + 1, (unsigned long long)entry.uOffset,
+                (unsigned long long)entry.uPCR);
+            if (j + 1 < entries.size() && entries[j + 1].uTime != entry.uTime)
+                printf("\t%.1f kbit/s\n", (double)(entries[j + 1].uPacketNum - entry.uPacketNum) * CPacket::PACKET_SIZE * 8
+                        * CPacket::PCR_CLOCK / (entries[j + 1].uTime - entry.uTime) / 1000);
+            else
+                printf("\t-\n");
+        }
+    }
+}
+
+//
+// ScanFile
+//
+// Indexes the file (or loads its saved index) and fills the summary.
+static bool ScanFile(const std::string& szName, const OPTIONS& options, SUMMARY* pSummary)
+{
+    CTransportStream ts;
+    ts.SetIndexCache(options.fCache);
+    if (!ts.Open(szName, false)) {
+        pSummary->pszStatus = "can't open";
+        return false;
+    }
+
+    ts.BuildIndex(CTSIndex::Progress(), options.uThreads);
+
+    const CTSIndex& index = ts.GetIndex();
+    if (!index.IsMPEG2TS()) {
+        pSummary->pszStatus = "not MPEG-2 TS";
+        return false;
+    }
+
+    std::vector<uint16_t> programs;
+    index.GetProgramNumbers(&programs);
+
+    // the index lists the sections of each program, so one program is
+    // listed without reading the others
+    uint64_t uPMSCount = index.GetPMSCount();
+    uint64_t uListCount = (options.iProgram < 0) ? uPMSCount : index.GetProgramPMSCount((uint16_t)options.iProgram);
+    for (uint64_t i = 0; options.fList && i < uListCount; i++) {
+        uint64_t uPMS = i;
+        PMS_INDEX_ENTRY entry;
+        if ((options.iProgram >= 0 && !index.GetProgramPMSection((uint16_t)options.iProgram, i, &uPMS)) || !index.GetPMSection(uPMS, &entry))
+            break;
+
+        uint64_t uTime = 0;
+        if (index.GetPacketTime(entry.uPacketNum, &uTime))
+            PrintPMS(szName, uPMS + 1, entry, FormatTime(uTime).c_str());
+        else
+            PrintPMS(szName, uPMS + 1, entry);
+    }
+
+    if (options.fChanges)
+        PrintChanges(szName, index, options.iProgram);
+
+    if (options.fStats)
+        PrintPIDStats(szName, index);
+
+    if (options.fErrors)
+        PrintErrors(szName, index);
+
+    if (options.fPCR)
+        PrintPCRIndex(szName, index);
+
+    pSummary->uPacketSize = index.GetPacketSize();
+    pSummary->uBytes = ts.GetFileSize();
+    pSummary->uPackets = index.GetPacketsCount();
+    pSummary->uSyncLossCount = index.GetSyncLossCount();
+    pSummary->uPASCount = index.GetPASCount();
+    pSummary->uPMSCount = uPMSCount;
+    pSummary->uProgramsCount = programs.size();
+    if (ts.IsIndexLoaded())
+        pSummary->pszStatus = "ok, saved index";
+
+    return true;
+}
+
+//
+// ScanStream
+//
+// Reads the stream up to its end and fills the summary; PM Sections are
+// listed as they arrive.
+static bool ScanStream(const std::string& szName, const OPTIONS& options, SUMMARY* pSummary)
+{
+    CTSStream stream;
+    stream.SetIdleTimeout(options.iTimeout);
+    if (!stream.Open(szName)) {
+        pSummary->pszStatus = "can't open";
+        return false;
+    }
+
+    std::bitset<65536> programs;
+    bool fResult = stream.Run(CTSStream::PATHandler(), [&](const PMS_INDEX_ENTRY& entry, const CPMTView& /* PMS */) {
+        programs.set(entry.program_number);
+        if (options.fList) {
+            PrintPMS(szName, stream.GetPMSCount(), entry);
+            fflush(stdout);
+        }
+
+        return true;
+    });
+
+    pSummary->uPacketSize = stream.GetPacketSize();
+    pSummary->uBytes = stream.GetBytesCount();
+    pSummary->uPackets = stream.GetPacketsCount();
+    pSummary->uSyncLossCount = stream.GetSyncLossCount();
+    pSummary->uPASCount = stream.GetPASCount();
+    pSummary->uPMSCount = stream.GetPMSCount();
+    pSummary->uProgramsCount = programs.count();
+
+    if (stream.GetPacketSize() == 0)
+        pSummary->pszStatus = stream.IsReadError() ? "read error" : "not MPEG-2 TS";
+    else if (!fResult)
+        pSummary->pszStatus = "read error";
+    else
+        pSummary->pszStatus = "ok, stream";
+
+    return fResult;
+}
+
+int main(int argc, char* argv[])
+{
+    OPTIONS options;
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+        PrintUsage();
+        return 0;
+    }
+
+    if (!ParseOptions(argc, argv, &options)) {
+        PrintUsage();
+        return 2;
+    }
+
+    int iExitCode = 0;
+    for (size_t i = 0; i < options.inputs.size(); i++) {
+        const std::string& szName = options.inputs[i];
+
+        SUMMARY summary;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool fResult = IsStream(szName) ? ScanStream(szName, options, &summary) : ScanFile(szName, options, &summary);
+        summary.dTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (!fResult)
+            iExitCode = 1;
+
+        printf("%s\t%u\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%.1f\t%s\n", szName.c_str(), (unsigned int)summary.uPacketSize,
+            (unsigned long long)summary.uBytes, (unsigned long long)summary.uPackets, (unsigned long long)summary.uSyncLossCount,
+            (unsigned long long)summary.uPASCount, (unsigned long long)summary.uPMSCount, (unsigned long long)summary.uProgramsCount,
+            summary.dTime, summary.pszStatus);
+        fflush(stdout);
+    }
+
+    return iExitCode;
+}
@@ -0,0 +1,88 @@
+/*******************************************************************************
+ * File: Arena.cpp
+ *
+ * Description: CArena class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "arena.h"
+#include <algorithm>
+
+const size_t CArena::BLOCK_SIZE;
+
+CArena::CArena(size_t uBlockSize /* = BLOCK_SIZE */)
+{
+    m_uBlockSize = uBlockSize;
+    m_pbFree = NULL;
+    m_pbEnd = NULL;
+    m_uAllocatedSize = 0;
+}
+
+CArena::~CArena(void)
+{
+    Reset();
+
+    if (!m_Blocks.empty())
+        ::operator delete(m_Blocks[0]);
+}
+
+//
+// CArena::Allocate
+//
+// Returns uSize bytes aligned by uAlignment (a power of two not greater than
+// alignof(max_align_t)).
+void* CArena::Allocate(size_t uSize, size_t uAlignment)
+{
+    uintptr_t uFree = ((uintptr_t)m_pbFree + uAlignment - 1) & ~(uintptr_t)(uAlignment - 1);
+    if (m_pbFree == NULL || uFree > (uintptr_t)m_pbEnd || uSize > (uintptr_t)m_pbEnd - uFree)
+        return AllocateBlock(uSize, uAlignment);
+
+    m_pbFree = (uint8_t*)uFree + uSize;
+    m_uAllocatedSize += uSize;
+    return (void*)uFree;
+}
+
+//
+// CArena::AllocateBlock
+//
+// Takes a new block for the allocation that doesn't fit in the last one. A
+// request bigger than a quarter of block gets its own block, so the free part
+// of the last one isn't wasted.
+void* CArena::AllocateBlock(size_t uSize, size_t uAlignment)
+{
+    if (uSize > m_uBlockSize / 4) {
+        uint8_t* pb = (uint8_t*)::operator new(uSize);
+        m_LargeBlocks.push_back(pb);
+        m_uAllocatedSize += uSize;
+        return pb;
+    }
+
+    uint8_t* pb = (uint8_t*)::operator new(m_uBlockSize);
+    m_Blocks.push_back(pb);
+    m_pbFree = pb;
+    m_pbEnd = pb + m_uBlockSize;
+
+    return Allocate(uSize, uAlignment);
+}
+
+//
+// CArena::Reset
+//
+// Frees all memory given out by the arena. The first block is kept for next
+// allocations.
+void CArena::Reset(void)
+{
+    for (size_t i = 1; i < m_Blocks.size(); i++)
+        ::operator delete(m_Blocks[i]);
+
+    for (size_t i = 0; i < m_LargeBlocks.size(); i++)
+        ::operator delete(m_LargeBlocks[i]);
+    m_LargeBlocks.clear();
+
+    m_Blocks.resize(std::min<size_t>(m_Blocks.size(), 1));
+    m_pbFree = m_Blocks.empty() ? NULL : m_Blocks[0];
+    m_pbEnd = m_Blocks.empty() ? NULL : m_Blocks[0] + m_uBlockSize;
+    m_uAllocatedSize = 0;
+}
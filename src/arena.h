@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * File: Arena.h
+ *
+ * Description:
+ *    CArena class definition. This class gives memory for short-lived
+ *    objects made while a file is scanned (parsed sections, their lists and
+ *    buffers): it's taken from big blocks by moving a pointer and is freed
+ *    all at once when the scan is finished. Also contains CArenaAllocator,
+ *    which lets standard containers take memory from an arena.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+//
+// Classes defined in this file
+//
+class CArena;
+
+template <class T>
+class CArenaAllocator;
+
+//
+// Class definitions
+//
+
+// Memory taken from the arena isn't freed one by one, only by Reset() or by
+// destructor; destructors of objects placed there aren't called by the arena.
+// The arena isn't thread-safe, so each thread uses its own one.
+class CArena {
+public:
+    // constants
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+public:
+    CArena(size_t uBlockSize = BLOCK_SIZE);
+    ~CArena(void);
+
+    void* Allocate(size_t uSize, size_t uAlignment);
+    void Reset(void);
+
+    size_t GetAllocatedSize(void) const { return m_uAllocatedSize; }
+    size_t GetBlocksCount(void) const { return m_Blocks.size() + m_LargeBlocks.size(); }
+
+private:
+    CArena(const CArena&);
+    CArena& operator=(const CArena&);
+
+    void* AllocateBlock(size_t uSize, size_t uAlignment);
+
+private:
+    size_t m_uBlockSize;
+    std::vector<uint8_t*> m_Blocks; // blocks of m_uBlockSize bytes, the first one is kept by Reset()
+    std::vector<uint8_t*> m_LargeBlocks; // allocations that don't fit in a block
+    uint8_t* m_pbFree; // free part of the last block of m_uBlockSize bytes
+    uint8_t* m_pbEnd;
+    size_t m_uAllocatedSize; // bytes given out since the last Reset()
+};
+
+// Allocator for standard containers. Without an arena it takes memory from
+// the heap as std::allocator does. A copy of a container is always made in
+// the heap, so it may outlive the arena; a container moved or assigned to
+// another one moves its memory only if both use the same arena.
+template <class T>
+class CArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::false_type propagate_on_container_move_assignment;
+    typedef std::false_type propagate_on_container_swap;
+
+public:
+    CArenaAllocator(void) : m_pArena(NULL) {}
+    CArenaAllocator(CArena* pArena) : m_pArena(pArena) {}
+
+    template <class U>
+    CArenaAllocator(const CArenaAllocator<U>& allocator) : m_pArena(allocator.GetArena()) {}
+
+    T* allocate(size_t uCount)
+    {
+        if (m_pArena == NULL)
+            return (T*)::operator new(uCount * sizeof(T));
+
+        return (T*)m_pArena->Allocate(uCount * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T* p, size_t /* uCount */)
+    {
+        if (m_pArena == NULL)
+            ::operator delete(p);
+    }
+
+    CArenaAllocator select_on_container_copy_construction(void) const { return CArenaAllocator(); }
+
+    CArena* GetArena(void) const { return m_pArena; }
+
+private:
+    CArena* m_pArena; // NULL for the heap
+};
+
+template <class T, class U>
+inline bool operator==(const CArenaAllocator<T>& a, const CArenaAllocator<U>& b)
+{
+    return (a.GetArena() == b.GetArena());
+}
+
+template <class T, class U>
+inline bool operator!=(const CArenaAllocator<T>& a, const CArenaAllocator<U>& b)
+{
+    return (a.GetArena() != b.GetArena());
+}
+
+#endif // _ARENA_H_
@@ -0,0 +1,161 @@
+/*******************************************************************************
+ * File: BitrateTimeline.cpp
+ *
+ * Description:
+ *    CBitrateTimeline class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "bitrate_timeline.h"
+#include <QMouseEvent>
+#include <QPainter>
+#include <QStringList>
+#include <algorithm>
+
+// space for the labels of time under the graph, in pixels
+static const int LABELS_HEIGHT = 16;
+
+CBitrateTimeline::CBitrateTimeline(QWidget* parent /* = nullptr */)
+    : QWidget(parent)
+{
+    setMinimumHeight(120);
+}
+
+//
+// CBitrateTimeline::SetPCRIndex
+//
+// Takes the bitrate between each two entries of the PCR index: the packets
+// between them by their time.
+void CBitrateTimeline::SetPCRIndex(const std::vector<PCR_INDEX_ENTRY>& entries)
+{
+    m_Points.clear();
+    m_uDuration = entries.empty() ? 0 : entries.back().uTime;
+    m_uMaxBitrate = 0;
+
+    for (size_t i = 0; i + 1 < entries.size(); i++) {
+        uint64_t uTicks = entries[i + 1].uTime - entries[i].uTime;
+        if (uTicks == 0)
+            continue;
+
+        POINT point;
+        point.uTime = entries[i].uTime;
+        point.uBitrate = (uint64_t)((double)(entries[i + 1].uPacketNum - entries[i].uPacketNum) * CPacket::PACKET_SIZE * 8
+            * CPacket::PCR_CLOCK / uTicks);
+        m_Points.push_back(point);
+
+        m_uMaxBitrate = std::max(m_uMaxBitrate, point.uBitrate);
+    }
+
+    update();
+}
+
+//
+// CBitrateTimeline::SetMarker
+//
+// Marks uTime on the graph, UINT64_MAX removes the mark.
+void CBitrateTimeline::SetMarker(uint64_t uTime)
+{
+    m_uMarker = uTime;
+    update();
+}
+
+void CBitrateTimeline::Clear(void)
+{
+    m_Points.clear();
+    m_uDuration = 0;
+    m_uMaxBitrate = 0;
+    m_uMarker = UINT64_MAX;
+    update();
+}
+
+//
+// CBitrateTimeline::FormatTime
+//
+// Formats ticks of PCR clock as h:mm:ss.mmm.
+QString CBitrateTimeline::FormatTime(uint64_t uTime)
+{
+    uint64_t uMs = uTime / (CPacket::PCR_CLOCK / 1000);
+
+    return QString("%1:%2:%3.%4")
+        .arg(uMs / 3600000)
+        .arg(uMs / 60000 % 60, 2, 10, QChar('0'))
+        .arg(uMs / 1000 % 60, 2, 10, QChar('0'))
+        .arg(uMs % 1000, 3, 10, QChar('0'));
+}
+
+//
+// CBitrateTimeline::ParseTime
+//
+// Parses [[h:]m:]s[.fraction] to ticks of PCR clock. Returns false if the
+// time is wrong.
+bool CBitrateTimeline::ParseTime(const QString& szTime, uint64_t* puTime)
+{
+    QStringList parts = szTime.trimmed().split(':');
+    if (parts.isEmpty() || parts.size() > 3)
+        return false;
+
+    double dSeconds = 0;
+    for (int i = 0; i < parts.size(); i++) {
+        bool fOk = false;
+        double dValue = parts[i].toDouble(&fOk);
+        if (!fOk || dValue < 0 || (i + 1 < parts.size() && dValue != (uint64_t)dValue))
+            // only seconds may have a fraction
+            return false;
+
+        dSeconds = dSeconds * 60 + dValue;
+    }
+
+    *puTime = (uint64_t)(dSeconds * CPacket::PCR_CLOCK);
+    return true;
+}
+
+void CBitrateTimeline::paintEvent(QPaintEvent* /* pEvent */)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+
+    int iWidth = width();
+    int iHeight = height() - LABELS_HEIGHT;
+    if (m_Points.empty() || m_uDuration == 0 || iWidth <= 0 || iHeight <= 0) {
+        painter.setPen(palette().color(QPalette::Text));
+        painter.drawText(rect(), Qt::AlignCenter, "Bitrate is unknown: there are no PCRs");
+        return;
+    }
+
+    auto getX = [&](uint64_t uTime) { return (int)((double)uTime * (iWidth - 1) / m_uDuration); };
+    auto getY = [&](uint64_t uBitrate) { return iHeight - 1 - (int)((double)uBitrate * (iHeight - 1) / m_uMaxBitrate); };
+
+    // each point holds its bitrate up to the next one
+    painter.setPen(palette().color(QPalette::Highlight));
+    for (size_t i = 0; i < m_Points.size(); i++) {
+        int x1 = getX(m_Points[i].uTime);
+        int x2 = getX((i + 1 < m_Points.size()) ? m_Points[i + 1].uTime : m_uDuration);
+        int y = getY(m_Points[i].uBitrate);
+
+        painter.drawLine(x1, y, x2, y);
+        if (i + 1 < m_Points.size())
+            painter.drawLine(x2, y, x2, getY(m_Points[i + 1].uBitrate));
+    }
+
+    if (m_uMarker != UINT64_MAX) {
+        painter.setPen(Qt::red);
+        int x = getX(std::min(m_uMarker, m_uDuration));
+        painter.drawLine(x, 0, x, iHeight - 1);
+    }
+
+    painter.setPen(palette().color(QPalette::Text));
+    painter.drawText(4, painter.fontMetrics().ascent() + 2, QString("%1 kbit/s").arg(m_uMaxBitrate / 1000.0, 0, 'f', 1));
+    painter.drawText(QRect(0, iHeight, iWidth, LABELS_HEIGHT), Qt::AlignLeft | Qt::AlignVCenter, FormatTime(0));
+    painter.drawText(QRect(0, iHeight, iWidth, LABELS_HEIGHT), Qt::AlignRight | Qt::AlignVCenter, FormatTime(m_uDuration));
+}
+
+void CBitrateTimeline::mousePressEvent(QMouseEvent* pEvent)
+{
+    if (m_uDuration == 0 || width() <= 1)
+        return;
+
+    int x = std::max(0, std::min(pEvent->pos().x(), width() - 1));
+    emit TimeClicked((uint64_t)((double)x * m_uDuration / (width() - 1)));
+}
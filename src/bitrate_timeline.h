@@ -0,0 +1,57 @@
+/*******************************************************************************
+ * File: BitrateTimeline.h
+ *
+ * Description:
+ *    CBitrateTimeline class definition. This widget draws the bitrate of TS
+ *    over the time of the file, as the PCR index says (see
+ *    CTSIndex::GetPCRIndex), and marks the time of the shown PM Section. A
+ *    click on the graph reports the time under the cursor.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _BITRATE_TIMELINE_H_
+#define _BITRATE_TIMELINE_H_
+
+#include <QString>
+#include <QWidget>
+#include <cstdint>
+#include <vector>
+
+#include "ts_index.h"
+
+class CBitrateTimeline : public QWidget {
+    Q_OBJECT
+
+public:
+    CBitrateTimeline(QWidget* parent = nullptr);
+
+    void SetPCRIndex(const std::vector<PCR_INDEX_ENTRY>& entries);
+    void SetMarker(uint64_t uTime);
+    void Clear(void);
+
+    static QString FormatTime(uint64_t uTime);
+    static bool ParseTime(const QString& szTime, uint64_t* puTime);
+
+signals:
+    void TimeClicked(uint64_t uTime);
+
+protected:
+    void paintEvent(QPaintEvent* pEvent) override;
+    void mousePressEvent(QMouseEvent* pEvent) override;
+
+private:
+    // bitrate of TS from uTime up to the time of the next point
+    struct POINT {
+        uint64_t uTime;
+        uint64_t uBitrate;
+    };
+
+    std::vector<POINT> m_Points;
+    uint64_t m_uDuration = 0; // time of the last PCR
+    uint64_t m_uMaxBitrate = 0;
+    uint64_t m_uMarker = UINT64_MAX; // UINT64_MAX if nothing is marked
+};
+
+#endif // _BITRATE_TIMELINE_H_
@@ -0,0 +1,203 @@
+/*******************************************************************************
+ * File: CRC32.cpp
+ *
+ * Description: CCRC32 class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "crc32.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_HAVE_CLMUL
+#define CRC32_CLMUL_TARGET __attribute__((target("pclmul,ssse3")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define CRC32_HAVE_CLMUL
+#define CRC32_CLMUL_TARGET
+#include <intrin.h>
+#endif
+
+static const uint32_t POLYNOMIAL = 0x04C11DB7;
+
+//
+// Slicing-by-8 tables. Table[0] is the usual byte-wise table; Table[k][i] is
+// CRC of byte i followed by k zero bytes.
+//
+struct CRC32_TABLES {
+    CRC32_TABLES(void)
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t uCRC = i << 24;
+            for (int j = 0; j < 8; j++)
+                uCRC = (uCRC & 0x80000000) ? ((uCRC << 1) ^ POLYNOMIAL) : (uCRC << 1);
+
+            Table[0][i] = uCRC;
+        }
+
+        for (int k = 1; k < 8; k++)
+            for (uint32_t i = 0; i < 256; i++)
+                Table[k][i] = (Table[k - 1][i] << 8) ^ Table[0][Table[k - 1][i] >> 24];
+    }
+
+    uint32_t Table[8][256];
+};
+
+static const CRC32_TABLES& GetTables(void)
+{
+    static const CRC32_TABLES tables;
+    return tables;
+}
+
+static inline uint32_t ReadBE32(const uint8_t* pb)
+{
+    return (((uint32_t)pb[0] << 24) | ((uint32_t)pb[1] << 16) | ((uint32_t)pb[2] << 8) | ((uint32_t)pb[3]));
+}
+
+//
+// CCRC32::CalcTable
+//
+// Calculates CRC with slicing-by-8 tables. uCRC is the initial value or the
+// result of previous call for the preceding data.
+uint32_t CCRC32::CalcTable(const uint8_t* pb, size_t uSize, uint32_t uCRC)
+{
+    const uint32_t (*T)[256] = GetTables().Table;
+
+    for (; uSize >= 8; pb += 8, uSize -= 8) {
+        uint32_t a = uCRC ^ ReadBE32(pb);
+        uint32_t b = ReadBE32(pb + 4);
+
+        uCRC = T[7][a >> 24] ^ T[6][(a >> 16) & 0xFF] ^ T[5][(a >> 8) & 0xFF] ^ T[4][a & 0xFF]
+            ^ T[3][b >> 24] ^ T[2][(b >> 16) & 0xFF] ^ T[1][(b >> 8) & 0xFF] ^ T[0][b & 0xFF];
+    }
+
+    for (; uSize != 0; pb++, uSize--)
+        uCRC = (uCRC << 8) ^ T[0][(uCRC >> 24) ^ *pb];
+
+    return uCRC;
+}
+
+#ifdef CRC32_HAVE_CLMUL
+
+// Constants x^k mod P for folding 128-bit blocks: a block A = A1 * x^64 + A0
+// moved forward by N bits is A1 * (x^(N+64) mod P) + A0 * (x^N mod P).
+static const uint64_t X576 = 0x8833794C; // fold by 512 bits (4 blocks)
+static const uint64_t X512 = 0xE6228B11;
+static const uint64_t X192 = 0xC5B9CD4C; // fold by 128 bits (1 block)
+static const uint64_t X128 = 0xE8A45605;
+
+CRC32_CLMUL_TARGET static inline __m128i Fold(__m128i x, __m128i k)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00));
+}
+
+//
+// CalcCLMULBlocks
+//
+// Folds whole 16-byte blocks of data (at least 4 of them) into one block and
+// finishes the CRC of it with the tables. The rest of the data (less than 16
+// bytes) is left to the caller.
+CRC32_CLMUL_TARGET static uint32_t CalcCLMULBlocks(const uint8_t*& pb, size_t& uSize, uint32_t uCRC)
+{
+    // the polynomial is not reflected, so bytes are reversed to put the first
+    // bit of a block into the highest bit of the register
+    const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k4 = _mm_set_epi64x((long long)X576, (long long)X512);
+    const __m128i k1 = _mm_set_epi64x((long long)X192, (long long)X128);
+
+    const __m128i* p = (const __m128i*)pb;
+    __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128(p + 0), mask);
+    __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128(p + 1), mask);
+    __m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128(p + 2), mask);
+    __m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128(p + 3), mask);
+    x0 = _mm_xor_si128(x0, _mm_set_epi32((int)uCRC, 0, 0, 0));
+    p += 4;
+    uSize -= 64;
+
+    for (; uSize >= 64; p += 4, uSize -= 64) {
+        x0 = _mm_xor_si128(Fold(x0, k4), _mm_shuffle_epi8(_mm_loadu_si128(p + 0), mask));
+        x1 = _mm_xor_si128(Fold(x1, k4), _mm_shuffle_epi8(_mm_loadu_si128(p + 1), mask));
+        x2 = _mm_xor_si128(Fold(x2, k4), _mm_shuffle_epi8(_mm_loadu_si128(p + 2), mask));
+        x3 = _mm_xor_si128(Fold(x3, k4), _mm_shuffle_epi8(_mm_loadu_si128(p + 3), mask));
+    }
+
+    __m128i x = _mm_xor_si128(Fold(x0, k1), x1);
+    x = _mm_xor_si128(Fold(x, k1), x2);
+    x = _mm_xor_si128(Fold(x, k1), x3);
+
+    for (; uSize >= 16; p++, uSize -= 16)
+        x = _mm_xor_si128(Fold(x, k1), _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+
+    pb = (const uint8_t*)p;
+
+    // the folded block is congruent to all processed data, so its CRC with zero
+    // initial value is the CRC of the data
+    uint8_t bBlock[16];
+    _mm_storeu_si128((__m128i*)bBlock, _mm_shuffle_epi8(x, mask));
+    return CCRC32::CalcTable(bBlock, sizeof(bBlock), 0);
+}
+
+static bool DetectCLMUL(void)
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return ((info[2] & (1 << 1)) != 0 && (info[2] & (1 << 9)) != 0);
+#else
+    __builtin_cpu_init();
+    return (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"));
+#endif
+}
+
+#endif // CRC32_HAVE_CLMUL
+
+//
+// CCRC32::HasCLMUL
+//
+// Returns TRUE if the CPU supports carry-less multiplication used by
+// CalcCLMUL().
+bool CCRC32::HasCLMUL(void)
+{
+#ifdef CRC32_HAVE_CLMUL
+    static const bool fHasCLMUL = DetectCLMUL();
+    return fHasCLMUL;
+#else
+    return false;
+#endif
+}
+
+//
+// CCRC32::CalcCLMUL
+//
+// Calculates CRC by folding with carry-less multiplication. Falls back to
+// the tables if the CPU doesn't support it or the buffer is short.
+uint32_t CCRC32::CalcCLMUL(const uint8_t* pb, size_t uSize, uint32_t uCRC)
+{
+#ifdef CRC32_HAVE_CLMUL
+    if (uSize >= 64 && HasCLMUL())
+        uCRC = CalcCLMULBlocks(pb, uSize, uCRC);
+#endif
+
+    return CalcTable(pb, uSize, uCRC);
+}
+
+//
+// CCRC32::Calc
+//
+// Calculates CRC of the buffer with the fastest implementation available.
+uint32_t CCRC32::Calc(const uint8_t* pb, size_t uSize, uint32_t uCRC)
+{
+    // CalcCLMUL() itself falls back to the tables for short buffers
+    return CalcCLMUL(pb, uSize, uCRC);
+}
+
+//
+// CCRC32::Check
+//
+// Checks the section that ends with CRC_32 field: CRC of the whole section
+// including CRC_32 is zero if the section isn't corrupted.
+bool CCRC32::Check(const uint8_t* pbSection, size_t uSize)
+{
+    return (uSize >= 4 && Calc(pbSection, uSize) == 0);
+}
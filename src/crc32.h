@@ -0,0 +1,44 @@
+/*******************************************************************************
+ * File: CRC32.h
+ *
+ * Description:
+ *    CRC-32 used by PSI sections (polynomial 0x04C11DB7, initial value
+ *    0xFFFFFFFF, no reflection, no final XOR). See table B.1 in
+ *    ISO/IEC 13818-1 second edition (2000-12-01).
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include <cstddef>
+#include <cstdint>
+
+//
+// Class defined in this file
+//
+class CCRC32;
+
+//
+// Class definitions
+//
+
+// Calculates CRC-32/MPEG-2. Data is processed 8 bytes per step with
+// slicing-by-8 tables; on x86 CPUs with PCLMULQDQ long buffers are folded by
+// carry-less multiplication. The implementation is chosen once at runtime.
+class CCRC32 {
+public:
+    static const uint32_t INITIAL_VALUE = 0xFFFFFFFF;
+
+public:
+    static uint32_t Calc(const uint8_t* pb, size_t uSize, uint32_t uCRC = INITIAL_VALUE);
+    static bool Check(const uint8_t* pbSection, size_t uSize);
+
+    static uint32_t CalcTable(const uint8_t* pb, size_t uSize, uint32_t uCRC = INITIAL_VALUE);
+    static uint32_t CalcCLMUL(const uint8_t* pb, size_t uSize, uint32_t uCRC = INITIAL_VALUE);
+    static bool HasCLMUL(void);
+};
+
+#endif // _CRC32_H_
@@ -0,0 +1,173 @@
+/*******************************************************************************
+ * File: IndexCache.cpp
+ *
+ * Description: CIndexCache class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "index_cache.h"
+#include "crc32.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+const size_t CIndexCache::CHECKED_SIZE;
+
+static const char SIDECAR_EXTENSION[] = ".pmtidx";
+static const char CACHE_DIR_NAME[] = "pmt-viewer-next";
+
+//
+// CalcCRC
+//
+// Returns CRC_32 of uSize bytes of the file starting at uOffset.
+static bool CalcCRC(const CTSFile& file, uint64_t uOffset, size_t uSize, uint32_t* puCRC)
+{
+    std::vector<uint8_t> buffer(file.IsMapped() ? 0 : uSize);
+
+    size_t uRead = uSize;
+    const uint8_t* pb = file.Read(uOffset, uRead, buffer.data());
+    if (pb == NULL || uRead != uSize)
+        return false;
+
+    *puCRC = CCRC32::Calc(pb, uSize);
+    return true;
+}
+
+static bool MakeDir(const std::string& szDirName)
+{
+#ifdef _WIN32
+    _mkdir(szDirName.c_str());
+    struct _stat64 st;
+    return (_stat64(szDirName.c_str(), &st) == 0 && (st.st_mode & _S_IFDIR) != 0);
+#else
+    mkdir(szDirName.c_str(), 0700);
+    struct stat st;
+    return (stat(szDirName.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+#endif
+}
+
+//
+// CIndexCache::GetKey
+//
+// Fills INDEX_KEY for the opened file. Returns false if the index of the file
+// shouldn't be saved: it isn't a regular file (e.g. a pipe) or it's empty.
+bool CIndexCache::GetKey(const std::string& szFileName, const CTSFile& file, INDEX_KEY* pKey)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(szFileName.c_str(), &st) != 0 || (st.st_mode & _S_IFREG) == 0)
+        return false;
+
+    pKey->iModificationTime = (int64_t)st.st_mtime * 1000000000;
+#else
+    struct stat st;
+    if (stat(szFileName.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+#ifdef __APPLE__
+    pKey->iModificationTime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    pKey->iModificationTime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+
+    pKey->uFileSize = (uint64_t)st.st_size;
+    if (pKey->uFileSize == 0 || pKey->uFileSize != file.GetSize())
+        return false;
+
+    // modification time may be kept by copying tools, so the data is checked too
+    size_t uSize = (size_t)std::min<uint64_t>(pKey->uFileSize, CHECKED_SIZE);
+    return CalcCRC(file, 0, uSize, &pKey->uHeadCRC)
+        && CalcCRC(file, pKey->uFileSize - uSize, uSize, &pKey->uTailCRC);
+}
+
+//
+// CIndexCache::Load
+//
+// Loads the saved index of szFileName, the one next to the file first.
+bool CIndexCache::Load(const std::string& szFileName, const INDEX_KEY& key, CTSIndex* pIndex)
+{
+    if (pIndex->Load(GetSidecarName(szFileName), key))
+        return true;
+
+    std::string szCacheName = GetCacheName(szFileName, false);
+    return (!szCacheName.empty() && pIndex->Load(szCacheName, key));
+}
+
+//
+// CIndexCache::Save
+//
+// Saves the complete index of szFileName next to the file or, if it's
+// impossible, in the cache directory.
+bool CIndexCache::Save(const std::string& szFileName, const INDEX_KEY& key, const CTSIndex& index)
+{
+    if (index.Save(GetSidecarName(szFileName), key))
+        return true;
+
+    std::string szCacheName = GetCacheName(szFileName, true);
+    return (!szCacheName.empty() && index.Save(szCacheName, key));
+}
+
+std::string CIndexCache::GetSidecarName(const std::string& szFileName)
+{
+    return szFileName + SIDECAR_EXTENSION;
+}
+
+//
+// CIndexCache::GetCacheName
+//
+// Returns the name of the saved index in the cache directory
+// ($XDG_CACHE_HOME or ~/.cache, %LOCALAPPDATA% on Windows); files are told
+// apart by CRC_32 of their names. Returns empty string if there's no cache
+// directory; if fCreateDir is true, the directory is created when needed.
+std::string CIndexCache::GetCacheName(const std::string& szFileName, bool fCreateDir)
+{
+    std::string szDirName;
+
+#ifdef _WIN32
+    const char* pszDir = std::getenv("LOCALAPPDATA");
+    if (pszDir == NULL || *pszDir == '\0')
+        return "";
+
+    szDirName = std::string(pszDir) + "\\" + CACHE_DIR_NAME;
+#else
+    const char* pszDir = std::getenv("XDG_CACHE_HOME");
+    if (pszDir != NULL && *pszDir == '/') {
+        szDirName = pszDir;
+    } else {
+        const char* pszHome = std::getenv("HOME");
+        if (pszHome == NULL || *pszHome == '\0')
+            return "";
+
+        szDirName = std::string(pszHome) + "/.cache";
+    }
+
+    if (fCreateDir && !MakeDir(szDirName))
+        return "";
+
+    szDirName += std::string("/") + CACHE_DIR_NAME;
+#endif
+
+    if (fCreateDir && !MakeDir(szDirName))
+        return "";
+
+    char szName[16];
+    snprintf(szName, sizeof(szName), "%08x", CCRC32::Calc((const uint8_t*)szFileName.data(), szFileName.size()));
+
+#ifdef _WIN32
+    return szDirName + "\\" + szName + SIDECAR_EXTENSION;
+#else
+    return szDirName + "/" + szName + SIDECAR_EXTENSION;
+#endif
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+ * File: IndexCache.h
+ *
+ * Description:
+ *    CIndexCache class definition. This class keeps the index of a file
+ *    (see CTSIndex::Save) between runs, so a file that was opened before is
+ *    shown without scanning it again. The index is saved next to the file
+ *    (<file>.pmtidx) or, if that directory isn't writable, in the user's
+ *    cache directory. A saved index is used only while size, modification
+ *    time and the data at both ends of the file are the same; otherwise the
+ *    file is indexed again and the saved index is replaced.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _INDEX_CACHE_H_
+#define _INDEX_CACHE_H_
+
+#include <string>
+
+#include "ts_file.h"
+#include "ts_index.h"
+
+//
+// Class defined in this file
+//
+class CIndexCache;
+
+//
+// Class definitions
+//
+
+class CIndexCache {
+public:
+    // constants
+    static const size_t CHECKED_SIZE = 64 * 1024; // bytes at each end of file that make INDEX_KEY
+
+public:
+    static bool GetKey(const std::string& szFileName, const CTSFile& file, INDEX_KEY* pKey);
+
+    static bool Load(const std::string& szFileName, const INDEX_KEY& key, CTSIndex* pIndex);
+    static bool Save(const std::string& szFileName, const INDEX_KEY& key, const CTSIndex& index);
+
+private:
+    static std::string GetSidecarName(const std::string& szFileName);
+    static std::string GetCacheName(const std::string& szFileName, bool fCreateDir);
+};
+
+#endif // _INDEX_CACHE_H_
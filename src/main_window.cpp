@@ -8,11 +8,29 @@
  *******************************************************************************/
 
 #include "main_window.h"
+#include "bitrate_timeline.h"
+#include "ts_sync.h"
 #include "src/ui/ui_main_window.h"
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
 #include <QMessageBox>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <sstream>
 
+// period of checking the size of followed file, in milliseconds
+static const int FOLLOW_INTERVAL = 1000;
+
+// errors listed at once from the one that is found
+static const uint64_t MAX_LISTED_ERRORS = 1000;
+
+// changes of programs listed at once
+static const uint64_t MAX_LISTED_CHANGES = 10000;
+
 Dialog::Dialog(QWidget* parent)
     : QDialog(parent)
     , ui(new Ui::Dialog)
@@ -20,17 +38,67 @@ Dialog::Dialog(QWidget* parent)
     ui->setupUi(this);
 
     connect(ui->openFile, &QPushButton::clicked, this, &Dialog::OpenFile);
+    connect(ui->cancelIndex, &QPushButton::clicked, this, &Dialog::CancelIndexing);
+    connect(ui->followFile, &QCheckBox::toggled, this, &Dialog::FollowFile);
+
+    m_pFileWatcher = new QFileSystemWatcher(this);
+    connect(m_pFileWatcher, &QFileSystemWatcher::fileChanged, this, &Dialog::CheckFileGrowth);
+
+    m_pFollowTimer = new QTimer(this);
+    m_pFollowTimer->setInterval(FOLLOW_INTERVAL);
+    connect(m_pFollowTimer, &QTimer::timeout, this, &Dialog::CheckFileGrowth);
 
     connect(ui->showFirst, &QPushButton::clicked, this, [this]() { PMSNavigate(s_TS, first); });
     connect(ui->showPrev, &QPushButton::clicked, this, [this]() { PMSNavigate(s_TS, prev); });
     connect(ui->showNext, &QPushButton::clicked, this, [this]() { PMSNavigate(s_TS, next); });
     connect(ui->showLast, &QPushButton::clicked, this, [this]() { PMSNavigate(s_TS, last); });
+    connect(ui->showPrevChange, &QPushButton::clicked, this, [this]() { PMSNavigate(s_TS, prevChange); });
+    connect(ui->showNextChange, &QPushButton::clicked, this, [this]() { PMSNavigate(s_TS, nextChange); });
+    connect(ui->goToPMS, &QPushButton::clicked, this, [this]() { PMSNavigate(s_TS, goTo); });
+    connect(ui->pmsNumber, &QSpinBox::editingFinished, this, [this]() { PMSNavigate(s_TS, goTo); });
+    connect(ui->programFilter, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, [this](int iIndex) {
+        // the list is cleared and filled again when a file is opened
+        if (iIndex < 0)
+            return;
+
+        PMSNavigate(s_TS, filterProgram);
+        UpdateNavigation();
+        ShowChanges();
+    });
+
+    ui->errorType->addItem("All errors", -1);
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++)
+        ui->errorType->addItem(CTSChecker::GetTypeName(i), i);
+
+    connect(ui->errorType, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, [this]() { ListErrors(); });
+    connect(ui->findError, &QPushButton::clicked, this, &Dialog::ListErrors);
+    connect(ui->errorPacket, &QSpinBox::editingFinished, this, &Dialog::ListErrors);
+
+    connect(ui->changesList, &QTreeWidget::itemDoubleClicked, this, [this](QTreeWidgetItem* pItem) {
+        PMSNavigate(s_TS, goToNumber, pItem->data(0, Qt::UserRole).toULongLong());
+        ui->tabs->setCurrentWidget(ui->pmsTab);
+    });
+
+    auto goToTime = [this]() {
+        uint64_t uTime = 0;
+        if (!CBitrateTimeline::ParseTime(ui->seekTime->text(), &uTime)) {
+            QMessageBox::warning(this, QString(), "Time must be h:mm:ss.mmm, m:ss or seconds.");
+            return;
+        }
+
+        GoToTime(uTime);
+        ui->tabs->setCurrentWidget(ui->pmsTab);
+    };
+    connect(ui->goToTime, &QPushButton::clicked, this, goToTime);
+    connect(ui->seekTime, &QLineEdit::returnPressed, this, goToTime);
+    connect(ui->bitrateTimeline, &CBitrateTimeline::TimeClicked, this, &Dialog::GoToTime);
 
     ResetAllControls();
 }
 
 Dialog::~Dialog()
 {
+    StopIndexing();
     delete ui;
 }
 
@@ -45,113 +113,433 @@ void Dialog::OpenFile()
         "All files (*.*)");
 
     if (!szFileName.isEmpty()) {
+        StopIndexing();
         s_TS.Close();
         ResetAllControls();
+        UpdateFollowing();
 
-        if (!s_TS.Open(szFileName.toStdString())) {
+        if (!s_TS.Open(szFileName.toStdString(), false)) {
             // file not opened
-            QMessageBox::warning(this, QString(), "File not opened.");
+            if (errno == ESPIPE)
+                QMessageBox::warning(this, QString(),
+                    "File not opened: it's a pipe or a device that can be read only forward. Use pmt-scan to read it.");
+            else
+                QMessageBox::warning(this, QString(), "File not opened.");
             return;
         }
 
-        if (!s_TS.IsMPEG2TS()) {
-            // file is not a MPEG-2 Transport Stream; so close it
-            QMessageBox::warning(this, QString(),
-                "File is not MPEG-2 Transport Stream or some packets are incorrect. File will be closed.");
-            s_TS.Close();
+        ui->filename->setText(QString(s_TS.GetFileName().c_str()));
+
+        // the file is validated and indexed in other thread; PM Sections are
+        // shown as soon as they are found
+        StartIndexing();
+    }
+}
+
+void Dialog::CancelIndexing()
+{
+    m_fCancelIndex = true;
+    ui->cancelIndex->setEnabled(false);
+}
+
+//
+// FollowFile
+//
+// Turns follow mode on or off. In follow mode the data appended to the file
+// (e.g. by a recorder) is indexed as soon as it's written.
+void Dialog::FollowFile(bool fFollow)
+{
+    UpdateFollowing();
+
+    if (fFollow)
+        CheckFileGrowth();
+}
+
+//
+// CheckFileGrowth
+//
+// Starts indexing of the appended data if the followed file became larger.
+// The size is compared without touching the index, so the check is cheap.
+void Dialog::CheckFileGrowth()
+{
+    if (!ui->followFile->isChecked() || m_pIndexThread != nullptr || !CanFollow())
+        return;
+
+    QFileInfo info(QString(s_TS.GetFileName().c_str()));
+    if ((uint64_t)info.size() != s_TS.GetFileSize())
+        StartIndexing(true);
+}
+
+//
+// UpdateFollowing
+//
+// Watches the opened file while follow mode is on and the file is indexed.
+void Dialog::UpdateFollowing()
+{
+    bool fFollow = ui->followFile->isChecked() && CanFollow();
+
+    if (!m_pFileWatcher->files().isEmpty())
+        m_pFileWatcher->removePaths(m_pFileWatcher->files());
+
+    if (fFollow) {
+        m_pFileWatcher->addPath(QString(s_TS.GetFileName().c_str()));
+        m_pFollowTimer->start();
+    } else {
+        m_pFollowTimer->stop();
+    }
+}
+
+//
+// CanFollow
+//
+// The opened file can be followed if it's indexed completely. A file where no
+// packets are found yet is followed too: it may be just created by the
+// recorder, so it's indexed again as soon as it grows (see CTSIndex::Update).
+bool Dialog::CanFollow()
+{
+    return !s_TS.GetFileName().empty()
+        && (s_TS.IsIndexComplete() || (!s_TS.IsMPEG2TS() && s_TS.GetFileSize() < CTSSync::SYNC_SEARCH_LIMIT));
+}
+
+//
+// StartIndexing
+//
+// Builds the index of opened file in other thread. The thread reports progress
+// and completion through the event loop.
+//
+// If fUpdate is true, only the data appended to the file since the last pass
+// is indexed (follow mode); progress isn't shown then, it's usually a moment.
+void Dialog::StartIndexing(bool fUpdate /* = false */)
+{
+    unsigned int uGeneration = ++m_uIndexGeneration;
+    m_fCancelIndex = false;
+
+    if (!fUpdate) {
+        ui->indexProgress->setValue(0);
+        ui->indexProgress->setVisible(true);
+        ui->indexStatus->setText("Indexing...");
+        ui->cancelIndex->setVisible(true);
+        ui->cancelIndex->setEnabled(true);
+    }
+
+    m_IndexTimer.start();
+
+    m_pIndexThread = QThread::create([this, uGeneration, fUpdate]() {
+        if (fUpdate) {
+            bool fResult = s_TS.UpdateIndex([this](uint64_t, uint64_t) { return !m_fCancelIndex; });
+
+            QMetaObject::invokeMethod(
+                this, [this, uGeneration, fResult]() {
+                    if (uGeneration == m_uIndexGeneration)
+                        IndexUpdated(fResult);
+                },
+                Qt::QueuedConnection);
             return;
         }
 
-        if (!s_TS.GetPMSCount()) {
-            // there is no PM Sections in file
-            QMessageBox::warning(this, QString(),
-                "File doesn't contains Program Map Sections and will be closed.");
-            s_TS.Close();
+        s_TS.BuildIndex([this, uGeneration](uint64_t uBytes, uint64_t uPMSCount) {
+            QMetaObject::invokeMethod(
+                this, [this, uGeneration, uBytes, uPMSCount]() {
+                    if (uGeneration == m_uIndexGeneration)
+                        IndexProgress(uBytes, uPMSCount);
+                },
+                Qt::QueuedConnection);
+
+            return !m_fCancelIndex;
+        });
+
+        QMetaObject::invokeMethod(
+            this, [this, uGeneration]() {
+                if (uGeneration == m_uIndexGeneration)
+                    IndexFinished();
+            },
+            Qt::QueuedConnection);
+    });
+
+    m_pIndexThread->start();
+}
+
+//
+// StopIndexing
+//
+// Cancels indexing (if it's running) and waits for the thread.
+void Dialog::StopIndexing()
+{
+    if (m_pIndexThread == nullptr)
+        return;
+
+    m_fCancelIndex = true;
+    m_pIndexThread->wait();
+
+    delete m_pIndexThread;
+    m_pIndexThread = nullptr;
+
+    // ignore notifications that are still in the event queue
+    m_uIndexGeneration++;
+}
+
+void Dialog::IndexProgress(uint64_t uBytes, uint64_t uPMSCount)
+{
+    uint64_t uSize = s_TS.GetFileSize();
+    if (uSize != 0)
+        ui->indexProgress->setValue((int)(uBytes * 100 / uSize));
+
+    double dSeconds = m_IndexTimer.elapsed() / 1000.0;
+    double dSpeed = (dSeconds > 0) ? uBytes / dSeconds / (1024 * 1024) : 0;
+
+    ui->indexStatus->setText(QString("Indexing: %1 MB/s, %2 PM Sections found")
+                                 .arg(dSpeed, 0, 'f', 1)
+                                 .arg(uPMSCount));
+
+    ShowPrograms();
+
+    if (m_uCurPMS == 0 && uPMSCount != 0)
+        // the first PM Section is found, show it
+        PMSNavigate(s_TS, first);
+    else
+        UpdateNavigation();
+}
+
+void Dialog::IndexFinished()
+{
+    bool fCanceled = m_fCancelIndex;
+
+    m_pIndexThread->wait();
+    delete m_pIndexThread;
+    m_pIndexThread = nullptr;
+
+    ui->indexProgress->setVisible(false);
+    ui->cancelIndex->setVisible(false);
+
+    // packets are searched only at the beginning of file, so a longer file
+    // without them can't become TS however it grows
+    bool fCanBecomeTS = s_TS.IsMPEG2TS() || s_TS.GetFileSize() < CTSSync::SYNC_SEARCH_LIMIT;
+    if (!fCanceled && ui->followFile->isChecked() && fCanBecomeTS && !s_TS.GetPMSCount()) {
+        // the followed file may be just created: keep it open until PM
+        // Sections are written to it
+        ui->indexStatus->setText("No PM Sections yet, following the file");
+        ShowStatistics();
+        UpdateFollowing();
+        return;
+    }
+
+    if (!fCanceled && !s_TS.IsMPEG2TS()) {
+        // file is not a MPEG-2 Transport Stream; so close it
+        QMessageBox::warning(this, QString(),
+            "File is not MPEG-2 Transport Stream or some packets are incorrect. File will be closed.");
+        s_TS.Close();
+        ResetAllControls();
+        return;
+    }
+
+    if (!s_TS.GetPMSCount()) {
+        // there is no PM Sections in file
+        QMessageBox::warning(this, QString(),
+            fCanceled ? "Indexing is canceled before any Program Map Section was found. File will be closed."
+                      : "File doesn't contains Program Map Sections and will be closed.");
+        s_TS.Close();
+        ResetAllControls();
+        return;
+    }
+
+    double dSeconds = m_IndexTimer.elapsed() / 1000.0;
+    QString szStatus;
+    if (s_TS.IsIndexLoaded())
+        szStatus = QString("%1 PM Sections, index loaded from saved one").arg(s_TS.GetPMSCount());
+    else
+        szStatus = QString(fCanceled ? "Indexing canceled: %1 PM Sections indexed" : "%1 PM Sections indexed in %2 s")
+                       .arg(s_TS.GetPMSCount())
+                       .arg(dSeconds, 0, 'f', 1);
+    if (s_TS.GetPacketSize() != CPacket::PACKET_SIZE)
+        // M2TS or TS with Reed-Solomon parity
+        szStatus += QString(", %1-byte packets").arg(s_TS.GetPacketSize());
+    ui->indexStatus->setText(szStatus);
+
+    ShowPrograms();
+
+    if (m_uCurPMS == 0)
+        PMSNavigate(s_TS, first);
+    else
+        UpdateNavigation();
+
+    ShowStatistics();
+    ShowErrors();
+    ShowChanges();
+    ShowTimeline();
+    UpdateFollowing();
+}
+
+//
+// IndexUpdated
+//
+// Called when the data appended to the followed file is indexed: the count of
+// PM Sections and navigation buttons are updated. A file that became smaller
+// (it's truncated or replaced by the recorder) is opened and indexed again.
+void Dialog::IndexUpdated(bool fResult)
+{
+    bool fCanceled = m_fCancelIndex;
+
+    m_pIndexThread->wait();
+    delete m_pIndexThread;
+    m_pIndexThread = nullptr;
+
+    if (!fResult && !fCanceled) {
+        std::string szFileName = s_TS.GetFileName();
+
+        s_TS.Close();
+        ResetAllControls();
+        UpdateFollowing();
+
+        if (!s_TS.Open(szFileName, false)) {
+            QMessageBox::warning(this, QString(), "File not opened.");
             return;
         }
 
         ui->filename->setText(QString(s_TS.GetFileName().c_str()));
+        StartIndexing();
+        return;
+    }
 
+    ui->indexStatus->setText(QString("%1 PM Sections indexed, following the file").arg(s_TS.GetPMSCount()));
+
+    ShowPrograms();
+
+    if (m_uCurPMS == 0)
         PMSNavigate(s_TS, first);
-    }
+    else
+        UpdateNavigation();
+
+    ShowStatistics();
+    ShowErrors();
+    ShowChanges();
+    ShowTimeline();
 }
 
 //
 // PMSNavigate
 //
 // Movement beetween PM Sections in TS and enable or disable appropriate buttons.
-void Dialog::PMSNavigate(CTransportStream& TS, Navigation navigation)
+// goToPacket shows the last PM Section at zero-based packet uValue or before
+// it, goToNumber shows PM Section with one-based number uValue. filterProgram
+// applies the program chosen in the filter: the other navigation then walks
+// only PM Sections of that program.
+void Dialog::PMSNavigate(CTransportStream& TS, Navigation navigation, uint64_t uValue /* = 0 */)
 {
-    static uint32_t s_uCurPMS = 0; // current PMS number
-
-    uint32_t uPMS = 0;
+    uint64_t uPMS = 0;
+    uint64_t uNum = 0;
     PM_SECTION PMS;
 
     switch (navigation) {
     case first:
-        if (uint32_t uNum = TS.GetFirstPMSection(&PMS, &uPMS)) {
-            s_uCurPMS = 1;
-            ShowPMSInfo(&PMS, uPMS, uNum);
-        } else
-            return;
-
+        uNum = TS.GetFirstPMSection(&PMS, &uPMS);
         break;
 
     case last:
-        if (uint32_t uNum = TS.GetLastPMSection(&PMS, &uPMS)) {
-            s_uCurPMS = TS.GetPMSCount();
-            ShowPMSInfo(&PMS, uPMS, uNum);
-        } else
-            return;
-
+        uNum = TS.GetLastPMSection(&PMS, &uPMS);
         break;
 
     case prev:
-        if (uint32_t uNum = TS.GetPrevPMSection(&PMS, &uPMS)) {
-            s_uCurPMS--;
-            ShowPMSInfo(&PMS, uPMS, uNum);
-        } else
-            return;
-
+        uNum = TS.GetPrevPMSection(&PMS, &uPMS);
         break;
 
     case next:
-        if (uint32_t uNum = TS.GetNextPMSection(&PMS, &uPMS)) {
-            s_uCurPMS++;
-            ShowPMSInfo(&PMS, uPMS, uNum);
-        } else
-            return;
+        uNum = TS.GetNextPMSection(&PMS, &uPMS);
+        break;
 
+    case goTo:
+        uNum = TS.GoToPMSection(ui->pmsNumber->value(), &PMS, &uPMS);
+        break;
+
+    case goToPacket:
+        uNum = TS.GoToPacket(uValue, &PMS, &uPMS);
+        break;
+
+    case goToNumber:
+        uNum = TS.GoToPMSection(uValue, &PMS, &uPMS);
+        break;
+
+    case prevChange:
+        uNum = TS.GetPrevPMSChange(&PMS, &uPMS);
+        break;
+
+    case nextChange:
+        uNum = TS.GetNextPMSChange(&PMS, &uPMS);
+        break;
+
+    case filterProgram:
+        uNum = TS.SetProgramFilter(ui->programFilter->currentData().toInt(), &PMS, &uPMS);
         break;
 
     default:
         return;
     }
 
+    if (uNum == 0)
+        return;
+
+    m_uCurPMS = uPMS;
+    ShowPMSInfo(&PMS, uPMS, uNum);
+
+    UpdateNavigation();
+    ui->pmsNumber->setValue((int)m_uCurPMS);
+}
+
+//
+// UpdateNavigation
+//
+// Enable or disable navigation buttons according to the current PMS and the
+// count of PM Sections (of the filtered program); the count grows while the
+// file is being indexed.
+void Dialog::UpdateNavigation()
+{
+    uint64_t uCount = s_TS.GetPMSCount();
+
     bool fBtnFirst = true,
          fBtnPrev = true,
          fBtnNext = true,
          fBtnLast = true;
 
-    if (s_uCurPMS <= 1)
+    // a section of other program may be shown (e.g. chosen by its number),
+    // then it's unknown which way the filtered program is
+    uint64_t uPosCount = 0;
+    uint64_t uPos = s_TS.GetCurPMSPosition(&uPosCount);
+
+    if (m_uCurPMS == 0 || uPosCount == 0)
+        fBtnFirst = fBtnPrev = fBtnNext = fBtnLast = false;
+    if (uPos == 1)
         fBtnFirst = fBtnPrev = false;
-    if (s_uCurPMS >= TS.GetPMSCount())
+    if (uPos != 0 && uPos >= uPosCount)
         fBtnNext = fBtnLast = false;
 
     ui->showFirst->setEnabled(fBtnFirst);
     ui->showPrev->setEnabled(fBtnPrev);
     ui->showNext->setEnabled(fBtnNext);
     ui->showLast->setEnabled(fBtnLast);
+
+    // the changes of the shown program are found in the index by binary search
+    const CTSIndex& index = s_TS.GetIndex();
+    ui->showPrevChange->setEnabled(m_uCurPMS != 0 && index.FindPrevPMSChange(m_uCurPMS - 1) != UINT64_MAX);
+    ui->showNextChange->setEnabled(m_uCurPMS != 0 && index.FindNextPMSChange(m_uCurPMS - 1) != UINT64_MAX);
+
+    // the widest QSpinBox range is int; larger numbers are unreachable from it
+    ui->pmsNumber->setRange(1, (int)std::max<uint64_t>(1, std::min<uint64_t>(uCount, INT_MAX)));
+    ui->pmsNumber->setEnabled(uCount != 0);
+    ui->goToPMS->setEnabled(uCount != 0);
 }
 
 //
 // ShowPMSInfo
 //
-void Dialog::ShowPMSInfo(const PM_SECTION* pPMS, uint32_t uPMSNum, uint32_t uPacketNum)
+void Dialog::ShowPMSInfo(const PM_SECTION* pPMS, uint64_t uPMSNum, uint64_t uPacketNum)
 {
     std::ostringstream ss;
     ss << "Program Map Section #" << uPMSNum << "(Packet #" << uPacketNum << ")";
 
+    uint64_t uCount = 0;
+    uint64_t uPos = s_TS.GetCurPMSPosition(&uCount);
+    if (s_TS.GetProgramFilter() >= 0 && uPos != 0)
+        ss << ", " << uPos << " of " << uCount << " of the program";
+
     ui->groupBox->setTitle(ss.str().c_str());
 
     ui->tableId->setNum(pPMS->table_id);
@@ -166,14 +554,33 @@ void Dialog::ShowPMSInfo(const PM_SECTION* pPMS, uint32_t uPMSNum, uint32_t uPac
     ui->programInfoLength->setNum(pPMS->program_info_length);
     ui->crc->setText(QString::number(pPMS->CRC_32));
 
+    // the time is by PCRs of the program; the timeline follows the program
+    uint64_t uTime = 0;
+    bool fTime = s_TS.GetIndex().GetPacketTime(uPacketNum - 1, &uTime, pPMS->PCR_PID);
+    if (fTime) {
+        ui->pmsTime->setText(CBitrateTimeline::FormatTime(uTime));
+        ui->seekTime->setText(CBitrateTimeline::FormatTime(uTime));
+    } else {
+        ui->pmsTime->setText("-");
+    }
+
+    if (pPMS->PCR_PID != m_uCurPCRPID) {
+        m_uCurPCRPID = pPMS->PCR_PID;
+        ShowTimeline();
+    }
+    ui->bitrateTimeline->SetMarker(fTime ? uTime : UINT64_MAX);
+
     // Fill the list box with the values of program descriptors
 
     ui->programDescriptors->clear();
 
-    for (Descriptors::const_iterator iter = pPMS->program_descriptors.begin(); iter != pPMS->program_descriptors.end(); iter++) {
+    Descriptors programDescriptors = pPMS->GetProgramDescriptors();
+    for (Descriptors::const_iterator iter = programDescriptors.begin(); iter != programDescriptors.end(); iter++) {
+        PCBYTE pbData = pPMS->GetDescriptorData(*iter);
+
         std::stringstream bytesSs;
         for (uint8_t i = 0; i < iter->length; i++) {
-            bytesSs << "0x" << std::hex << std::uppercase << iter->pbData[i];
+            bytesSs << "0x" << std::hex << std::uppercase << pbData[i];
         }
 
         ss << "{tag: " << iter->tag << "; length: " << iter->length << "; data: " << bytesSs.str() << "}";
@@ -185,16 +592,20 @@ void Dialog::ShowPMSInfo(const PM_SECTION* pPMS, uint32_t uPMSNum, uint32_t uPac
 
     ui->esDescriptors->clear();
 
-    for (PMTable::const_iterator iter = pPMS->m_PMT.begin(); iter != pPMS->m_PMT.end(); iter++) {
+    PMTable PMT = pPMS->GetPMT();
+    for (PMTable::const_iterator iter = PMT.begin(); iter != PMT.end(); iter++) {
         std::stringstream pmsSs;
         pmsSs << "{stream type: " << iter->stream_type << "; elementary PID: " << iter->elementary_PID << "; ES info length: " << iter->ES_info_length << "}";
 
         auto topLevelItem = new QTreeWidgetItem({ pmsSs.str().c_str() });
 
-        for (Descriptors::const_iterator descriptorsIter = iter->ES_descriptors.begin(); descriptorsIter != iter->ES_descriptors.end(); descriptorsIter++) {
+        Descriptors ESDescriptors = pPMS->GetESDescriptors(*iter);
+        for (Descriptors::const_iterator descriptorsIter = ESDescriptors.begin(); descriptorsIter != ESDescriptors.end(); descriptorsIter++) {
+            PCBYTE pbData = pPMS->GetDescriptorData(*descriptorsIter);
+
             std::stringstream bytesSs;
             for (uint8_t i = 0; i < descriptorsIter->length; i++) {
-                bytesSs << "0x" << std::hex << std::uppercase << descriptorsIter->pbData[i];
+                bytesSs << "0x" << std::hex << std::uppercase << pbData[i];
             }
 
             std::stringstream descriptorSs;
@@ -207,6 +618,222 @@ void Dialog::ShowPMSInfo(const PM_SECTION* pPMS, uint32_t uPMSNum, uint32_t uPac
     }
 }
 
+//
+// ShowPrograms
+//
+// Adds the programs met since the last call to the program filter. Programs
+// are listed in order they are met, so the ones listed before stay.
+void Dialog::ShowPrograms()
+{
+    std::vector<uint16_t> programs;
+    s_TS.GetIndex().GetProgramNumbers(&programs);
+
+    for (size_t i = (size_t)ui->programFilter->count() - 1; i < programs.size(); i++)
+        ui->programFilter->addItem(QString("Program %1").arg(programs[i]), programs[i]);
+
+    ui->programFilter->setEnabled(!programs.empty());
+}
+
+//
+// ShowStatistics
+//
+// Fills the statistics tab: packets and bitrates of each PID counted by the
+// indexing pass, null packets (PID 0x1FFF) included.
+void Dialog::ShowStatistics()
+{
+    const CTSIndex& index = s_TS.GetIndex();
+    uint64_t uPacketsCount = index.GetPacketsCount();
+    uint64_t uBitrate = index.GetBitrate();
+
+    if (uBitrate != 0)
+        ui->tsBitrate->setText(QString("%1 packets, TS bitrate %2 kbit/s (by PCR)").arg(uPacketsCount).arg(uBitrate / 1000.0, 0, 'f', 1));
+    else
+        ui->tsBitrate->setText(QString("%1 packets, TS bitrate is unknown: there are no PCRs").arg(uPacketsCount));
+
+    std::vector<PID_STATS> stats;
+    index.GetPIDStats(&stats);
+
+    ui->pidStats->clear();
+    for (size_t i = 0; i < stats.size(); i++) {
+        const PID_STATS& s = stats[i];
+
+        QString szPID = "0x" + QString("%1").arg(s.PID, 4, 16, QChar('0')).toUpper();
+        if (s.PID == CPacket::NULL_PACKET)
+            szPID += " (null)";
+
+        auto pItem = new QTreeWidgetItem({ szPID,
+            QString::number(s.uPacketsCount),
+            QString::number(s.uPacketsCount * 100.0 / uPacketsCount, 'f', 2),
+            (uBitrate != 0) ? QString::number(s.uBitrate / 1000.0, 'f', 1) : QString("-"),
+            (uBitrate != 0) ? QString::number(s.uPeakBitrate / 1000.0, 'f', 1) : QString("-") });
+
+        ui->pidStats->addTopLevelItem(pItem);
+    }
+}
+
+//
+// ShowErrors
+//
+// Fills the errors tab: the number of errors of each type found by the
+// indexing pass, then the list from the packet that is chosen. Timeouts
+// aren't checked without the bitrate, so their number is unknown then.
+void Dialog::ShowErrors()
+{
+    const CTSIndex& index = s_TS.GetIndex();
+    bool fBitrate = index.GetBitrate() != 0;
+
+    QString szSummary = QString("%1 errors").arg(index.GetErrorsCount());
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++) {
+        QString szCount = QString::number(index.GetErrorsCount(i));
+        if (!fBitrate && (i == TS_ERROR::patTimeout || i == TS_ERROR::pmtTimeout))
+            szCount = "unknown";
+        szSummary += QString(i == 0 ? ": %1 %2" : ", %1 %2").arg(CTSChecker::GetTypeName(i)).arg(szCount);
+    }
+    ui->errorsSummary->setText(szSummary);
+
+    // the widest QSpinBox range is int; larger numbers are unreachable from it
+    uint64_t uPacketsCount = index.GetPacketsCount();
+    ui->errorPacket->setRange(1, (int)std::max<uint64_t>(1, std::min<uint64_t>(uPacketsCount, INT_MAX)));
+    ui->errorPacket->setEnabled(uPacketsCount != 0);
+    ui->findError->setEnabled(uPacketsCount != 0);
+
+    ListErrors();
+}
+
+//
+// ListErrors
+//
+// Lists up to MAX_LISTED_ERRORS errors of the chosen type starting from the
+// first one at the chosen packet or after it; the index finds it by binary
+// search, so any place of a large file is listed at once.
+void Dialog::ListErrors()
+{
+    const CTSIndex& index = s_TS.GetIndex();
+    int iType = ui->errorType->currentData().toInt();
+
+    ui->errorsList->clear();
+
+    uint64_t uCount = index.GetKeptErrorsCount(iType);
+    uint64_t uListed = 0;
+    for (uint64_t i = index.FindError(ui->errorPacket->value() - 1, iType); i < uCount && uListed < MAX_LISTED_ERRORS; i++, uListed++) {
+        TS_ERROR error;
+        if (!index.GetError(i, &error, iType))
+            break;
+
+        QString szDetails;
+        switch (error.type) {
+        case TS_ERROR::syncLoss:
+            szDetails = QString("%1 bytes skipped").arg(error.uDetail);
+            break;
+
+        case TS_ERROR::patTimeout:
+        case TS_ERROR::pmtTimeout:
+            szDetails = QString("%1 ms without the table").arg(error.uDetail);
+            break;
+
+        case TS_ERROR::continuity:
+            szDetails = QString("expected %1, found %2").arg(error.uDetail >> 4).arg(error.uDetail & 0x0F);
+            break;
+        }
+
+        auto pItem = new QTreeWidgetItem({ QString::number(error.uPacketNum + 1),
+            QString::number(error.uOffset),
+            (error.type == TS_ERROR::syncLoss) ? QString("-") : "0x" + QString("%1").arg(error.PID, 4, 16, QChar('0')).toUpper(),
+            CTSChecker::GetTypeName(error.type),
+            szDetails });
+
+        ui->errorsList->addTopLevelItem(pItem);
+    }
+}
+
+//
+// ShowChanges
+//
+// Fills the changes tab: PM Sections where programs (or the filtered one)
+// change, without the sections that repeat them. Up to MAX_LISTED_CHANGES
+// ones are listed.
+void Dialog::ShowChanges()
+{
+    const CTSIndex& index = s_TS.GetIndex();
+    int iProgram = s_TS.GetProgramFilter();
+    uint64_t uCount = index.GetPMSChangesCount(iProgram);
+
+    QString szSummary = (iProgram < 0)
+        ? QString("%1 changes of programs in %2 PM Sections").arg(uCount).arg(index.GetPMSCount())
+        : QString("%1 changes of program %2 in its %3 PM Sections").arg(uCount).arg(iProgram).arg(index.GetProgramPMSCount((uint16_t)iProgram));
+    if (uCount > MAX_LISTED_CHANGES)
+        szSummary += QString(", the first %1 are listed").arg(MAX_LISTED_CHANGES);
+    ui->changesSummary->setText(szSummary);
+
+    ui->changesList->clear();
+    for (uint64_t i = 0; i < uCount && i < MAX_LISTED_CHANGES; i++) {
+        uint64_t uPMS = 0;
+        PMS_INDEX_ENTRY entry;
+        if (!index.GetPMSChange(i, &uPMS, iProgram) || !index.GetPMSection(uPMS, &entry))
+            break;
+
+        uint64_t uTime = 0;
+        bool fTime = index.GetPacketTime(entry.uPacketNum, &uTime);
+
+        auto pItem = new QTreeWidgetItem({ QString::number(uPMS + 1),
+            QString::number(entry.uPacketNum + 1),
+            fTime ? CBitrateTimeline::FormatTime(uTime) : QString("-"),
+            QString::number(entry.program_number),
+            "0x" + QString("%1").arg(entry.PID, 4, 16, QChar('0')).toUpper(),
+            QString::number(entry.version_number),
+            QString::number(entry.CRC_32) });
+        pItem->setData(0, Qt::UserRole, QVariant((qulonglong)(uPMS + 1)));
+
+        ui->changesList->addTopLevelItem(pItem);
+    }
+}
+
+//
+// ShowTimeline
+//
+// Draws the bitrate of TS by the PCR index of the shown program's PCR_PID
+// (or of the PID that measures the bitrate of TS if it has no PCRs).
+void Dialog::ShowTimeline()
+{
+    const CTSIndex& index = s_TS.GetIndex();
+
+    std::vector<PCR_INDEX_ENTRY> entries;
+    index.GetPCRIndex(m_uCurPCRPID, &entries);
+    ui->bitrateTimeline->SetPCRIndex(entries);
+
+    std::vector<uint16_t> PIDs;
+    index.GetPCRPIDs(&PIDs);
+
+    uint64_t uDuration = 0;
+    if (entries.empty()) {
+        ui->timelineSummary->setText("There are no PCRs, time is unknown");
+    } else if (index.GetPacketTime(index.GetPacketsCount(), &uDuration, m_uCurPCRPID)) {
+        QString szPID = (std::find(PIDs.begin(), PIDs.end(), m_uCurPCRPID) != PIDs.end())
+            ? QString("PCR PID 0x%1 of the shown program").arg(m_uCurPCRPID, 4, 16, QChar('0')).toUpper()
+            : QString("PCR PID that measures TS bitrate");
+        ui->timelineSummary->setText(QString("Duration %1 by %2; %3 PCR PIDs in TS")
+                                         .arg(CBitrateTimeline::FormatTime(uDuration))
+                                         .arg(szPID)
+                                         .arg(PIDs.size()));
+    }
+
+    ui->seekTime->setEnabled(!entries.empty());
+    ui->goToTime->setEnabled(!entries.empty());
+}
+
+//
+// GoToTime
+//
+// Shows the PM Section in effect at uTime, ticks of PCR clock from the
+// beginning of the file; the packet is found in the PCR index by binary
+// search.
+void Dialog::GoToTime(uint64_t uTime)
+{
+    uint64_t uPacketNum = 0;
+    if (s_TS.GetIndex().FindPacketByTime(uTime, &uPacketNum, m_uCurPCRPID))
+        PMSNavigate(s_TS, goToPacket, uPacketNum);
+}
+
 //
 // ResetAllControls
 //
@@ -229,12 +856,48 @@ void Dialog::ResetAllControls()
     ui->pcrPid->setText(sz);
     ui->programInfoLength->setText(sz);
     ui->crc->setText(sz);
+    ui->pmsTime->setText(sz);
 
     ui->programDescriptors->clear();
     ui->esDescriptors->clear();
 
+    ui->tsBitrate->clear();
+    ui->pidStats->clear();
+
+    ui->errorsSummary->clear();
+    ui->errorsList->clear();
+    ui->errorPacket->setValue(1);
+    ui->errorPacket->setEnabled(false);
+    ui->findError->setEnabled(false);
+
+    ui->changesSummary->clear();
+    ui->changesList->clear();
+
+    ui->timelineSummary->clear();
+    ui->bitrateTimeline->Clear();
+    ui->seekTime->clear();
+    ui->seekTime->setEnabled(false);
+    ui->goToTime->setEnabled(false);
+    m_uCurPCRPID = CPacket::NULL_PACKET;
+
     ui->showFirst->setEnabled(false);
     ui->showPrev->setEnabled(false);
     ui->showNext->setEnabled(false);
     ui->showLast->setEnabled(false);
+    ui->showPrevChange->setEnabled(false);
+    ui->showNextChange->setEnabled(false);
+
+    ui->programFilter->clear();
+    ui->programFilter->addItem("All programs", -1);
+    ui->programFilter->setEnabled(false);
+
+    ui->pmsNumber->setValue(1);
+    ui->pmsNumber->setEnabled(false);
+    ui->goToPMS->setEnabled(false);
+
+    m_uCurPMS = 0;
+
+    ui->indexProgress->setVisible(false);
+    ui->indexStatus->clear();
+    ui->cancelIndex->setVisible(false);
 }
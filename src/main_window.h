@@ -10,11 +10,16 @@
 
 #include "transport_stream.h"
 #include <QDialog>
+#include <QElapsedTimer>
+#include <atomic>
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
 class Dialog;
 }
+class QFileSystemWatcher;
+class QThread;
+class QTimer;
 QT_END_NAMESPACE
 
 class Dialog : public QDialog {
@@ -24,7 +29,13 @@ class Dialog : public QDialog {
         first,
         last,
         prev,
-        next
+        next,
+        goTo,
+        goToPacket,
+        goToNumber,
+        prevChange,
+        nextChange,
+        filterProgram
     };
 
 public:
@@ -33,14 +44,46 @@ public:
 
 private slots:
     void OpenFile();
+    void CancelIndexing();
+    void FollowFile(bool fFollow);
+    void CheckFileGrowth();
 
 private:
-    void PMSNavigate(CTransportStream& TS, Navigation navigation);
-    void ShowPMSInfo(const PM_SECTION* pPMS, uint32_t uPMSNum, uint32_t uPacketNum);
+    void StartIndexing(bool fUpdate = false);
+    void StopIndexing();
+    void IndexProgress(uint64_t uBytes, uint64_t uPMSCount);
+    void IndexFinished();
+    void IndexUpdated(bool fResult);
+    void UpdateFollowing();
+    bool CanFollow();
+
+    void PMSNavigate(CTransportStream& TS, Navigation navigation, uint64_t uValue = 0);
+    void UpdateNavigation();
+    void ShowPMSInfo(const PM_SECTION* pPMS, uint64_t uPMSNum, uint64_t uPacketNum);
+    void ShowPrograms();
+    void ShowStatistics();
+    void ShowErrors();
+    void ListErrors();
+    void ShowChanges();
+    void ShowTimeline();
+    void GoToTime(uint64_t uTime);
     void ResetAllControls();
 
 private:
     Ui::Dialog* ui;
 
     CTransportStream s_TS;
+    uint64_t m_uCurPMS = 0; // one-based number of shown PMS, 0 if nothing is shown
+    uint16_t m_uCurPCRPID = CPacket::NULL_PACKET; // PCR_PID of shown PMS, the timeline is drawn by it
+
+    // background indexing
+    QThread* m_pIndexThread = nullptr;
+    std::atomic<bool> m_fCancelIndex { false };
+    unsigned int m_uIndexGeneration = 0; // drops notifications from previous files
+    QElapsedTimer m_IndexTimer;
+
+    // follow mode: the file is indexed further as it grows; the watcher
+    // notices writes at once, the timer is for file systems where it can't
+    QFileSystemWatcher* m_pFileWatcher = nullptr;
+    QTimer* m_pFollowTimer = nullptr;
 };
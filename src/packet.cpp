@@ -11,6 +11,48 @@
  *******************************************************************************/
 
 #include "packet.h"
+#include "crc32.h"
+#include "pmt_view.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+//
+// AlignOffset
+//
+// Rounds uOffset up to alignment of T; used to place arrays in PM_SECTION
+// buffer.
+template <class T>
+static size_t AlignOffset(size_t uOffset)
+{
+    return (uOffset + alignof(T) - 1) / alignof(T) * alignof(T);
+}
+
+static size_t GetDescriptorsOffset(size_t uSectionSize)
+{
+    return AlignOffset<DESCRIPTOR>(uSectionSize);
+}
+
+static size_t GetESOffset(size_t uDescriptorsOffset, size_t uDescriptorsCount)
+{
+    return AlignOffset<ES_INFO>(uDescriptorsOffset + uDescriptorsCount * sizeof(DESCRIPTOR));
+}
+
+//
+// IsSectionCorrupted
+//
+// Checks CRC_32 of the section that starts the payload. Only a section that
+// ends in the same packet can be checked and parsed, so a longer one is
+// corrupted here; such sections are collected by CSectionAssembler, which
+// checks them itself.
+static bool IsSectionCorrupted(const PAYLOAD& section)
+{
+    if (section.uSize < 3)
+        return true;
+
+    size_t uLength = 3 + (((section.pbData[1] & 0x0F) << 8) | section.pbData[2]);
+    return (uLength > section.uSize || !CCRC32::Check(section.pbData, uLength));
+}
 
 CPacket::CPacket(void)
 {
@@ -40,9 +82,6 @@ CPacket::~CPacket(void)
 void CPacket::Set(const uint8_t* pbData)
 {
     m_pbData = pbData;
-
-    m_header.Reset();
-    m_PASection.Reset();
 }
 
 bool CPacket::CheckSyncByte(void) const
@@ -61,86 +100,211 @@ uint16_t CPacket::GetPID(void) const
     return (((m_pbData[1] & 0x1F) << 8) | m_pbData[2]);
 }
 
+bool CPacket::IsTransportError(void) const
+{
+    if (m_pbData == NULL)
+        return false;
+
+    return GET_BIT(m_pbData[1], 7);
+}
+
+bool CPacket::IsPayloadUnitStart(void) const
+{
+    if (m_pbData == NULL)
+        return false;
+
+    return GET_BIT(m_pbData[1], 6);
+}
+
+uint8_t CPacket::GetContinuityCounter(void) const
+{
+    if (m_pbData == NULL)
+        return 0;
+
+    return (m_pbData[3] & 0x0F);
+}
+
 //
-// CPacket::GetPASection
+// CPacket::GetPayload
 //
-// Parse packet and search PA Section. If some errors occurs, return FALSE.
-bool CPacket::GetPASection(PA_SECTION* pPAS) const
+// Locates the payload of the packet: skips the header and the adaptation
+// field if adaptation_field_control says it's present. The payload isn't
+// copied, pPayload points into the packet data. Returns FALSE if the packet
+// has no payload or adaptation_field_length is invalid.
+// See tables 2-2 and 2-6 in ISO/IEC 13818-1 second edition (2000-12-01).
+bool CPacket::GetPayload(PAYLOAD* pPayload) const
 {
     if (m_pbData == NULL)
         return false;
 
-    const uint8_t* pb = m_pbData;
+    uint8_t adaptation_field_control = (m_pbData[3] >> 4) & 0x03;
+    if (!(adaptation_field_control & 0x01))
+        // adaptation_field_control is equal '00' (reserved) or '10' (no payload)
+        return false;
 
-    PACKET_HEADER header(pb);
+    PCBYTE pb = m_pbData + 4;
+    PCBYTE pbEnd = m_pbData + PACKET_SIZE;
 
-    if ((header.adaptation_field_control & 0x02) || (header.adaptation_field_control & 0x03)) {
-        // adaptation_field_control is equal '10' or '11'
-        // next bytes is adaptation field
-    }
+    if (adaptation_field_control & 0x02) {
+        // adaptation_field_control is equal '11': adaptation field is followed
+        // by payload, so adaptation_field_length is in range 0..182
+        uint8_t adaptation_field_length = *pb;
+        if (adaptation_field_length > 182)
+            return false;
 
-    if (header.payload_unit_start_indicator) {
-        // read the pointer_field
-        uint8_t pointer_field = *pb;
-        pb++;
-        pb += pointer_field;
+        pb += 1 + adaptation_field_length;
     }
 
-    if ((header.adaptation_field_control & 0x01) || (header.adaptation_field_control & 0x03)) {
-        // adaptation_field_control is equal '01' or '11'
-        // next bytes is payload
+    *pPayload = PAYLOAD(pb, pbEnd - pb);
+    return true;
+}
 
-        if (header.PID == 0x0000) {
-            // payload contains Program Association section
-            PA_SECTION PAS(pb);
-            *pPAS = PAS;
-            return true;
-        }
-    }
+//
+// CPacket::GetPCR
+//
+// Reads program_clock_reference from the adaptation field: returns false if
+// the packet doesn't carry it. The value is in ticks of 27 MHz clock
+// (PCR_base * 300 + PCR_extension).
+bool CPacket::GetPCR(uint64_t* puPCR) const
+{
+    if (m_pbData == NULL)
+        return false;
 
-    return false;
+    // adaptation_field_control is equal '10' or '11', adaptation_field_length
+    // covers the flags and PCR, PCR_flag is set
+    if (!GET_BIT(m_pbData[3], 5) || m_pbData[4] < 7 || !GET_BIT(m_pbData[5], 4))
+        return false;
+
+    PCBYTE pb = m_pbData + 6;
+    uint64_t uBase = ((uint64_t)pb[0] << 25) | ((uint64_t)pb[1] << 17) | ((uint64_t)pb[2] << 9) | ((uint64_t)pb[3] << 1) | (pb[4] >> 7);
+    uint64_t uExtension = ((uint64_t)(pb[4] & 0x01) << 8) | pb[5];
+
+    *puPCR = uBase * 300 + uExtension;
+    return true;
+}
+
+//
+// CPacket::GetSectionStart
+//
+// Returns the part of the payload that starts from the first byte of the
+// section pointed by pointer_field. The bytes before it (from the beginning of
+// the payload after pointer_field) end the section started in previous
+// packets. Returns FALSE if payload_unit_start_indicator isn't set or
+// pointer_field points beyond the packet.
+bool CPacket::GetSectionStart(PAYLOAD* pPayload) const
+{
+    PAYLOAD payload;
+    if (!IsPayloadUnitStart() || !GetPayload(&payload) || payload.IsEmpty())
+        return false;
+
+    uint8_t pointer_field = payload.pbData[0];
+    if ((size_t)pointer_field + 1 >= payload.uSize)
+        return false;
+
+    *pPayload = PAYLOAD(payload.pbData + 1 + pointer_field, payload.uSize - 1 - pointer_field);
+    return true;
+}
+
+//
+// CPacket::GetPASection
+//
+// Parse packet and search PA Section. If some errors occurs, return FALSE.
+bool CPacket::GetPASection(PA_SECTION* pPAS) const
+{
+    PAYLOAD section;
+    if (GetPID() != 0x0000 || !GetSectionStart(&section) || section.pbData[0] != 0x00)
+        // payload doesn't contain the beginning of Program Association section
+        return false;
+
+    if (IsSectionCorrupted(section))
+        return false;
+
+    PCBYTE pb = section.pbData;
+    PA_SECTION PAS(pb, section.uSize);
+    *pPAS = std::move(PAS);
+    return true;
+}
+
+//
+// CPacket::IsPMS
+//
+// Checks whether the packet contains the beginning of a PM Section. PID isn't
+// checked, so it should be checked against the PAT by the caller.
+bool CPacket::IsPMS(void) const
+{
+    PAYLOAD section;
+    return (GetSectionStart(&section) && section.pbData[0] == 0x02);
 }
 
 //
 // CPacket::GetPMSection
 //
 // Parse packet and search PM Section. If some errors occurs, return FALSE.
-bool CPacket::GetPMSection(PM_SECTION* pPMS, PATable PAT) const
+bool CPacket::GetPMSection(PM_SECTION* pPMS, const PATable& PAT) const
 {
     if (m_pbData == NULL)
         return false;
 
-    const uint8_t* pb = m_pbData;
+    uint16_t uPID = GetPID();
 
-    PACKET_HEADER header(pb);
+    PATable::const_iterator iter;
+    for (iter = PAT.begin(); iter != PAT.end(); iter++)
+        if (iter->PID == uPID)
+            // payload contains Program Map section
+            return GetPMSection(pPMS);
 
-    if ((header.adaptation_field_control & 0x02) || (header.adaptation_field_control & 0x03)) {
-        // adaptation_field_control is equal '10' or '11'
-        // next bytes is adaptation field
-    }
+    return false;
+}
 
-    if (header.payload_unit_start_indicator) {
-        // read the pointer_field
-        uint8_t pointer_field = *pb;
-        pb++;
-        pb += pointer_field;
-    }
+//
+// CPacket::GetPMSection
+//
+// Parse packet as a packet with PM Section. Unlike the function above doesn't
+// check that PID of the packet belongs to Program Map Table.
+bool CPacket::GetPMSection(PM_SECTION* pPMS) const
+{
+    PAYLOAD section;
+    if (!GetSectionStart(&section) || section.pbData[0] != 0x02)
+        // payload doesn't contain the beginning of Program Map section
+        return false;
 
-    if ((header.adaptation_field_control & 0x01) || (header.adaptation_field_control & 0x03)) {
-        // adaptation_field_control is equal '01' or '11'
-        // next bytes is payload
-
-        std::list<PROGRAM_DESCRIPTOR>::const_iterator iter;
-        for (iter = PAT.begin(); iter != PAT.end(); iter++)
-            if (iter->PID == header.PID) {
-                // payload contains Program Map section
-                PM_SECTION PMS(pb);
-                *pPMS = PMS;
-                return true;
-            }
-    }
+    if (IsSectionCorrupted(section))
+        return false;
 
-    return false;
+    PCBYTE pb = section.pbData;
+    PM_SECTION PMS(pb, section.uSize);
+    *pPMS = std::move(PMS);
+    return true;
+}
+
+//
+// CPIDMap implementation
+//
+
+CPIDMap::CPIDMap(void)
+{
+    Reset();
+}
+
+void CPIDMap::Reset(void)
+{
+    memset(m_bTypes, other, sizeof(m_bTypes));
+    m_bTypes[0x0000] = pat;
+}
+
+//
+// CPIDMap::Set
+//
+// Rebuilds the map from PAT. PID of program_number 0 is network_PID, other
+// PIDs are program_map_PIDs.
+void CPIDMap::Set(const PATable& PAT)
+{
+    Reset();
+
+    PATable::const_iterator iter;
+    for (iter = PAT.begin(); iter != PAT.end(); iter++)
+        if (iter->PID != 0x0000)
+            m_bTypes[iter->PID] = (iter->program_number == 0) ? nit : pmt;
 }
 
 //
@@ -192,9 +356,17 @@ PA_SECTION::PA_SECTION(void)
 //
 // Constructor
 //
-// Parse PA Section. Movement received reference.
-PA_SECTION::PA_SECTION(PCBYTE& pb)
+// Parse PA Section. Movement received reference. uSize is the number of bytes
+// available at pb; if the section (as counted by section_length) doesn't fit
+// in them, it's left empty and pb isn't moved.
+PA_SECTION::PA_SECTION(PCBYTE& pb, size_t uSize, CArena* pArena /* = NULL */)
+    : m_PAT(PATable::allocator_type(pArena))
 {
+    if (uSize < MIN_SIZE || 3 + (((pb[1] & 0x0F) << 8) | pb[2]) > uSize) {
+        Reset();
+        return;
+    }
+
     table_id = *pb;
     pb++;
 
@@ -220,7 +392,7 @@ PA_SECTION::PA_SECTION(PCBYTE& pb)
 
     PROGRAM_DESCRIPTOR pd = { 0 };
 
-    int nCount = (section_length - 9) / 4; // number of program descriptors
+    int nCount = ((int)section_length - 9) / 4; // number of program descriptors
     for (int i = 0; i < nCount; i++) {
         pd.program_number = ((uint16_t)*pb << 8) | pb[1];
         pb += 2;
@@ -264,9 +436,21 @@ PM_SECTION::PM_SECTION(void)
 //
 // Constructor
 //
-// Parse PM Section. Movement received reference.
-PM_SECTION::PM_SECTION(PCBYTE& pb)
+// Parse PM Section. Movement received reference. uSize is the number of bytes
+// available at pb; if the section (as counted by section_length) doesn't fit
+// in them, it's left empty and pb isn't moved.
+PM_SECTION::PM_SECTION(PCBYTE& pb, size_t uSize)
 {
+    PCBYTE pbSection = pb;
+
+    // lengths of the loops are checked against section_length, so broken
+    // section isn't read beyond it
+    CPMTView view(pbSection, uSize);
+    if (!view.IsValid()) {
+        Reset();
+        return;
+    }
+
     table_id = *pb;
     pb++;
 
@@ -298,17 +482,55 @@ PM_SECTION::PM_SECTION(PCBYTE& pb)
     program_info_length = ((uint16_t)(*pb & 0x0F) << 8) | pb[1];
     pb += 2;
 
-    PCBYTE pbES_info = pb + program_info_length;
-    while (pb < pbES_info) {
-        DESCRIPTOR d(pb);
-        program_descriptors.push_back(d);
-    }
+    PCBYTE pbCRC_32 = pbSection + view.GetSize() - 4;
 
-    PCBYTE pbCRC_32 = pb + (section_length - 13 - program_info_length);
-    while (pb < pbCRC_32) {
-        ES_INFO ESInfo(pb);
-        m_PMT.push_back(ESInfo);
-    }
+    // Walks the descriptor loops and the ES info loop. Called twice: first
+    // only counts the items, then stores them into the buffer allocated once
+    // with the exact size.
+    auto parseLoops = [&](DESCRIPTOR* pDescriptors, ES_INFO* pESInfos) {
+        size_t uDescriptorsCount = 0;
+        size_t uESCount = 0;
+
+        auto addDescriptors = [&](const CDescriptorLoop& loop) {
+            for (CDescriptorLoop::iterator iter = loop.begin(); iter != loop.end(); ++iter) {
+                if (pDescriptors != NULL)
+                    pDescriptors[uDescriptorsCount] = DESCRIPTOR(*iter, pbSection);
+                uDescriptorsCount++;
+            }
+        };
+
+        addDescriptors(view.GetProgramDescriptors());
+        m_uProgramDescriptorsCount = (uint16_t)uDescriptorsCount;
+
+        CESLoop ESInfos = view.GetESInfos();
+        for (CESLoop::iterator iter = ESInfos.begin(); iter != ESInfos.end(); ++iter) {
+            ES_INFO_VIEW ESInfoView = *iter;
+            PCBYTE pbESInfo = ESInfoView.pbData;
+            ES_INFO ESInfo(pbESInfo);
+
+            ESInfo.uFirstDescriptor = (uint16_t)uDescriptorsCount;
+            addDescriptors(ESInfoView.ES_descriptors);
+            ESInfo.uDescriptorsCount = (uint16_t)(uDescriptorsCount - ESInfo.uFirstDescriptor);
+
+            if (pESInfos != NULL)
+                pESInfos[uESCount] = ESInfo;
+            uESCount++;
+        }
+
+        m_uDescriptorsCount = (uint16_t)uDescriptorsCount;
+        m_uESCount = (uint16_t)uESCount;
+    };
+
+    parseLoops(NULL, NULL);
+
+    m_uSectionSize = (uint16_t)view.GetSize();
+    size_t uDescriptorsOffset = GetDescriptorsOffset(m_uSectionSize);
+    size_t uESOffset = GetESOffset(uDescriptorsOffset, m_uDescriptorsCount);
+    m_Data.resize(uESOffset + m_uESCount * sizeof(ES_INFO));
+    memcpy(m_Data.data(), pbSection, m_uSectionSize);
+
+    parseLoops((DESCRIPTOR*)(m_Data.data() + uDescriptorsOffset), (ES_INFO*)(m_Data.data() + uESOffset));
+    pb = pbCRC_32;
 
     CRC_32 = (((uint32_t)pb[0] << 24) | ((uint32_t)pb[1] << 16) | ((uint32_t)pb[2] << 8) | ((uint32_t)pb[3]));
     pb += 4;
@@ -332,6 +554,61 @@ void PM_SECTION::Reset(void)
     reserved_4 = 0;
     program_info_length = 0;
     CRC_32 = 0;
+
+    m_Data.clear();
+    m_uSectionSize = 0;
+    m_uProgramDescriptorsCount = 0;
+    m_uDescriptorsCount = 0;
+    m_uESCount = 0;
+}
+
+//
+// PM_SECTION::GetProgramDescriptors
+//
+// Returns descriptors of the program info loop. The returned array and the
+// arrays below are valid as long as the section isn't changed or destroyed.
+Descriptors PM_SECTION::GetProgramDescriptors(void) const
+{
+    return Descriptors(GetDescriptors(), m_uProgramDescriptorsCount);
+}
+
+//
+// PM_SECTION::GetPMT
+//
+// Returns ES info entries of the section.
+PMTable PM_SECTION::GetPMT(void) const
+{
+    if (m_uESCount == 0)
+        return PMTable();
+
+    size_t uESOffset = GetESOffset(GetDescriptorsOffset(m_uSectionSize), m_uDescriptorsCount);
+    return PMTable((const ES_INFO*)(m_Data.data() + uESOffset), m_uESCount);
+}
+
+//
+// PM_SECTION::GetESDescriptors
+//
+// Returns descriptors of the ES info entry that belongs to this section.
+Descriptors PM_SECTION::GetESDescriptors(const ES_INFO& ESInfo) const
+{
+    return Descriptors(GetDescriptors() + ESInfo.uFirstDescriptor, ESInfo.uDescriptorsCount);
+}
+
+//
+// PM_SECTION::GetDescriptorData
+//
+// Returns length bytes of data of the descriptor that belongs to this section.
+PCBYTE PM_SECTION::GetDescriptorData(const DESCRIPTOR& d) const
+{
+    return m_Data.data() + d.uOffset;
+}
+
+const DESCRIPTOR* PM_SECTION::GetDescriptors(void) const
+{
+    if (m_uDescriptorsCount == 0)
+        return NULL;
+
+    return (const DESCRIPTOR*)(m_Data.data() + GetDescriptorsOffset(m_uSectionSize));
 }
 
 //
@@ -346,7 +623,9 @@ ES_INFO::ES_INFO(void)
 //
 // Constructor
 //
-// Parse ES info, which is a part of PM Section. Movement received reference.
+// Parse ES info, which is a part of PM Section. Descriptors that follow it
+// are parsed by PM_SECTION, so the received reference is moved to the first
+// of them.
 ES_INFO::ES_INFO(PCBYTE& pb)
 {
     stream_type = *pb;
@@ -360,11 +639,8 @@ ES_INFO::ES_INFO(PCBYTE& pb)
     ES_info_length = ((uint16_t)(*pb & 0x0F) << 8) | pb[1];
     pb += 2;
 
-    PCBYTE pbEnd = pb + ES_info_length;
-    while (pb < pbEnd) {
-        DESCRIPTOR d(pb);
-        ES_descriptors.push_back(d);
-    }
+    uFirstDescriptor = 0;
+    uDescriptorsCount = 0;
 }
 
 void ES_INFO::Reset(void)
@@ -374,7 +650,8 @@ void ES_INFO::Reset(void)
     elementary_PID = 0;
     reserved_2 = 0;
     ES_info_length = 0;
-    ES_descriptors.clear();
+    uFirstDescriptor = 0;
+    uDescriptorsCount = 0;
 }
 
 //
@@ -383,73 +660,25 @@ void ES_INFO::Reset(void)
 
 DESCRIPTOR::DESCRIPTOR(void)
 {
-    tag = 0;
-    length = 0;
-    pbData = NULL;
+    Reset();
 }
 
 //
 // Constructor
 //
-// Parse descriptor. Gets following fields: tag, length and data. Don't
-// determine descriptor type and don't parse data field accroding to type.
-// Instead, gets data field as array of bytes.
-//
-// Movement received reference.
-DESCRIPTOR::DESCRIPTOR(PCBYTE& pb)
-{
-    tag = *pb;
-    pb++;
-
-    length = *pb;
-    pb++;
-
-    pbData = new uint8_t[length];
-    for (uint8_t i = 0; i < length; i++)
-        pbData[i] = *pb++;
-}
-
-//
-// Copy constructor
-//
-DESCRIPTOR::DESCRIPTOR(const DESCRIPTOR& d)
+// Takes tag and length of the descriptor in the section. Don't determine
+// descriptor type and don't parse data field accroding to type. The data
+// isn't copied, uOffset is its position from pbSection.
+DESCRIPTOR::DESCRIPTOR(const DESCRIPTOR_VIEW& d, PCBYTE pbSection)
 {
     tag = d.tag;
     length = d.length;
-    pbData = new uint8_t[length];
-    for (uint8_t i = 0; i < length; i++)
-        pbData[i] = d.pbData[i];
-}
-
-DESCRIPTOR::~DESCRIPTOR(void)
-{
-    Reset();
-}
-
-DESCRIPTOR& DESCRIPTOR::operator=(const DESCRIPTOR& d)
-{
-    if (this != &d) {
-        tag = d.tag;
-        length = d.length;
-
-        if (pbData != NULL)
-            delete[] pbData;
-
-        pbData = new uint8_t[length];
-        for (uint8_t i = 0; i < length; i++)
-            pbData[i] = d.pbData[i];
-    }
-
-    return *this;
+    uOffset = (uint16_t)(d.pbData - pbSection);
 }
 
 void DESCRIPTOR::Reset(void)
 {
     tag = 0;
     length = 0;
-
-    if (pbData != NULL) {
-        delete[] pbData;
-        pbData = NULL;
-    }
+    uOffset = 0;
 }
@@ -15,7 +15,12 @@
 #ifndef _PACKET_H_
 #define _PACKET_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <list>
+#include <vector>
+
+#include "arena.h"
 
 //
 // #define directives
@@ -26,8 +31,10 @@
 // Class and structures defined in this file
 //
 class CPacket;
+class CPIDMap;
 
 struct PACKET_HEADER;
+struct PAYLOAD;
 struct PA_SECTION;
 struct PM_SECTION;
 
@@ -35,14 +42,20 @@ struct PROGRAM_DESCRIPTOR;
 struct ES_INFO;
 struct DESCRIPTOR;
 
+template <class T>
+struct ITEMS;
+
+// defined in pmt_view.h
+struct DESCRIPTOR_VIEW;
+
 //
 // Typedefs
 //
 typedef const uint8_t* PCBYTE;
 
-typedef std::list<PROGRAM_DESCRIPTOR> PATable;
-typedef std::list<ES_INFO> PMTable;
-typedef std::list<DESCRIPTOR> Descriptors;
+typedef std::list<PROGRAM_DESCRIPTOR, CArenaAllocator<PROGRAM_DESCRIPTOR>> PATable;
+typedef ITEMS<ES_INFO> PMTable;
+typedef ITEMS<DESCRIPTOR> Descriptors;
 
 //
 // Class and structures definitions
@@ -65,14 +78,33 @@ struct PACKET_HEADER {
     uint8_t continuity_counter : 4;
 };
 
+// Bytes of a packet payload. Points into the packet data, nothing is copied,
+// so it's valid as long as the packet data is.
+struct PAYLOAD {
+    PAYLOAD(void) : pbData(NULL), uSize(0) {}
+    PAYLOAD(PCBYTE pb, size_t uLength) : pbData(pb), uSize(uLength) {}
+
+    PCBYTE begin(void) const { return pbData; }
+    PCBYTE end(void) const { return pbData + uSize; }
+    bool IsEmpty(void) const { return (uSize == 0); }
+
+    PCBYTE pbData;
+    size_t uSize;
+};
+
 // See table 2-25 in ISO/IEC 13818-1 second edition (2000-12-01).
+//
+// If pArena is passed, the list of programs takes memory from it; copies of
+// the section are made in the heap.
 struct PA_SECTION {
     // constructors
     PA_SECTION(void);
-    PA_SECTION(PCBYTE& pb);
+    PA_SECTION(PCBYTE& pb, size_t uSize, CArena* pArena = NULL);
 
     void Reset(void);
 
+    static const size_t MIN_SIZE = 12; // header and CRC_32
+
     uint8_t table_id;
     uint16_t section_syntax_indicator : 1;
     uint16_t bit_null : 1;
@@ -90,13 +122,42 @@ struct PA_SECTION {
     uint32_t CRC_32;
 };
 
+// Array of items kept by another object, e.g. ES info entries of PM_SECTION.
+// Valid as long as that object isn't changed or destroyed.
+template <class T>
+struct ITEMS {
+    typedef const T* const_iterator;
+
+    ITEMS(void) : pBegin(NULL), pEnd(NULL) {}
+    ITEMS(const T* pFirst, size_t uCount) : pBegin(pFirst), pEnd(pFirst + uCount) {}
+
+    const T* begin(void) const { return pBegin; }
+    const T* end(void) const { return pEnd; }
+    size_t size(void) const { return (size_t)(pEnd - pBegin); }
+    bool IsEmpty(void) const { return (pBegin == pEnd); }
+
+    const T* pBegin;
+    const T* pEnd;
+};
+
 // See table 2-28 in ISO/IEC 13818-1 second edition (2000-12-01).
+//
+// Descriptors and ES info entries aren't allocated one by one: the section
+// bytes, the array of descriptors and the array of ES info entries are kept
+// in one buffer, and descriptors refer to their data by offset in the section
+// bytes. So copying the structure takes one allocation (none if the buffer of
+// the target is big enough), moving it takes none.
 struct PM_SECTION {
     PM_SECTION(void);
-    PM_SECTION(PCBYTE& pb);
+    PM_SECTION(PCBYTE& pb, size_t uSize);
 
     void Reset(void);
 
+    Descriptors GetProgramDescriptors(void) const;
+    PMTable GetPMT(void) const;
+    Descriptors GetESDescriptors(const ES_INFO& ESInfo) const;
+    PCBYTE GetDescriptorData(const DESCRIPTOR& d) const;
+
     uint8_t table_id;
     uint16_t section_syntax_indicator : 1;
     uint16_t bit_null : 1;
@@ -113,10 +174,16 @@ struct PM_SECTION {
     uint16_t reserved_4 : 4;
     uint16_t program_info_length : 12;
 
-    Descriptors program_descriptors;
-    PMTable m_PMT;
-
     uint32_t CRC_32;
+
+private:
+    const DESCRIPTOR* GetDescriptors(void) const;
+
+    std::vector<uint8_t> m_Data; // section bytes, then descriptors, then ES info entries
+    uint16_t m_uSectionSize = 0;
+    uint16_t m_uProgramDescriptorsCount = 0;
+    uint16_t m_uDescriptorsCount = 0; // program and ES descriptors
+    uint16_t m_uESCount = 0;
 };
 
 // Used by PA_SECTION. Associates Program Number and Program Map Table PID.
@@ -127,7 +194,9 @@ struct PROGRAM_DESCRIPTOR {
     uint16_t PID : 13;
 };
 
-// Used by PM_SECTION.
+// Used by PM_SECTION. Descriptors of the entry are uDescriptorsCount
+// descriptors of the section starting from uFirstDescriptor (see
+// PM_SECTION::GetESDescriptors).
 // See table 2-28 in ISO/IEC 13818-1 second edition (2000-12-01).
 struct ES_INFO {
     ES_INFO(void);
@@ -141,31 +210,34 @@ struct ES_INFO {
     uint16_t reserved_2 : 4;
     uint16_t ES_info_length : 12;
 
-    Descriptors ES_descriptors;
+    uint16_t uFirstDescriptor;
+    uint16_t uDescriptorsCount;
 };
 
+// Used by PM_SECTION. The data isn't copied: uOffset is the position of the
+// data in the section (see PM_SECTION::GetDescriptorData).
 // See section 2.6 in ISO/IEC 13818-1 second edition (2000-12-01).
 struct DESCRIPTOR {
     DESCRIPTOR(void);
-    DESCRIPTOR(PCBYTE& pb);
-    DESCRIPTOR(const DESCRIPTOR& d);
-    ~DESCRIPTOR(void);
-
-    DESCRIPTOR& operator=(const DESCRIPTOR& d);
+    DESCRIPTOR(const DESCRIPTOR_VIEW& d, PCBYTE pbSection);
 
     void Reset(void);
 
     uint8_t tag;
     uint8_t length;
-    uint8_t* pbData;
+    uint16_t uOffset;
 };
 
 class CPacket {
 public:
     // constants
     static const int PACKET_SIZE = 188; // size in bytes of TS packet
+    static const int M2TS_PACKET_SIZE = 192; // TS packet with 4-byte timestamp before it
+    static const int RS_PACKET_SIZE = 204; // TS packet with 16 bytes of Reed-Solomon parity after it
     static const uint8_t SYNC_BYTE = 0x47; // compare with first byte in packet
     static const uint16_t NULL_PACKET = 0x1FFF;
+    static const uint64_t PCR_CLOCK = 27000000; // PCR ticks per second
+    static const uint64_t PCR_PERIOD = 300ull << 33; // PCR wraps around after this number of ticks
 
 public:
     CPacket(void);
@@ -178,13 +250,47 @@ public:
 
     bool IsPMS(void) const;
     uint16_t GetPID(void) const;
+    bool IsTransportError(void) const;
+    bool IsPayloadUnitStart(void) const;
+    uint8_t GetContinuityCounter(void) const;
+    bool GetPayload(PAYLOAD* pPayload) const;
+    bool GetPCR(uint64_t* puPCR) const;
+    bool GetSectionStart(PAYLOAD* pPayload) const;
     bool GetPASection(PA_SECTION* pPAS) const;
-    bool GetPMSection(PM_SECTION* pPMS, PATable pat) const;
+    bool GetPMSection(PM_SECTION* pPMS, const PATable& PAT) const;
+    bool GetPMSection(PM_SECTION* pPMS) const;
 
 private:
     const uint8_t* m_pbData;
-    PACKET_HEADER m_header;
-    PA_SECTION m_PASection;
+};
+
+// Classifies packets by PID. The map is built from PAT, so the type of a
+// packet is found by one load from the table instead of walking PATable.
+// Rebuild it only when PAT changes.
+class CPIDMap {
+public:
+    // constants
+    static const int PID_COUNT = 8192; // PID is 13-bit value
+
+    // types of PIDs
+    enum Type {
+        other = 0,
+        pat, // Program Association Table
+        pmt, // Program Map Table
+        nit // Network Information Table (program_number 0 in PAT)
+    };
+
+public:
+    CPIDMap(void);
+
+    void Reset(void);
+    void Set(const PATable& PAT);
+
+    Type Get(uint16_t uPID) const { return (Type)m_bTypes[uPID & (PID_COUNT - 1)]; }
+    bool IsPMT(uint16_t uPID) const { return (m_bTypes[uPID & (PID_COUNT - 1)] == pmt); }
+
+private:
+    uint8_t m_bTypes[PID_COUNT];
 };
 
 #endif // _PACKET_H_
@@ -0,0 +1,43 @@
+/*******************************************************************************
+ * File: PMTView.cpp
+ *
+ * Description: CPMTView class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "pmt_view.h"
+
+const size_t CPMTView::HEADER_SIZE;
+const size_t CPMTView::CRC_32_SIZE;
+
+CPMTView::CPMTView(void)
+{
+    m_pb = NULL;
+    m_pbCRC_32 = NULL;
+}
+
+//
+// Constructor
+//
+// pbSection points to the first byte of PM Section, uSize is the number of
+// bytes available there. The view is invalid if the section (as counted by
+// section_length) doesn't fit in them. table_id isn't checked.
+CPMTView::CPMTView(PCBYTE pbSection, size_t uSize)
+{
+    m_pb = NULL;
+    m_pbCRC_32 = NULL;
+
+    if (pbSection == NULL || uSize < HEADER_SIZE + CRC_32_SIZE)
+        return;
+
+    // section_length counts bytes after it up to the end of CRC_32; lengths
+    // of the loops are checked against it, as PM_SECTION does
+    size_t uSectionSize = std::max<size_t>(3 + (((pbSection[1] & 0x0F) << 8) | pbSection[2]), HEADER_SIZE + CRC_32_SIZE);
+    if (uSectionSize > uSize)
+        return;
+
+    m_pb = pbSection;
+    m_pbCRC_32 = pbSection + uSectionSize - CRC_32_SIZE;
+}
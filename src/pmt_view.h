@@ -0,0 +1,267 @@
+/*******************************************************************************
+ * File: PMTView.h
+ *
+ * Description:
+ *    CPMTView class definition. This class reads the fields of a PM Section
+ *    right from the section bytes: nothing is copied or allocated, the
+ *    descriptor loops and the ES info loop are walked by iterators only when
+ *    they are needed. The layout of the fields is the same as in PM_SECTION.
+ *
+ *    See table 2-28 and section 2.6 in ISO/IEC 13818-1 second edition
+ *    (2000-12-01).
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _PMT_VIEW_H_
+#define _PMT_VIEW_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+#include "packet.h"
+
+//
+// Classes and structures defined in this file
+//
+class CPMTView;
+class CDescriptorLoop;
+class CESLoop;
+
+struct DESCRIPTOR_VIEW;
+struct ES_INFO_VIEW;
+
+//
+// Class and structures definitions
+//
+
+// Descriptor in the section bytes.
+struct DESCRIPTOR_VIEW {
+    uint8_t tag;
+    uint8_t length;
+    PCBYTE pbData;
+};
+
+// Descriptors in [pbBegin, pbEnd) bytes. Iteration stops at a descriptor
+// that goes beyond the loop, as PM_SECTION does.
+class CDescriptorLoop {
+public:
+    // items are built from the bytes on dereference, so it's an input iterator
+    class iterator {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef DESCRIPTOR_VIEW value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const DESCRIPTOR_VIEW* pointer;
+        typedef DESCRIPTOR_VIEW reference;
+
+        iterator(void) : m_pb(NULL), m_pbEnd(NULL) {}
+        iterator(PCBYTE pb, PCBYTE pbEnd) : m_pb(pb), m_pbEnd(pbEnd) { Check(); }
+
+        DESCRIPTOR_VIEW operator*(void) const
+        {
+            DESCRIPTOR_VIEW d = { m_pb[0], m_pb[1], m_pb + 2 };
+            return d;
+        }
+
+        iterator& operator++(void)
+        {
+            m_pb += 2 + m_pb[1];
+            Check();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator prev = *this;
+            ++*this;
+            return prev;
+        }
+
+        bool operator==(const iterator& iter) const { return (m_pb == iter.m_pb); }
+        bool operator!=(const iterator& iter) const { return (m_pb != iter.m_pb); }
+
+    private:
+        void Check(void)
+        {
+            if (m_pbEnd - m_pb < 2 || m_pb[1] > m_pbEnd - m_pb - 2)
+                m_pb = m_pbEnd;
+        }
+
+        PCBYTE m_pb;
+        PCBYTE m_pbEnd;
+    };
+
+    typedef iterator const_iterator;
+
+public:
+    CDescriptorLoop(void) : m_pbBegin(NULL), m_pbEnd(NULL) {}
+    CDescriptorLoop(PCBYTE pbBegin, PCBYTE pbEnd) : m_pbBegin(pbBegin), m_pbEnd(pbEnd) {}
+
+    iterator begin(void) const { return iterator(m_pbBegin, m_pbEnd); }
+    iterator end(void) const { return iterator(m_pbEnd, m_pbEnd); }
+    bool IsEmpty(void) const { return (begin() == end()); }
+
+private:
+    PCBYTE m_pbBegin;
+    PCBYTE m_pbEnd;
+};
+
+// ES info entry in the section bytes.
+struct ES_INFO_VIEW {
+    PCBYTE pbData; // the first byte of the entry (stream_type)
+    uint8_t stream_type;
+    uint16_t elementary_PID;
+    uint16_t ES_info_length;
+    CDescriptorLoop ES_descriptors;
+};
+
+// ES info entries in [pbBegin, pbEnd) bytes. Iteration stops at an entry
+// that goes beyond the loop, as PM_SECTION does.
+class CESLoop {
+public:
+    // items are built from the bytes on dereference, so it's an input iterator
+    class iterator {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef ES_INFO_VIEW value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const ES_INFO_VIEW* pointer;
+        typedef ES_INFO_VIEW reference;
+
+        iterator(void) : m_pb(NULL), m_pbEnd(NULL) {}
+        iterator(PCBYTE pb, PCBYTE pbEnd) : m_pb(pb), m_pbEnd(pbEnd) { Check(); }
+
+        ES_INFO_VIEW operator*(void) const
+        {
+            ES_INFO_VIEW ESInfo;
+            ESInfo.pbData = m_pb;
+            ESInfo.stream_type = m_pb[0];
+            ESInfo.elementary_PID = ((uint16_t)(m_pb[1] & 0x1F) << 8) | m_pb[2];
+            ESInfo.ES_info_length = GetESInfoLength();
+            ESInfo.ES_descriptors = CDescriptorLoop(m_pb + 5, m_pb + 5 + ESInfo.ES_info_length);
+            return ESInfo;
+        }
+
+        iterator& operator++(void)
+        {
+            m_pb += 5 + GetESInfoLength();
+            Check();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator prev = *this;
+            ++*this;
+            return prev;
+        }
+
+        bool operator==(const iterator& iter) const { return (m_pb == iter.m_pb); }
+        bool operator!=(const iterator& iter) const { return (m_pb != iter.m_pb); }
+
+    private:
+        uint16_t GetESInfoLength(void) const { return ((uint16_t)(m_pb[3] & 0x0F) << 8) | m_pb[4]; }
+
+        void Check(void)
+        {
+            if (m_pbEnd - m_pb < 5 || GetESInfoLength() > m_pbEnd - m_pb - 5)
+                m_pb = m_pbEnd;
+        }
+
+        PCBYTE m_pb;
+        PCBYTE m_pbEnd;
+    };
+
+    typedef iterator const_iterator;
+
+public:
+    CESLoop(void) : m_pbBegin(NULL), m_pbEnd(NULL) {}
+    CESLoop(PCBYTE pbBegin, PCBYTE pbEnd) : m_pbBegin(pbBegin), m_pbEnd(pbEnd) {}
+
+    iterator begin(void) const { return iterator(m_pbBegin, m_pbEnd); }
+    iterator end(void) const { return iterator(m_pbEnd, m_pbEnd); }
+    bool IsEmpty(void) const { return (begin() == end()); }
+
+private:
+    PCBYTE m_pbBegin;
+    PCBYTE m_pbEnd;
+};
+
+// PM Section in place. The view is valid as long as the section bytes are;
+// fields are read on each call, so keep the values that are used often.
+class CPMTView {
+public:
+    // constants
+    static const size_t HEADER_SIZE = 12; // bytes up to the program info loop
+    static const size_t CRC_32_SIZE = 4;
+
+public:
+    CPMTView(void);
+    CPMTView(PCBYTE pbSection, size_t uSize);
+
+    bool IsValid(void) const { return (m_pb != NULL); }
+
+    uint8_t GetTableId(void) const { return m_pb[0]; }
+    bool GetSectionSyntaxIndicator(void) const { return GET_BIT(m_pb[1], 7); }
+    uint16_t GetSectionLength(void) const { return ((uint16_t)(m_pb[1] & 0x0F) << 8) | m_pb[2]; }
+    uint16_t GetProgramNumber(void) const { return (((uint16_t)m_pb[3] << 8) | m_pb[4]); }
+    uint8_t GetVersionNumber(void) const { return (m_pb[5] >> 1) & 0x1F; }
+    bool GetCurrentNextIndicator(void) const { return GET_BIT(m_pb[5], 0); }
+    uint8_t GetSectionNumber(void) const { return m_pb[6]; }
+    uint8_t GetLastSectionNumber(void) const { return m_pb[7]; }
+    uint16_t GetPCRPID(void) const { return ((uint16_t)(m_pb[8] & 0x1F) << 8) | m_pb[9]; }
+    uint16_t GetProgramInfoLength(void) const { return ((uint16_t)(m_pb[10] & 0x0F) << 8) | m_pb[11]; }
+    uint32_t GetCRC32(void) const;
+
+    CDescriptorLoop GetProgramDescriptors(void) const;
+    CESLoop GetESInfos(void) const;
+
+    PCBYTE GetData(void) const { return m_pb; }
+    size_t GetSize(void) const { return (size_t)(m_pbCRC_32 + CRC_32_SIZE - m_pb); }
+
+private:
+    PCBYTE GetESInfoStart(void) const;
+
+    PCBYTE m_pb; // the first byte of the section (table_id)
+    PCBYTE m_pbCRC_32;
+};
+
+//
+// CPMTView::GetCRC32
+//
+inline uint32_t CPMTView::GetCRC32(void) const
+{
+    PCBYTE pb = m_pbCRC_32;
+    return (((uint32_t)pb[0] << 24) | ((uint32_t)pb[1] << 16) | ((uint32_t)pb[2] << 8) | ((uint32_t)pb[3]));
+}
+
+//
+// CPMTView::GetProgramDescriptors
+//
+// Returns the program info loop; program_info_length is limited by the end
+// of the section.
+inline CDescriptorLoop CPMTView::GetProgramDescriptors(void) const
+{
+    PCBYTE pb = m_pb + HEADER_SIZE;
+    return CDescriptorLoop(pb, GetESInfoStart());
+}
+
+//
+// CPMTView::GetESInfos
+//
+// Returns the ES info loop that follows the program info loop up to CRC_32.
+inline CESLoop CPMTView::GetESInfos(void) const
+{
+    return CESLoop(GetESInfoStart(), m_pbCRC_32);
+}
+
+inline PCBYTE CPMTView::GetESInfoStart(void) const
+{
+    return std::min(m_pb + HEADER_SIZE + GetProgramInfoLength(), m_pbCRC_32);
+}
+
+#endif // _PMT_VIEW_H_
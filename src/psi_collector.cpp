@@ -0,0 +1,73 @@
+/*******************************************************************************
+ * File: PSICollector.cpp
+ *
+ * Description: CPSICollector class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "psi_collector.h"
+#include <algorithm>
+
+CPSICollector::CPSICollector(void)
+{
+    m_StartNums.resize(CPIDMap::PID_COUNT);
+    Reset();
+}
+
+void CPSICollector::Reset(void)
+{
+    m_Assembler.Reset();
+    m_PATAssembler.Reset();
+    m_Arena.Reset();
+    m_PAT.Reset();
+    m_NewPAT.Reset();
+    m_fPAT = false;
+    m_PIDs.Reset();
+    std::fill(m_StartNums.begin(), m_StartNums.end(), 0);
+}
+
+//
+// CPSICollector::AddPAS
+//
+// Adds the PA Section to PAT. Returns true if it completes PAT that differs
+// from the previous one (by version_number and CRC_32); GetPAT() returns it
+// and GetType() returns the types of its PIDs then.
+bool CPSICollector::AddPAS(PCBYTE pbSection, size_t uSize)
+{
+    bool fChanged = false;
+
+    {
+        PA_SECTION PAS(pbSection, uSize, &m_Arena);
+        if (m_PATAssembler.Add(PAS, &m_NewPAT)
+            && (!m_fPAT || m_NewPAT.version_number != m_PAT.version_number || m_NewPAT.CRC_32 != m_PAT.CRC_32)) {
+            m_PAT = m_NewPAT;
+            m_fPAT = true;
+            m_PIDs.Set(m_PAT.m_PAT);
+            fChanged = true;
+        }
+    }
+
+    // the section is repeated many times, so its memory is reused
+    m_Arena.Reset();
+    return fChanged;
+}
+
+//
+// CPSICollector::MakePMSEntry
+//
+// Returns the index entry of the PM Section of uPID that starts in the
+// packet uPacketNum at uOffset. Only a few fields are needed, so the section
+// isn't parsed; uPAS is left for the caller.
+PMS_INDEX_ENTRY CPSICollector::MakePMSEntry(const CPMTView& PMS, uint16_t uPID, uint64_t uOffset, uint64_t uPacketNum)
+{
+    PMS_INDEX_ENTRY entry = {};
+    entry.uPacketNum = uPacketNum;
+    entry.uOffset = uOffset;
+    entry.PID = uPID;
+    entry.program_number = PMS.GetProgramNumber();
+    entry.version_number = PMS.GetVersionNumber();
+    entry.CRC_32 = PMS.GetCRC32();
+    return entry;
+}
@@ -0,0 +1,86 @@
+/*******************************************************************************
+ * File: PSICollector.h
+ *
+ * Description:
+ *    CPSICollector class definition. This class collects PA Sections and PM
+ *    Sections from packets of TS: it keeps the section assembler, the PAT
+ *    built from PA Sections (and so the PMT PIDs) and the number of the
+ *    packet each section starts in. CTSIndex uses one collector per chunk of
+ *    a file and CTSStream one per stream, so both find the same sections.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _PSI_COLLECTOR_H_
+#define _PSI_COLLECTOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "arena.h"
+#include "packet.h"
+#include "pmt_view.h"
+#include "section_assembler.h"
+#include "ts_index.h"
+
+//
+// Class defined in this file
+//
+class CPSICollector;
+
+//
+// Class definitions
+//
+
+// Packets are pushed in the order they are met in TS; the caller chooses
+// which ones (usually PAT PID and PMT PIDs, see GetType) and what to do with
+// the completed sections: PA Sections are passed to AddPAS(), PM Sections are
+// turned into index entries by MakePMSEntry().
+class CPSICollector {
+public:
+    CPSICollector(void);
+
+    void Reset(void);
+
+    CPIDMap::Type GetType(uint16_t uPID) const { return m_PIDs.Get(uPID); }
+    bool HasPAT(void) const { return m_fPAT; }
+    const PA_SECTION& GetPAT(void) const { return m_PAT; }
+    const CSectionAssembler& GetAssembler(void) const { return m_Assembler; }
+
+    bool AddPAS(PCBYTE pbSection, size_t uSize);
+
+    static PMS_INDEX_ENTRY MakePMSEntry(const CPMTView& PMS, uint16_t uPID, uint64_t uOffset, uint64_t uPacketNum);
+
+    //
+    // CPSICollector::Push
+    //
+    // Passes the packet of uPID at uOffset to the assembler and calls
+    // handler(pbSection, uSize, uTag, uStartNum) for each section completed
+    // in it; uTag is the offset of the packet the section starts in and
+    // uStartNum is the number of that packet.
+    template <class Handler>
+    void Push(const uint8_t* pbPacket, uint16_t uPID, uint64_t uOffset, uint64_t uPacketNum, Handler handler)
+    {
+        m_Assembler.Push(pbPacket, uOffset, [&](PCBYTE pbSection, size_t uSize, uint64_t uTag) {
+            // the section starts either in current packet or in the last packet
+            // of this PID where payload unit starts
+            handler(pbSection, uSize, uTag, (uTag == uOffset) ? uPacketNum : m_StartNums[uPID]);
+        });
+
+        if (CPacket(pbPacket).IsPayloadUnitStart())
+            m_StartNums[uPID] = uPacketNum;
+    }
+
+private:
+    CSectionAssembler m_Assembler;
+    CPATAssembler m_PATAssembler;
+    CArena m_Arena; // PA Sections are parsed here; the tables are in the heap
+    PA_SECTION m_PAT; // the last PAT that differs from the previous one
+    PA_SECTION m_NewPAT; // the last PAT collected
+    bool m_fPAT; // m_PAT is collected
+    CPIDMap m_PIDs; // built from m_PAT
+    std::vector<uint64_t> m_StartNums; // number of last packet with payload_unit_start_indicator per PID
+};
+
+#endif // _PSI_COLLECTOR_H_
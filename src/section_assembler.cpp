@@ -0,0 +1,191 @@
+/*******************************************************************************
+ * File: SectionAssembler.cpp
+ *
+ * Description: CSectionAssembler and CPATAssembler classes implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "section_assembler.h"
+
+//
+// CSectionAssembler implementation
+//
+
+CSectionAssembler::CSectionAssembler(void)
+{
+    Reset();
+}
+
+void CSectionAssembler::Reset(void)
+{
+    PID_STATE state = { false, -1, 0, 0, 0 };
+    m_States.assign(CPIDMap::PID_COUNT, state);
+    m_uCRCErrorsCount = 0;
+
+    m_FreeBuffers.clear();
+    for (uint32_t i = 0; i < m_Pool.size() / MAX_SECTION_SIZE; i++)
+        m_FreeBuffers.push_back(i);
+}
+
+//
+// CSectionAssembler::Reset
+//
+// Drops the section collected on uPID, e.g. when PID stops being PMT PID.
+void CSectionAssembler::Reset(uint16_t uPID)
+{
+    PID_STATE& state = m_States[uPID & (CPIDMap::PID_COUNT - 1)];
+    Release(state);
+    state.iCC = -1;
+}
+
+bool CSectionAssembler::IsPending(uint16_t uPID) const
+{
+    return m_States[uPID & (CPIDMap::PID_COUNT - 1)].fPending;
+}
+
+//
+// CSectionAssembler::GetPendingTag
+//
+// Returns tag of the packet where the pending section on uPID starts.
+uint64_t CSectionAssembler::GetPendingTag(uint16_t uPID) const
+{
+    return m_States[uPID & (CPIDMap::PID_COUNT - 1)].uTag;
+}
+
+//
+// CSectionAssembler::Start
+//
+// Takes a buffer from the pool for a new section.
+void CSectionAssembler::Start(PID_STATE& state, uint64_t uTag)
+{
+    if (m_FreeBuffers.empty()) {
+        m_FreeBuffers.push_back((uint32_t)(m_Pool.size() / MAX_SECTION_SIZE));
+        m_Pool.resize(m_Pool.size() + MAX_SECTION_SIZE);
+    }
+
+    state.uBuffer = m_FreeBuffers.back();
+    m_FreeBuffers.pop_back();
+
+    state.fPending = true;
+    state.uSize = 0;
+    state.uTag = uTag;
+}
+
+void CSectionAssembler::Append(PID_STATE& state, PCBYTE pb, size_t uSize)
+{
+    // don't copy bytes after the end of the section (stuffing or next section)
+    size_t uLength = GetLength(state);
+    if (uLength != 0 && uSize > uLength - state.uSize)
+        uSize = uLength - state.uSize;
+
+    if (state.uSize + uSize > MAX_SECTION_SIZE) {
+        Release(state);
+        return;
+    }
+
+    memcpy(GetBuffer(state.uBuffer) + state.uSize, pb, uSize);
+    state.uSize += (uint16_t)uSize;
+
+    // section_length could be unknown until now
+    if (GetLength(state) > MAX_SECTION_SIZE)
+        Release(state);
+}
+
+//
+// CSectionAssembler::Release
+//
+// Returns the buffer of pending section to the pool.
+void CSectionAssembler::Release(PID_STATE& state)
+{
+    if (!state.fPending)
+        return;
+
+    m_FreeBuffers.push_back(state.uBuffer);
+    state.fPending = false;
+    state.uSize = 0;
+}
+
+bool CSectionAssembler::IsComplete(const PID_STATE& state) const
+{
+    size_t uLength = GetLength(state);
+    return (uLength != 0 && state.uSize >= uLength);
+}
+
+//
+// CSectionAssembler::GetLength
+//
+// Returns full length of the pending section (with table_id and section_length
+// fields) or 0 if section_length isn't received yet.
+size_t CSectionAssembler::GetLength(const PID_STATE& state) const
+{
+    if (state.uSize < 3)
+        return 0;
+
+    const uint8_t* pb = GetBuffer(state.uBuffer);
+    return 3 + (((pb[1] & 0x0F) << 8) | pb[2]);
+}
+
+//
+// CPATAssembler implementation
+//
+
+CPATAssembler::CPATAssembler(void)
+{
+}
+
+void CPATAssembler::Reset(void)
+{
+    m_Sections.clear();
+    m_Received.reset();
+}
+
+//
+// CPATAssembler::Add
+//
+// Adds PA Section to the table. If all sections of the table are received,
+// returns true and the whole table in pPAT: its m_PAT contains programs of all
+// sections, CRC_32 is a combination of CRC_32 of all sections.
+bool CPATAssembler::Add(const PA_SECTION& PAS, PA_SECTION* pPAT)
+{
+    if (!PAS.current_next_indicator)
+        // the table isn't applicable yet
+        return false;
+
+    if (PAS.last_section_number == 0) {
+        // the usual case: the table consists of one section
+        Reset();
+        *pPAT = PAS;
+        return true;
+    }
+
+    if (PAS.section_number > PAS.last_section_number)
+        return false;
+
+    if (!m_Sections.empty()
+        && (m_Sections[0].version_number != PAS.version_number
+            || m_Sections[0].last_section_number != PAS.last_section_number))
+        // new version of the table, start again
+        Reset();
+
+    if (m_Sections.empty())
+        m_Sections.resize(PAS.last_section_number + 1);
+
+    m_Sections[PAS.section_number] = PAS;
+    m_Received.set(PAS.section_number);
+
+    if (m_Received.count() != m_Sections.size())
+        return false;
+
+    *pPAT = m_Sections[0];
+    pPAT->section_number = 0;
+    for (size_t i = 1; i < m_Sections.size(); i++) {
+        pPAT->m_PAT.insert(pPAT->m_PAT.end(), m_Sections[i].m_PAT.begin(), m_Sections[i].m_PAT.end());
+        pPAT->CRC_32 = ((pPAT->CRC_32 << 1) | (pPAT->CRC_32 >> 31)) ^ m_Sections[i].CRC_32;
+    }
+
+    // sections of next version (or repetitions of this one) are collected again
+    Reset();
+    return true;
+}
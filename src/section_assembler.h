@@ -0,0 +1,200 @@
+/*******************************************************************************
+ * File: SectionAssembler.h
+ *
+ * Description:
+ *    CSectionAssembler class definition. This class collects PSI sections
+ *    (PA Sections, PM Sections and so on) that are carried by several
+ *    transport packets. Also contains CPATAssembler class, which collects
+ *    Program Association Table that consists of several sections.
+ *
+ *    See sections 2.4.4 and 2.4.3.3 (pointer_field, continuity_counter) in
+ *    ISO/IEC 13818-1 second edition (2000-12-01).
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _SECTION_ASSEMBLER_H_
+#define _SECTION_ASSEMBLER_H_
+
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "crc32.h"
+#include "packet.h"
+
+//
+// Class defined in this file
+//
+class CSectionAssembler;
+class CPATAssembler;
+
+//
+// Class definitions
+//
+
+// Collects sections per PID. Packets of each PID must be pushed in the order
+// they are met in TS; packets of different PIDs can be interleaved.
+//
+// A section that is entirely in one packet is passed to the handler right from
+// the packet memory. Only sections that span several packets are copied to a
+// buffer; buffers have fixed size and are reused, so no memory is allocated
+// per section.
+class CSectionAssembler {
+public:
+    // constants
+    static const int MAX_SECTION_SIZE = 4096; // maximum size of private section
+
+public:
+    CSectionAssembler(void);
+
+    void Reset(void);
+    void Reset(uint16_t uPID);
+
+    bool IsPending(uint16_t uPID) const;
+    uint64_t GetPendingTag(uint16_t uPID) const;
+    uint64_t GetCRCErrorsCount(void) const { return m_uCRCErrorsCount; }
+
+    //
+    // CSectionAssembler::Push
+    //
+    // Parses the packet and calls handler(pbSection, uSize, uTag) for each section
+    // completed in it. uTag is the value passed with the packet the section
+    // starts in (e.g. offset of the packet). pbSection is valid only during the
+    // call. Sections with wrong CRC_32 are dropped.
+    template <class Handler>
+    void Push(const uint8_t* pbPacket, uint64_t uTag, Handler handler)
+    {
+        CPacket packet(pbPacket);
+        PAYLOAD payload;
+        if (!packet.CheckSyncByte() || packet.IsTransportError() || !packet.GetPayload(&payload) || payload.IsEmpty())
+            return;
+
+        PID_STATE& state = m_States[packet.GetPID()];
+
+        // continuity_counter must be incremented by one in each packet with payload;
+        // one duplicate packet is allowed and is skipped
+        uint8_t uCC = packet.GetContinuityCounter();
+        if (state.iCC >= 0) {
+            if (uCC == state.iCC)
+                return;
+
+            if (uCC != ((state.iCC + 1) & 0x0F))
+                // packets are lost, so the section can't be collected
+                Release(state);
+        }
+        state.iCC = uCC;
+
+        PCBYTE pb = payload.begin();
+        PCBYTE pbEnd = payload.end();
+
+        if (packet.IsPayloadUnitStart()) {
+            // payload_unit_start_indicator is set: pointer_field points to the first
+            // byte of new section, the bytes before it end the current one
+            uint8_t pointer_field = *pb++;
+            if (pb + pointer_field > pbEnd) {
+                Release(state);
+                return;
+            }
+
+            if (state.fPending) {
+                Append(state, pb, pointer_field);
+                if (state.fPending && IsComplete(state))
+                    Emit(state, handler);
+
+                // section must end before the new one starts
+                Release(state);
+            }
+
+            pb += pointer_field;
+
+            // there may be several sections in one packet
+            while (pb < pbEnd && *pb != 0xFF) {
+                if (pbEnd - pb >= 3) {
+                    size_t uLength = 3 + (((pb[1] & 0x0F) << 8) | pb[2]);
+                    if (uLength > MAX_SECTION_SIZE)
+                        break;
+
+                    if ((size_t)(pbEnd - pb) >= uLength) {
+                        // the whole section is in this packet; no copying is needed
+                        Deliver(pb, uLength, uTag, handler);
+                        pb += uLength;
+                        continue;
+                    }
+                }
+
+                // the section continues in next packets
+                Start(state, uTag);
+                Append(state, pb, pbEnd - pb);
+                break;
+            }
+        } else if (state.fPending) {
+            Append(state, pb, payload.uSize);
+            if (state.fPending && IsComplete(state)) {
+                Emit(state, handler);
+                Release(state);
+            }
+        }
+    }
+
+private:
+    struct PID_STATE {
+        bool fPending; // section is being collected
+        int8_t iCC; // continuity_counter of previous packet, -1 if unknown
+        uint16_t uSize; // collected bytes
+        uint32_t uBuffer; // number of buffer in the pool
+        uint64_t uTag; // tag of packet the section starts in
+    };
+
+    void Start(PID_STATE& state, uint64_t uTag);
+    void Append(PID_STATE& state, PCBYTE pb, size_t uSize);
+    void Release(PID_STATE& state);
+    bool IsComplete(const PID_STATE& state) const;
+    size_t GetLength(const PID_STATE& state) const;
+
+    uint8_t* GetBuffer(uint32_t uBuffer) { return &m_Pool[(size_t)uBuffer * MAX_SECTION_SIZE]; }
+    const uint8_t* GetBuffer(uint32_t uBuffer) const { return &m_Pool[(size_t)uBuffer * MAX_SECTION_SIZE]; }
+
+    template <class Handler>
+    void Emit(PID_STATE& state, Handler handler)
+    {
+        Deliver(GetBuffer(state.uBuffer), GetLength(state), state.uTag, handler);
+    }
+
+    // passes the section to the handler if its CRC_32 is correct; sections
+    // with section_syntax_indicator equal 0 have no CRC_32
+    template <class Handler>
+    void Deliver(PCBYTE pbSection, size_t uSize, uint64_t uTag, Handler handler)
+    {
+        if (GET_BIT(pbSection[1], 7) && !CCRC32::Check(pbSection, uSize)) {
+            m_uCRCErrorsCount++;
+            return;
+        }
+
+        handler(pbSection, uSize, uTag);
+    }
+
+private:
+    std::vector<PID_STATE> m_States; // one per PID
+    std::vector<uint8_t> m_Pool; // buffers of MAX_SECTION_SIZE bytes
+    std::vector<uint32_t> m_FreeBuffers;
+    uint64_t m_uCRCErrorsCount; // sections dropped because of wrong CRC_32
+};
+
+// Collects Program Association Table from its sections. A table with one
+// section (the usual case) is returned at once.
+class CPATAssembler {
+public:
+    CPATAssembler(void);
+
+    void Reset(void);
+    bool Add(const PA_SECTION& PAS, PA_SECTION* pPAT);
+
+private:
+    std::vector<PA_SECTION> m_Sections; // sections of the table being collected
+    std::bitset<256> m_Received; // numbers of received sections
+};
+
+#endif // _SECTION_ASSEMBLER_H_
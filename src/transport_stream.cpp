@@ -9,8 +9,10 @@
  *******************************************************************************/
 
 #include "transport_stream.h"
-#include <cstdio>
-#include <list>
+#include "index_cache.h"
+#include "section_assembler.h"
+#include "ts_sync.h"
+#include <algorithm>
 
 CTransportStream::CTransportStream(void)
 {
@@ -21,542 +23,444 @@ CTransportStream::~CTransportStream(void)
     Close();
 }
 
-bool CTransportStream::Open(const std::string& pszFileName)
+//
+// CTransportStream::Open
+//
+// Opens the file and builds the index of PM Sections (or loads the one saved
+// for this file before). If fBuildIndex is false, the index should be built by
+// BuildIndex(), e.g. in other thread.
+//
+// Returns false if the file can't be opened. Pipes and other inputs that can
+// be read only forward aren't opened either, errno is ESPIPE then (see
+// CTSFile::Open); CTSStream reads them.
+bool CTransportStream::Open(const std::string& pszFileName, bool fBuildIndex /* = true */)
 {
-    if (m_hFile != nullptr)
+    if (m_File.IsOpened())
         Close();
 
     m_szFileName = pszFileName;
 
     // open file
-    m_hFile = std::fopen(m_szFileName.c_str(), "rb");
-    if (m_hFile == nullptr) {
+    if (!m_File.Open(m_szFileName)) {
         m_szFileName = "";
         return false;
     }
 
+    if (fBuildIndex)
+        BuildIndex();
+
     return true;
 }
 
 void CTransportStream::Close(void)
 {
-    if (m_hFile == nullptr) {
-        fclose(m_hFile);
-        m_hFile = nullptr;
-    }
+    m_File.Close();
 
     m_szFileName = "";
 
+    m_Index.Clear();
+    m_fIsIndexLoaded = false;
+
     m_uCurPMS = 0;
-    m_uCurPMSPacket = 0;
-    m_uPMSCount = 0;
+    m_iProgram = -1;
+    m_uCurProgramPos = 0;
 }
 
 //
-// CTransportStream::IsMPEG2TS
+// CTransportStream::BuildIndex
 //
-// In this function checks only first byte of each packet in a file. The value
-// of this byte must be equal SYNC_BYTE value.
-bool CTransportStream::IsMPEG2TS(void) const
+// Builds the index of opened file. PM Sections can be accessed while the index
+// is being built (from other thread): PM Sections count grows as the file is
+// indexed. See CTSIndex::Build for details.
+//
+// If the index was saved for this file before (see CIndexCache), it's loaded
+// instead; a newly built complete index is saved. SetIndexCache(false) turns
+// both off, e.g. for batch jobs that must not leave files behind.
+bool CTransportStream::BuildIndex(const CTSIndex::Progress& progress /* = CTSIndex::Progress() */, unsigned int uThreads /* = 0 */)
 {
-    if (m_hFile == nullptr)
+    if (!m_File.IsOpened())
         return false;
 
-    if (fseek(m_hFile, 0, SEEK_SET) != 0)
-        return false;
+    INDEX_KEY key;
+    bool fCanSave = m_fIsIndexCacheEnabled && CIndexCache::GetKey(m_szFileName, m_File, &key);
 
-    CPacket packet;
-    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
-    int dwReaded = 0; // number of bytes readed from file
+    m_fIsIndexLoaded = fCanSave && CIndexCache::Load(m_szFileName, key, &m_Index);
+    if (m_fIsIndexLoaded) {
+        if (progress)
+            progress(m_File.GetSize(), m_Index.GetPMSCount());
 
-    while (true) {
-        if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-            break;
+        return true;
+    }
 
-        //        if (dwReaded == 0)
-        //            // reached end of file
-        //            break;
+    bool fResult = m_Index.Build(m_File, progress, uThreads);
 
-        packet.Set(bPacket);
-        if (!packet.CheckSyncByte())
-            return false;
-    }
+    // the file isn't MPEG-2 TS: nothing to save
+    if (fCanSave && m_Index.IsComplete() && m_Index.IsMPEG2TS())
+        CIndexCache::Save(m_szFileName, key, m_Index);
 
-    return true;
+    return fResult;
 }
 
-std::string CTransportStream::GetFileName(void) const
+bool CTransportStream::IsIndexLoaded(void) const
 {
-    return m_szFileName;
+    return m_fIsIndexLoaded;
 }
 
-int CTransportStream::GetFileSize(void) const
+//
+// CTransportStream::UpdateIndex
+//
+// Indexes the data appended to the file since the index was built, for files
+// that are still being written. Only new data is scanned (see
+// CTSIndex::Update). Returns false if indexing is canceled or if the file
+// became smaller; it should be opened again in the last case.
+bool CTransportStream::UpdateIndex(const CTSIndex::Progress& progress /* = CTSIndex::Progress() */)
 {
-    if (m_hFile == nullptr)
-        return 0;
+    if (!m_File.IsOpened() || !m_File.Refresh())
+        return false;
 
-    fseek(m_hFile, 0, SEEK_END);
-    int size = ftell(m_hFile);
-    if (size == -1L)
-        return 0;
+    return m_Index.Update(m_File, progress);
+}
 
-    return size;
+bool CTransportStream::IsIndexComplete(void) const
+{
+    return m_Index.IsComplete();
 }
 
 //
-// GetPMTCount
+// CTransportStream::ReadPMSection
 //
-// Returns a count of Program Map Sections in Transport Stream.
-uint32_t CTransportStream::GetPMSCount(void)
+// Reads and parses PM Section with zero-based number uIndex in the index.
+// The section may span several packets: they are read starting from the
+// packet the section begins in, packets of other PIDs are skipped.
+// Returns one-based number of packet that contains this PM Section or 0 if
+// some errors occurs.
+uint64_t CTransportStream::ReadPMSection(uint64_t uIndex, PM_SECTION* pPMS) const
 {
-    if (m_hFile == nullptr)
+    PMS_INDEX_ENTRY entry;
+    if (!m_Index.GetPMSection(uIndex, &entry))
         return 0;
 
-    if (m_uPMSCount)
-        // m_uPMSCount is already known
-        return m_uPMSCount;
+    CSectionAssembler assembler;
+    bool fFound = false;
+    auto onSection = [&](PCBYTE pbSection, size_t uSize, uint64_t uTag) {
+        if (!fFound && uTag == entry.uOffset && pbSection[0] == 0x02) {
+            *pPMS = PM_SECTION(pbSection, uSize);
+            fFound = true;
+        }
+    };
 
-    if (fseek(m_hFile, 0, SEEK_SET) != 0)
-        return 0;
+    size_t uPacketSize = m_Index.GetPacketSize();
+    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
+    std::vector<uint8_t> buffer; // used to skip garbage
+    for (uint64_t uOffset = entry.uOffset; !fFound; uOffset += uPacketSize) {
+        size_t uSize = CPacket::PACKET_SIZE;
+        const uint8_t* pb = m_File.Read(uOffset, uSize, bPacket);
+        if (pb == NULL || uSize != CPacket::PACKET_SIZE)
+            return 0;
 
-    CPacket packet;
-    PA_SECTION PAS;
-    PM_SECTION PMS;
-    PATable PAT;
+        CPacket packet(pb);
+        if (!packet.CheckSyncByte()) {
+            // the section is interrupted by garbage, find where packets continue
+            uOffset = CTSSync::Find(m_File, uPacketSize, uOffset + 1, uOffset + CTSSync::WINDOW_SIZE, buffer);
+            if (uOffset == UINT64_MAX)
+                return 0;
 
-    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
-    int dwReaded = 0; // number of bytes readed from file
-    uint32_t uPMSCount = 0;
-
-    while (true) {
-        if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-            break;
-
-        //        if (dwReaded == 0)
-        //            // reached end of file
-        //            break;
-
-        packet.Set(bPacket);
-
-        uint16_t uPID = packet.GetPID();
-        if (uPID == 0) {
-            // packet contains PA Section
-            if (packet.GetPASection(&PAS))
-                PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-        } else {
-            PATable::const_iterator iter;
-            for (iter = PAT.begin(); iter != PAT.end(); iter++)
-                if (iter->PID == uPID)
-                    if (packet.GetPMSection(&PMS, PAT))
-                        uPMSCount++;
+            uOffset -= uPacketSize;
+            continue;
         }
+
+        if (packet.GetPID() != entry.PID)
+            continue;
+
+        assembler.Push(pb, uOffset, onSection);
+        if (!fFound && (!assembler.IsPending(entry.PID) || assembler.GetPendingTag(entry.PID) != entry.uOffset))
+            return 0;
     }
 
-    m_uPMSCount = uPMSCount;
-    return m_uPMSCount;
+    return (entry.uPacketNum + 1);
 }
 
-uint32_t CTransportStream::GetPacketsCount(void) const
+//
+// CTransportStream::SetCurPMSection
+//
+// Makes PM Section with zero-based number uIndex current for functions for
+// sequential access to PM Sections.
+uint64_t CTransportStream::SetCurPMSection(uint64_t uIndex, PM_SECTION* pPMS, uint64_t* uPMSNum)
 {
-    if (m_hFile == nullptr)
+    uint64_t uPacketNum = ReadPMSection(uIndex, pPMS);
+    if (uPacketNum == 0)
         return 0;
 
-    if (fseek(m_hFile, 0, SEEK_SET) != 0)
-        return 0;
+    m_uCurPMS = uIndex;
 
-    CPacket packet;
-    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
-    int dwReaded = 0; // number of bytes readed from file
-    uint32_t uPacketsCount = 0;
+    if (uPMSNum != NULL)
+        *uPMSNum = m_uCurPMS + 1;
 
-    while (true) {
-        if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-            break;
+    return uPacketNum;
+}
 
-        //        if (dwReaded == 0)
-        //            // reached end of file
-        //            break;
+//
+// CTransportStream::IsMPEG2TS
+//
+// The file is checked while building the index: packets must be found at
+// its beginning; garbage after them is skipped (see CTSIndex::Build).
+bool CTransportStream::IsMPEG2TS(void) const
+{
+    if (!m_File.IsOpened())
+        return false;
 
-        uPacketsCount++;
-    }
+    return m_Index.IsMPEG2TS();
+}
 
-    return uPacketsCount;
+std::string CTransportStream::GetFileName(void) const
+{
+    return m_szFileName;
 }
 
-/*
-UINT CTransportStream::GetPMSection(UINT uNum, PM_SECTION* pPMS) const
+uint64_t CTransportStream::GetFileSize(void) const
 {
-        if (m_hFile == INVALID_HANDLE_VALUE)
-                return 0;
+    return m_File.GetSize();
+}
 
-        if (SetFilePointer(m_hFile, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
-                return 0;
+//
+// GetPMTCount
+//
+// Returns a count of Program Map Sections in Transport Stream.
+uint64_t CTransportStream::GetPMSCount(void) const
+{
+    return m_Index.GetPMSCount();
+}
 
-        CPacket	   packet;
-        PA_SECTION PAS;
-        PM_SECTION PMS;
-        PATable    PAT;
-
-        BYTE  bPacket[CPacket::PACKET_SIZE] = {0};
-        DWORD dwReaded   = 0;
-        UINT  uPASNum    = 1; // number of current PA Section
-        UINT  uPMSNum    = 1; // number of current PM Section
-        UINT  uPacketNum = 1; // number of current packet
-
-        while (TRUE)
-        {
-                if (!ReadFile(m_hFile, &bPacket, CPacket::PACKET_SIZE, &dwReaded, NULL))
-                        return 0;
-
-                if (dwReaded == 0)
-                        // reached end of file
-                        break;
-
-                packet.Set(bPacket);
-
-                USHORT uPID = packet.GetPID();
-                if (uPID == 0)
-                {
-                        // packet contains PA Section
-                        uPASNum++;
-                        if (packet.GetPASection(&PAS))
-                                PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-                }
-                else
-                {
-                        std::list<PROGRAM_DESCRIPTOR>::const_iterator iter;
-                        for (iter = PAT.begin(); iter != PAT.end(); iter++)
-                                if (iter->PID == uPID)
-                                        if (packet.GetPMSection(&PMS, PAT))
-                                                // TODO: ckeck != < >
-                                                if (uPMSNum == uNum)
-                                                {
-                                                        *pPMS = PMS;
-                                                        return uPacketNum;
-                                                }
-                                                else
-                                                        uPMSNum++; // TODO: break; ?
-                }
-
-                uPacketNum++;
-        }
+uint64_t CTransportStream::GetPacketsCount(void) const
+{
+    return m_Index.GetPacketsCount();
+}
 
-        return 0;
+//
+// CTransportStream::GetPacketSize
+//
+// Returns size of packets in the file: 188 bytes for plain TS, 192 bytes for
+// M2TS or 204 bytes for TS with Reed-Solomon parity. It's known after the
+// index is built.
+size_t CTransportStream::GetPacketSize(void) const
+{
+    return m_Index.GetPacketSize();
 }
-*/
 
-uint32_t CTransportStream::GetFirstPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum /* = NULL */)
+//
+// CTransportStream::GetPMSection
+//
+// Random access to PM Section with one-based number uNum. Offset of the packet
+// where the section begins is taken from the index, so reading starts there
+// however far into the file it is; the section is reassembled from the
+// packets of its PID by ReadPMSection. Returns one-based number of packet
+// that contains the PM Section or 0 if there is no such PM Section.
+uint64_t CTransportStream::GetPMSection(uint64_t uNum, PM_SECTION* pPMS) const
 {
-    if (m_hFile == nullptr)
+    if (uNum == 0)
         return 0;
 
-    if (fseek(m_hFile, 0, SEEK_SET) != 0)
+    return ReadPMSection(uNum - 1, pPMS);
+}
+
+//
+// CTransportStream::SetCurProgramSection
+//
+// Makes the section uPos of the filtered program current.
+uint64_t CTransportStream::SetCurProgramSection(uint64_t uPos, PM_SECTION* pPMS, uint64_t* uPMSNum)
+{
+    uint64_t uIndex = 0;
+    if (!m_Index.GetProgramPMSection((uint16_t)m_iProgram, uPos, &uIndex))
         return 0;
 
-    CPacket packet;
-    PA_SECTION PAS;
-    PM_SECTION PMS;
-    PATable PAT;
+    uint64_t uPacketNum = SetCurPMSection(uIndex, pPMS, uPMSNum);
+    if (uPacketNum != 0)
+        m_uCurProgramPos = uPos;
 
-    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
-    int dwReaded = 0; // number of bytes readed from file
-    uint32_t uPacketNum = 0; // zero-based number of current packet
-
-    while (true) {
-        if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-            break;
-
-        //        if (dwReaded == 0)
-        //            // reached end of file
-        //            break;
-
-        packet.Set(bPacket);
-
-        uint16_t uPID = packet.GetPID();
-        if (uPID == 0) {
-            // packet contains PA Section
-            if (packet.GetPASection(&PAS))
-                PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-        } else {
-            std::list<PROGRAM_DESCRIPTOR>::const_iterator iter;
-            for (iter = PAT.begin(); iter != PAT.end(); iter++)
-                if (iter->PID == uPID)
-                    if (packet.GetPMSection(&PMS, PAT)) {
-                        *pPMS = PMS;
-                        m_uCurPMS = 0; // this is a first PM Section in TS
-                        m_uCurPMSPacket = uPacketNum;
-
-                        if (uPMSNum != NULL)
-                            *uPMSNum = m_uCurPMS + 1;
-
-                        return (m_uCurPMSPacket + 1);
-                    }
-        }
+    return uPacketNum;
+}
 
-        uPacketNum++;
+//
+// CTransportStream::FindProgramPosition
+//
+// Returns the position among the sections of the filtered program of the
+// first one that is current PM Section or comes after it; *pfIsCur tells
+// which. The position of current section is remembered, so stepping through
+// the program takes constant time; after a jump elsewhere it's found by
+// binary search.
+uint64_t CTransportStream::FindProgramPosition(bool* pfIsCur) const
+{
+    uint64_t uPos = m_uCurProgramPos;
+    uint64_t uIndex = 0;
+    if (!m_Index.GetProgramPMSection((uint16_t)m_iProgram, uPos, &uIndex) || uIndex != m_uCurPMS) {
+        uPos = m_Index.FindProgramPMSection((uint16_t)m_iProgram, m_uCurPMS);
+        if (!m_Index.GetProgramPMSection((uint16_t)m_iProgram, uPos, &uIndex))
+            uIndex = UINT64_MAX;
     }
 
-    // there is no PM Sections in file
-    return 0;
+    *pfIsCur = (uIndex == m_uCurPMS);
+    return uPos;
 }
 
-uint32_t CTransportStream::GetLastPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum /* = NULL */)
+uint64_t CTransportStream::GetFirstPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
 {
-    if (m_hFile == nullptr)
-        return 0;
+    if (m_iProgram >= 0)
+        return SetCurProgramSection(0, pPMS, uPMSNum);
 
-    if (fseek(m_hFile, 0, SEEK_SET) != 0)
+    if (m_Index.GetPMSCount() == 0)
+        // there is no PM Sections in file
         return 0;
 
-    CPacket packet;
-    PA_SECTION PAS;
-    PM_SECTION PMS;
-    PATable PAT;
-
-    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
-    //    int dwReaded = 0; // number of bytes readed from file
-    uint32_t uPMSCount = 0;
-    uint32_t uCurPMSPacket = 0;
-    uint32_t uPacketNum = 0; // zero-based number of current packet
-
-    while (true) {
-        if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-            break;
-
-        //        if (dwReaded == 0)
-        //            // reached end of file
-        //            break;
-
-        packet.Set(bPacket);
-
-        uint16_t uPID = packet.GetPID();
-        if (uPID == 0) {
-            // packet contains PA Section
-            if (packet.GetPASection(&PAS))
-                PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-        } else {
-            std::list<PROGRAM_DESCRIPTOR>::const_iterator iter;
-            for (iter = PAT.begin(); iter != PAT.end(); iter++)
-                if (iter->PID == uPID)
-                    if (packet.GetPMSection(&PMS, PAT)) {
-                        uPMSCount++;
-                        uCurPMSPacket = uPacketNum;
-                    }
-        }
+    return SetCurPMSection(0, pPMS, uPMSNum);
+}
 
-        uPacketNum++;
+uint64_t CTransportStream::GetLastPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
+{
+    if (m_iProgram >= 0) {
+        uint64_t uCount = m_Index.GetProgramPMSCount((uint16_t)m_iProgram);
+        return (uCount != 0) ? SetCurProgramSection(uCount - 1, pPMS, uPMSNum) : 0;
     }
 
-    if (uPMSCount == 0)
-        // PM Section not found
+    if (m_Index.GetPMSCount() == 0)
+        // there is no PM Sections in file
         return 0;
 
-    *pPMS = PMS;
-    m_uCurPMS = uPMSCount - 1; // m_uCurPMS is zero-based
-    m_uCurPMSPacket = uCurPMSPacket;
-
-    if (uPMSNum != NULL)
-        *uPMSNum = m_uCurPMS + 1;
-
-    return (m_uCurPMSPacket + 1);
+    return SetCurPMSection(m_Index.GetPMSCount() - 1, pPMS, uPMSNum);
 }
 
-uint32_t CTransportStream::GetNextPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum /* = NULL */)
+uint64_t CTransportStream::GoToPMSection(uint64_t uNum, PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
 {
-    if (m_hFile == nullptr)
+    if (uNum == 0 || uNum > m_Index.GetPMSCount())
+        // there is no such PM Section in file
         return 0;
 
-    CPacket packet;
-    PA_SECTION PAS;
-    PM_SECTION PMS;
-    PATable PAT;
-
-    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
-    //    int dwReaded = 0; // number of bytes readed from file
-    uint32_t uPacketNum = 0; // zero-based number of current packet
-
-    // May be there are no PA Sections between current PM Section and next PM Section.
-    // Therefore, if the current PM Section is not a first PM Section in TS,
-    // then make a backward search of PA Section from current PM Section.
-    if (m_uCurPMSPacket > 0) {
-        uPacketNum = m_uCurPMSPacket - 1;
-        while (true) {
-            if (fseek(m_hFile, 188 * uPacketNum, SEEK_SET) != 0)
-                break;
-
-            if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-                break;
-
-            //            if (dwReaded == 0)
-            //                // reached end of file
-            //                return 0;
-
-            packet.Set(bPacket);
-            if (packet.GetPID() == 0)
-                if (packet.GetPASection(&PAS)) {
-                    PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-                    break;
-                }
-
-            if (uPacketNum)
-                uPacketNum--;
-            else
-                break;
-        }
-    }
-
-    // Go to packet following after the current PM Section and then search PA Section and PM Section
+    return SetCurPMSection(uNum - 1, pPMS, uPMSNum);
+}
 
-    uPacketNum = m_uCurPMSPacket + 1;
-    if (fseek(m_hFile, 188 * uPacketNum, SEEK_SET) != 0)
+//
+// CTransportStream::GoToPacket
+//
+// Makes current the last PM Section that starts at zero-based packet
+// uPacketNum or before it (the first one if there is no such one); the index
+// finds it by binary search (see CTSIndex::FindPacketByTime to go to a time).
+// If a program is filtered, the last section of the program is taken.
+uint64_t CTransportStream::GoToPacket(uint64_t uPacketNum, PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
+{
+    if (m_Index.GetPMSCount() == 0)
+        // there is no PM Sections in file
         return 0;
 
-    while (true) {
-        if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-            break;
-
-        //        if (dwReaded == 0)
-        //            // reached end of file
-        //            break;
-
-        packet.Set(bPacket);
-
-        uint16_t uPID = packet.GetPID();
-        if (uPID == 0) {
-            // packet contains PA Section
-            if (packet.GetPASection(&PAS))
-                PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-        } else {
-            std::list<PROGRAM_DESCRIPTOR>::const_iterator iter;
-            for (iter = PAT.begin(); iter != PAT.end(); iter++)
-                if (iter->PID == uPID)
-                    if (packet.GetPMSection(&PMS, PAT)) {
-                        *pPMS = PMS;
-                        m_uCurPMS++;
-                        m_uCurPMSPacket = uPacketNum;
-
-                        if (uPMSNum != NULL)
-                            *uPMSNum = m_uCurPMS + 1;
-
-                        return (m_uCurPMSPacket + 1);
-                    }
-        }
-
-        uPacketNum++;
+    if (m_iProgram >= 0) {
+        uint64_t uPos = m_Index.FindProgramPMSectionByPacket((uint16_t)m_iProgram, uPacketNum);
+        return SetCurProgramSection((uPos < m_Index.GetProgramPMSCount((uint16_t)m_iProgram)) ? uPos : 0, pPMS, uPMSNum);
     }
 
-    // there is no PM Sections in file
-    return 0;
+    uint64_t uIndex = m_Index.FindPMSection(uPacketNum);
+    return SetCurPMSection((uIndex < m_Index.GetPMSCount()) ? uIndex : 0, pPMS, uPMSNum);
 }
 
-uint32_t CTransportStream::GetPrevPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum /* = NULL */)
+uint64_t CTransportStream::GetNextPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
 {
-    if (m_hFile == nullptr)
-        return 0;
+    if (m_iProgram >= 0) {
+        bool fIsCur = false;
+        uint64_t uPos = FindProgramPosition(&fIsCur);
+        return SetCurProgramSection(fIsCur ? uPos + 1 : uPos, pPMS, uPMSNum);
+    }
 
-    if (m_uCurPMSPacket <= 1)
-        // Current PMS packet is first or second in TS, so there are no
-        // PM Sections before this PMS packet
+    if (m_uCurPMS + 1 >= m_Index.GetPMSCount())
+        // current PM Section is the last one
         return 0;
 
-    CPacket packet;
-    PA_SECTION PAS;
-    PM_SECTION PMS;
-    PATable PAT;
+    return SetCurPMSection(m_uCurPMS + 1, pPMS, uPMSNum);
+}
 
-    uint8_t bPacket[CPacket::PACKET_SIZE] = { 0 };
-    //    int dwReaded = 0; // number of bytes readed from file
-    uint32_t uPacketNum = 0; // zero-based number of current packet
-    uint32_t uPAS = 0;
-
-    uPacketNum = m_uCurPMSPacket - 1;
-    while (uPacketNum > 0) {
-        // backward search of PA Section
-        while (true) {
-            if (fseek(m_hFile, 188 * uPacketNum, SEEK_SET) != 0)
-                break;
-
-            if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-                break;
-
-            //            if (dwReaded == 0)
-            //                // reached end of file
-            //                return 0;
-
-            packet.Set(bPacket);
-            if (packet.GetPID() == 0)
-                if (packet.GetPASection(&PAS)) {
-                    PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-                    break;
-                }
-
-            if (uPacketNum)
-                uPacketNum--;
-            else
-                break;
-        }
+uint64_t CTransportStream::GetPrevPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
+{
+    if (m_iProgram >= 0) {
+        bool fIsCur = false;
+        uint64_t uPos = FindProgramPosition(&fIsCur);
+        return (uPos != 0) ? SetCurProgramSection(uPos - 1, pPMS, uPMSNum) : 0;
+    }
 
-        if (PAT.empty())
-            // PA Section not found
-            return 0;
+    if (m_uCurPMS == 0 || m_Index.GetPMSCount() == 0)
+        // current PM Section is the first one
+        return 0;
 
-        uPAS = uPacketNum;
+    return SetCurPMSection(m_uCurPMS - 1, pPMS, uPMSNum);
+}
 
-        // Search a PM Section from PA Section to current PM Section
-        // ... PA (uPAS) ... search -> ... PM (m_uCurPMSPacket) ...
+//
+// CTransportStream::GetNextPMSChange
+//
+// Makes current the next PM Section where the program of current one changes
+// (see CTSIndex::GetPMSChangesCount), skipping the sections that repeat it.
+uint64_t CTransportStream::GetNextPMSChange(PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
+{
+    uint64_t uIndex = m_Index.FindNextPMSChange(m_uCurPMS);
+    if (uIndex == UINT64_MAX)
+        // the program doesn't change after current PM Section
+        return 0;
 
-        uPacketNum++;
-        if (fseek(m_hFile, 188 * uPacketNum, SEEK_SET) != 0)
-            return 0;
+    return SetCurPMSection(uIndex, pPMS, uPMSNum);
+}
 
-        uint32_t uCurPMSPacket = 0;
-        while (uPacketNum < m_uCurPMSPacket) {
-            if (fread(bPacket, CPacket::PACKET_SIZE, 1, m_hFile) != 1)
-                break;
-
-            //            if (dwReaded == 0)
-            //                // reached end of file
-            //                break;
-
-            packet.Set(bPacket);
-
-            uint16_t uPID = packet.GetPID();
-            if (uPID == 0) {
-                // packet contains PA Section
-                if (packet.GetPASection(&PAS))
-                    PAT.assign(PAS.m_PAT.begin(), PAS.m_PAT.end());
-            } else {
-                std::list<PROGRAM_DESCRIPTOR>::const_iterator iter;
-                for (iter = PAT.begin(); iter != PAT.end(); iter++)
-                    if (iter->PID == uPID)
-                        if (packet.GetPMSection(&PMS, PAT))
-                            uCurPMSPacket = uPacketNum;
-            }
-
-            uPacketNum++;
-        }
+uint64_t CTransportStream::GetPrevPMSChange(PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
+{
+    uint64_t uIndex = m_Index.FindPrevPMSChange(m_uCurPMS);
+    if (uIndex == UINT64_MAX)
+        // there are no changes of the program before current PM Section
+        return 0;
 
-        if (uCurPMSPacket > 0) {
-            *pPMS = PMS;
-            m_uCurPMS--;
-            m_uCurPMSPacket = uCurPMSPacket;
+    return SetCurPMSection(uIndex, pPMS, uPMSNum);
+}
 
-            if (uPMSNum != NULL)
-                *uPMSNum = m_uCurPMS + 1;
+//
+// CTransportStream::SetProgramFilter
+//
+// Makes functions for sequential access walk only PM Sections of program
+// iProgram (program_number), or all of them if it's -1. The index lists the
+// sections of each program, so the next and previous ones are found in
+// constant time however many programs are multiplexed. The section of the
+// program nearest after current PM Section (or its last one) becomes
+// current; returns one-based number of its packet, 0 if there is no such
+// one or the filter is turned off.
+uint64_t CTransportStream::SetProgramFilter(int iProgram, PM_SECTION* pPMS, uint64_t* uPMSNum /* = NULL */)
+{
+    m_iProgram = iProgram;
+    m_uCurProgramPos = 0;
+    if (m_iProgram < 0)
+        return 0;
 
-            return (m_uCurPMSPacket + 1);
-        }
+    uint64_t uCount = m_Index.GetProgramPMSCount((uint16_t)m_iProgram);
+    if (uCount == 0)
+        return 0;
 
-        // There are no packets with PM Section from PA Section to current PM Section,
-        // so continue to search a PA Section in reverse order
-        // <- search ... PA (uPAS) ... PM (m_uCurPMSPacket) ...
+    bool fIsCur = false;
+    uint64_t uPos = FindProgramPosition(&fIsCur);
+    return SetCurProgramSection(std::min(uPos, uCount - 1), pPMS, uPMSNum);
+}
 
-        if (uPAS == 0)
-            return 0;
+int CTransportStream::GetProgramFilter(void) const
+{
+    return m_iProgram;
+}
 
-        uPacketNum = uPAS - 1;
+//
+// CTransportStream::GetCurPMSPosition
+//
+// Returns one-based position of current PM Section among the sections of the
+// filtered program (among all PM Sections if there is no filter), 0 if it
+// isn't a section of the program. *puCount is the count of the sections.
+uint64_t CTransportStream::GetCurPMSPosition(uint64_t* puCount) const
+{
+    if (m_iProgram < 0) {
+        *puCount = m_Index.GetPMSCount();
+        return (m_uCurPMS < *puCount) ? m_uCurPMS + 1 : 0;
     }
 
-    // there is no PM Sections in file
-    return 0;
+    *puCount = m_Index.GetProgramPMSCount((uint16_t)m_iProgram);
+
+    bool fIsCur = false;
+    uint64_t uPos = FindProgramPosition(&fIsCur);
+    return fIsCur ? uPos + 1 : 0;
 }
@@ -15,6 +15,8 @@
 #include <string>
 
 #include "packet.h"
+#include "ts_file.h"
+#include "ts_index.h"
 
 class CTransportStream {
 public:
@@ -22,33 +24,64 @@ public:
     CTransportStream(const std::string& pszFileName);
     ~CTransportStream(void);
 
-    bool Open(const std::string& pszFileName);
+    bool Open(const std::string& pszFileName, bool fBuildIndex = true);
     void Close(void);
 
+    bool BuildIndex(const CTSIndex::Progress& progress = CTSIndex::Progress(), unsigned int uThreads = 0);
+    bool UpdateIndex(const CTSIndex::Progress& progress = CTSIndex::Progress());
+    bool IsIndexComplete(void) const;
+    bool IsIndexLoaded(void) const;
+    void SetIndexCache(bool fEnabled) { m_fIsIndexCacheEnabled = fEnabled; }
+    const CTSIndex& GetIndex(void) const { return m_Index; }
+
     bool IsMPEG2TS(void) const;
 
     std::string GetFileName(void) const;
-    int GetFileSize(void) const;
-    uint32_t GetPMSCount(void);
-    uint32_t GetPacketsCount(void) const;
+    uint64_t GetFileSize(void) const;
+    uint64_t GetPMSCount(void) const;
+    uint64_t GetPacketsCount(void) const;
+    size_t GetPacketSize(void) const;
 
     // random access to PM Sections in a TS
-    uint32_t GetPMSection(uint32_t uNum, PM_SECTION* pPMS) const;
+    uint64_t GetPMSection(uint64_t uNum, PM_SECTION* pPMS) const;
 
     // functions for sequential access to PM Sections in a TS
-    uint32_t GetFirstPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum = NULL);
-    uint32_t GetLastPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum = NULL);
-    uint32_t GetNextPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum = NULL);
-    uint32_t GetPrevPMSection(PM_SECTION* pPMS, uint32_t* uPMSNum = NULL);
+    uint64_t GetFirstPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    uint64_t GetLastPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    uint64_t GoToPMSection(uint64_t uNum, PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    uint64_t GoToPacket(uint64_t uPacketNum, PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    uint64_t GetNextPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    uint64_t GetPrevPMSection(PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    uint64_t GetNextPMSChange(PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    uint64_t GetPrevPMSChange(PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+
+    // sequential access to PM Sections of one program of MPTS
+    uint64_t SetProgramFilter(int iProgram, PM_SECTION* pPMS, uint64_t* uPMSNum = NULL);
+    int GetProgramFilter(void) const;
+    uint64_t GetCurPMSPosition(uint64_t* puCount) const;
+
+private:
+    uint64_t ReadPMSection(uint64_t uIndex, PM_SECTION* pPMS) const;
+    uint64_t SetCurPMSection(uint64_t uIndex, PM_SECTION* pPMS, uint64_t* uPMSNum);
+    uint64_t SetCurProgramSection(uint64_t uPos, PM_SECTION* pPMS, uint64_t* uPMSNum);
+    uint64_t FindProgramPosition(bool* pfIsCur) const;
 
 private:
-    std::FILE* m_hFile = nullptr;
+    CTSFile m_File;
     std::string m_szFileName = "";
-    uint32_t m_uPMSCount = 0; // count of PM Section in TS
 
-    // zero-based variables used by functions for sequential access to PM Sections
-    uint32_t m_uCurPMS = 0; // number of current PMS
-    uint32_t m_uCurPMSPacket = 0; // number of current packet that contains PM Section
+    CTSIndex m_Index; // PM Sections index, built once by Open() or BuildIndex()
+    bool m_fIsIndexLoaded = false; // m_Index is loaded from the saved one
+    bool m_fIsIndexCacheEnabled = true; // the index is loaded and saved by CIndexCache
+
+    // zero-based number of current PM Section, used by functions for sequential access
+    uint64_t m_uCurPMS = 0;
+
+    // program_number whose PM Sections are walked by functions for sequential
+    // access, -1 for all PM Sections; m_uCurProgramPos is the position of
+    // current PM Section among the sections of the program, if it's there
+    int m_iProgram = -1;
+    uint64_t m_uCurProgramPos = 0;
 };
 
 #endif // _TRANSPORT_STREAM_H_
@@ -0,0 +1,402 @@
+/*******************************************************************************
+ * File: TSChecker.cpp
+ *
+ * Description: CTSChecker class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "ts_checker.h"
+#include <algorithm>
+#include <cstring>
+
+const uint64_t CTSChecker::TABLE_TIMEOUT_MS;
+const uint8_t CTSChecker::CC_KNOWN;
+const uint8_t CTSChecker::CC_DUPLICATE;
+const uint8_t CTSChecker::CC_RESYNC;
+const uint8_t CTSChecker::CC_MASK;
+
+//
+// Saved checker (see CTSChecker::Save): the header, kept errors, states of
+// continuity_counter of all PIDs and TABLE_RECORD for each PID with tables.
+//
+struct CHECKER_HEADER {
+    uint64_t uErrorsCount;
+    uint64_t ErrorCounts[TS_ERROR::TYPES_COUNT];
+    uint64_t uTablesCount;
+    uint64_t uEndErrorsCount; // the last errors are found by CheckEnd()
+};
+
+struct TABLE_RECORD {
+    uint16_t PID;
+    uint16_t reserved[3];
+    uint64_t uPacketNum;
+};
+
+// sync loss before a packet comes before the errors in that packet
+static bool IsEarlier(const TS_ERROR& a, const TS_ERROR& b)
+{
+    return a.uPacketNum < b.uPacketNum || (a.uPacketNum == b.uPacketNum && a.uOffset < b.uOffset);
+}
+
+CTSChecker::CTSChecker(void)
+{
+    Reset();
+}
+
+//
+// CTSChecker::Reset
+//
+// Forgets all checked packets. Locations of at most uMaxErrors errors are
+// kept, the next ones are only counted; this bounds the memory taken by
+// broken recordings, where nearly every packet can be wrong.
+void CTSChecker::Reset(size_t uMaxErrors /* = SIZE_MAX */)
+{
+    m_uMaxErrors = uMaxErrors;
+    m_Errors.clear();
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++) {
+        m_TypeErrors[i].clear();
+        m_ErrorCounts[i] = 0;
+    }
+
+    m_CCStates.assign(CPIDMap::PID_COUNT, 0);
+    m_FirstPackets.clear();
+    m_TableNums.clear();
+    m_uEndErrorsCount = 0;
+}
+
+void CTSChecker::Swap(CTSChecker& checker)
+{
+    std::swap(m_uMaxErrors, checker.m_uMaxErrors);
+    m_Errors.swap(checker.m_Errors);
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++) {
+        m_TypeErrors[i].swap(checker.m_TypeErrors[i]);
+        std::swap(m_ErrorCounts[i], checker.m_ErrorCounts[i]);
+    }
+
+    m_CCStates.swap(checker.m_CCStates);
+    m_FirstPackets.swap(checker.m_FirstPackets);
+    m_TableNums.swap(checker.m_TableNums);
+    std::swap(m_uEndErrorsCount, checker.m_uEndErrorsCount);
+}
+
+//
+// CTSChecker::AddError
+//
+// Counts the error and keeps its location. Errors should be added in packet
+// order; Append() sorts the errors of the chunk anyway.
+void CTSChecker::AddError(TS_ERROR::Type type, uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset, uint32_t uDetail /* = 0 */)
+{
+    m_ErrorCounts[type]++;
+
+    TS_ERROR error;
+    error.uPacketNum = uPacketNum;
+    error.uOffset = uOffset;
+    error.uDetail = uDetail;
+    error.PID = uPID;
+    error.type = (uint8_t)type;
+    error.reserved = 0;
+    Add(error);
+}
+
+//
+// CTSChecker::Append
+//
+// Joins the checker of the packets that follow the ones checked here;
+// uFirstPacketNum is the number of its first packet. The first packets of
+// each PID there are checked against the last ones here.
+//
+// arrivals are the tables completed in those packets, numbered from their
+// first packet, in order of each PID. An interval longer than uTimeoutPackets
+// (TABLE_TIMEOUT_MS at the bitrate of TS) is a timeout; 0 means that the
+// bitrate is unknown, so only the last tables are remembered.
+void CTSChecker::Append(CTSChecker& checker, uint64_t uFirstPacketNum, const std::vector<TABLE_ARRIVAL>& arrivals, uint64_t uTimeoutPackets)
+{
+    std::vector<TS_ERROR> errors(checker.m_Errors);
+    for (size_t i = 0; i < errors.size(); i++)
+        errors[i].uPacketNum += uFirstPacketNum;
+
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++)
+        m_ErrorCounts[i] += checker.m_ErrorCounts[i];
+
+    auto addError = [&](TS_ERROR::Type type, uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset, uint32_t uDetail) {
+        TS_ERROR error = { uPacketNum, uOffset, uDetail, uPID, (uint8_t)type, 0 };
+        errors.push_back(error);
+        m_ErrorCounts[type]++;
+    };
+
+    for (size_t i = 0; i < checker.m_FirstPackets.size(); i++) {
+        FIRST_PACKET first = checker.m_FirstPackets[i];
+        first.uPacketNum += uFirstPacketNum;
+
+        uint16_t& uState = m_CCStates[first.PID];
+        if (uState == 0) {
+            m_FirstPackets.push_back(first);
+            continue;
+        }
+
+        uint8_t bExpected = 0;
+        if (!CheckCC(&uState, first.bHeader, first.fDiscontinuity, &bExpected))
+            addError(TS_ERROR::continuity, first.PID, first.uPacketNum, first.uOffset, (uint32_t)(bExpected << 4 | (first.bHeader & CC_MASK)));
+    }
+
+    for (size_t i = 0; i < CPIDMap::PID_COUNT; i++)
+        if (checker.m_CCStates[i] != 0)
+            m_CCStates[i] = checker.m_CCStates[i];
+
+    if (m_TableNums.empty())
+        m_TableNums.assign(CPIDMap::PID_COUNT, UINT64_MAX);
+
+    for (size_t i = 0; i < arrivals.size(); i++) {
+        const TABLE_ARRIVAL& arrival = arrivals[i];
+        uint64_t uPacketNum = arrival.uPacketNum + uFirstPacketNum;
+        uint64_t& uLastNum = m_TableNums[arrival.PID];
+
+        if (uLastNum != UINT64_MAX && uTimeoutPackets != 0 && uPacketNum - uLastNum > uTimeoutPackets) {
+            uint64_t uInterval = (uPacketNum - uLastNum) * TABLE_TIMEOUT_MS / uTimeoutPackets;
+            addError((TS_ERROR::Type)arrival.type, arrival.PID, uPacketNum, arrival.uOffset, (uint32_t)std::min<uint64_t>(uInterval, UINT32_MAX));
+        }
+
+        uLastNum = uPacketNum;
+    }
+
+    // the errors of the chunk are found in several passes (packets, sections,
+    // the joints above), so they are merged by packet numbers
+    std::stable_sort(errors.begin(), errors.end(), IsEarlier);
+
+    size_t uCount = m_Errors.size() + errors.size();
+    if (uCount > m_Errors.capacity())
+        m_Errors.reserve(std::max(uCount, m_Errors.capacity() * 2));
+    for (size_t i = 0; i < errors.size(); i++)
+        Add(errors[i]);
+}
+
+//
+// CTSChecker::CheckEnd
+//
+// Checks the intervals from the last table on PAT PID and on PMT PIDs of
+// PIDs to the end of the checked packets; uPacketsCount is their number and
+// uLastOffset is the offset of the last one, where the timeouts are put.
+// These timeouts are taken back by ClearEnd() before more packets are
+// appended, then the interval is checked again up to the next table or the
+// new end. Nothing is checked if uTimeoutPackets is 0 (see Append).
+void CTSChecker::CheckEnd(uint64_t uPacketsCount, uint64_t uLastOffset, uint64_t uTimeoutPackets, const CPIDMap& PIDs)
+{
+    ClearEnd();
+
+    if (uTimeoutPackets == 0 || uPacketsCount == 0 || m_TableNums.empty())
+        return;
+
+    for (uint16_t i = 0; i < CPIDMap::PID_COUNT; i++) {
+        uint64_t uLastNum = m_TableNums[i];
+        if (uLastNum == UINT64_MAX || (i != 0 && !PIDs.IsPMT(i)) || uPacketsCount - uLastNum <= uTimeoutPackets)
+            continue;
+
+        if (m_Errors.size() >= m_uMaxErrors)
+            // the error couldn't be taken back
+            break;
+
+        uint64_t uInterval = (uPacketsCount - uLastNum) * TABLE_TIMEOUT_MS / uTimeoutPackets;
+        AddError((i == 0) ? TS_ERROR::patTimeout : TS_ERROR::pmtTimeout, i, uPacketsCount - 1, uLastOffset, (uint32_t)std::min<uint64_t>(uInterval, UINT32_MAX));
+        m_uEndErrorsCount++;
+    }
+}
+
+//
+// CTSChecker::ClearEnd
+//
+// Takes back the timeouts found by CheckEnd(); they are the last errors.
+void CTSChecker::ClearEnd(void)
+{
+    for (; m_uEndErrorsCount != 0 && !m_Errors.empty(); m_uEndErrorsCount--) {
+        const TS_ERROR& error = m_Errors.back();
+        m_ErrorCounts[error.type]--;
+        m_TypeErrors[error.type].pop_back();
+        m_Errors.pop_back();
+    }
+
+    m_uEndErrorsCount = 0;
+}
+
+//
+// CTSChecker::Save
+//
+// Writes the checker to pData, so that Load() restores it and the next
+// packets can be appended (first packets of PIDs aren't saved).
+void CTSChecker::Save(std::vector<uint8_t>* pData) const
+{
+    CHECKER_HEADER header;
+    memset(&header, 0, sizeof(header));
+    header.uErrorsCount = m_Errors.size();
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++)
+        header.ErrorCounts[i] = m_ErrorCounts[i];
+
+    std::vector<TABLE_RECORD> tables;
+    for (uint16_t i = 0; i < m_TableNums.size(); i++)
+        if (m_TableNums[i] != UINT64_MAX) {
+            TABLE_RECORD record = { i, { 0, 0, 0 }, m_TableNums[i] };
+            tables.push_back(record);
+        }
+    header.uTablesCount = tables.size();
+    header.uEndErrorsCount = m_uEndErrorsCount;
+
+    pData->clear();
+    pData->insert(pData->end(), (const uint8_t*)&header, (const uint8_t*)(&header + 1));
+    pData->insert(pData->end(), (const uint8_t*)m_Errors.data(), (const uint8_t*)(m_Errors.data() + m_Errors.size()));
+    for (size_t i = 0; i < m_CCStates.size(); i++)
+        pData->push_back((uint8_t)m_CCStates[i]);
+    pData->insert(pData->end(), (const uint8_t*)tables.data(), (const uint8_t*)(tables.data() + tables.size()));
+}
+
+//
+// CTSChecker::Load
+//
+// Restores the checker written by Save(). Returns false if the data is
+// broken; the checker is empty then.
+bool CTSChecker::Load(const uint8_t* pbData, size_t uSize)
+{
+    Reset();
+
+    CHECKER_HEADER header;
+    if (uSize < sizeof(header))
+        return false;
+    memcpy(&header, pbData, sizeof(header));
+    pbData += sizeof(header);
+    uSize -= sizeof(header);
+
+    if (header.uErrorsCount > uSize / sizeof(TS_ERROR)
+        || header.uEndErrorsCount > header.uErrorsCount
+        || header.uTablesCount > CPIDMap::PID_COUNT
+        || uSize != header.uErrorsCount * sizeof(TS_ERROR) + CPIDMap::PID_COUNT + header.uTablesCount * sizeof(TABLE_RECORD))
+        return false;
+
+    m_Errors.reserve((size_t)header.uErrorsCount);
+    for (uint64_t i = 0; i < header.uErrorsCount; i++, pbData += sizeof(TS_ERROR)) {
+        TS_ERROR error;
+        memcpy(&error, pbData, sizeof(error));
+        if (error.type >= TS_ERROR::TYPES_COUNT || (!m_Errors.empty() && error.uPacketNum < m_Errors.back().uPacketNum)) {
+            Reset();
+            return false;
+        }
+
+        Add(error);
+    }
+
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++)
+        m_ErrorCounts[i] = header.ErrorCounts[i];
+    m_uEndErrorsCount = header.uEndErrorsCount;
+
+    for (size_t i = 0; i < CPIDMap::PID_COUNT; i++)
+        m_CCStates[i] = *pbData++;
+
+    m_TableNums.assign(CPIDMap::PID_COUNT, UINT64_MAX);
+    for (uint64_t i = 0; i < header.uTablesCount; i++, pbData += sizeof(TABLE_RECORD)) {
+        TABLE_RECORD record;
+        memcpy(&record, pbData, sizeof(record));
+        m_TableNums[record.PID & (CPIDMap::PID_COUNT - 1)] = record.uPacketNum;
+    }
+
+    return true;
+}
+
+//
+// CTSChecker::GetErrorsCount
+//
+// Returns the number of found errors of iType (TS_ERROR::Type) or of all
+// types if iType is -1, including the ones whose locations aren't kept.
+uint64_t CTSChecker::GetErrorsCount(int iType /* = -1 */) const
+{
+    if (iType >= 0)
+        return (iType < TS_ERROR::TYPES_COUNT) ? m_ErrorCounts[iType] : 0;
+
+    uint64_t uCount = 0;
+    for (int i = 0; i < TS_ERROR::TYPES_COUNT; i++)
+        uCount += m_ErrorCounts[i];
+
+    return uCount;
+}
+
+//
+// CTSChecker::GetKeptErrorsCount
+//
+// Returns the number of errors of iType (or of all types) that can be got by
+// GetError().
+uint64_t CTSChecker::GetKeptErrorsCount(int iType /* = -1 */) const
+{
+    if (iType >= 0)
+        return (iType < TS_ERROR::TYPES_COUNT) ? m_TypeErrors[iType].size() : 0;
+
+    return m_Errors.size();
+}
+
+//
+// CTSChecker::GetError
+//
+// Gets the error number uIndex among the kept errors of iType (or of all
+// types), which are in packet order.
+bool CTSChecker::GetError(uint64_t uIndex, TS_ERROR* pError, int iType /* = -1 */) const
+{
+    if (uIndex >= GetKeptErrorsCount(iType))
+        return false;
+
+    *pError = m_Errors[(size_t)((iType >= 0) ? m_TypeErrors[iType][(size_t)uIndex] : uIndex)];
+    return true;
+}
+
+//
+// CTSChecker::FindError
+//
+// Returns the index (see GetError) of the first kept error of iType (or of
+// all types) in packet uPacketNum or after it, or GetKeptErrorsCount(iType)
+// if there are none; the error before the packet is the previous one.
+uint64_t CTSChecker::FindError(uint64_t uPacketNum, int iType /* = -1 */) const
+{
+    if (iType < 0)
+        return std::lower_bound(m_Errors.begin(), m_Errors.end(), uPacketNum,
+                   [](const TS_ERROR& error, uint64_t uNum) { return error.uPacketNum < uNum; })
+            - m_Errors.begin();
+
+    if (iType >= TS_ERROR::TYPES_COUNT)
+        return 0;
+
+    const std::vector<uint64_t>& indexes = m_TypeErrors[iType];
+    return std::lower_bound(indexes.begin(), indexes.end(), uPacketNum,
+               [this](uint64_t uIndex, uint64_t uNum) { return m_Errors[(size_t)uIndex].uPacketNum < uNum; })
+        - indexes.begin();
+}
+
+//
+// CTSChecker::GetTypeName
+//
+// Returns the name of TS_ERROR::Type for reports.
+const char* CTSChecker::GetTypeName(int iType)
+{
+    static const char* const names[TS_ERROR::TYPES_COUNT] = {
+        "Sync loss", "PAT error", "PAT timeout", "Continuity error", "PMT error", "PMT timeout", "Transport error"
+    };
+
+    return (iType >= 0 && iType < TS_ERROR::TYPES_COUNT) ? names[iType] : "";
+}
+
+//
+// CTSChecker::AddFirst
+//
+// Remembers the first packet of PID, which Append() checks against the
+// previous packets of the PID.
+void CTSChecker::AddFirst(const uint8_t* pb, uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset)
+{
+    m_CCStates[uPID] = CC_KNOWN | (pb[3] & CC_MASK);
+
+    FIRST_PACKET first = { uPacketNum, uOffset, uPID, pb[3], IsDiscontinuity(pb) };
+    m_FirstPackets.push_back(first);
+}
+
+void CTSChecker::Add(const TS_ERROR& error)
+{
+    if (m_Errors.size() >= m_uMaxErrors)
+        return;
+
+    m_TypeErrors[error.type].push_back(m_Errors.size());
+    m_Errors.push_back(error);
+}
@@ -0,0 +1,212 @@
+/*******************************************************************************
+ * File: TSChecker.h
+ *
+ * Description:
+ *    CTSChecker class definition. This class checks packets of MPEG-2
+ *    Transport Stream for the errors of priority 1 of ETSI TR 101 290 (sync
+ *    loss, PAT and PMT errors and timeouts, continuity_counter errors) and
+ *    for transport_error_indicator (priority 2), and remembers where each
+ *    error is. The errors are kept in packet order, so the ones near any
+ *    packet are found by binary search.
+ *
+ *    A file is checked in chunks, each one by its own checker (see CTSIndex);
+ *    Append() joins the chunk to the checked packets and checks what can't be
+ *    checked inside the chunk: counters of the first packets of each PID and
+ *    the intervals between tables, which need the bitrate of TS. CheckEnd()
+ *    checks the intervals from the last tables to the end of the packets.
+ *
+ *    See section 2.4.3.3 (continuity_counter, discontinuity_indicator) in
+ *    ISO/IEC 13818-1 second edition (2000-12-01) and section 5.2.1 in
+ *    ETSI TR 101 290 V1.2.1 (2001-05).
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _TS_CHECKER_H_
+#define _TS_CHECKER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "packet.h"
+
+//
+// Class and structures defined in this file
+//
+class CTSChecker;
+
+struct TS_ERROR;
+struct TABLE_ARRIVAL;
+
+//
+// Class and structures definitions
+//
+
+// Error found in TS (see CTSChecker::GetError).
+struct TS_ERROR {
+    enum Type {
+        syncLoss = 0, // garbage between packets (1.1, 1.2); uDetail is its size in bytes
+        patError, // PID 0 carries other table or is scrambled (1.3)
+        patTimeout, // PA Sections are more than 0.5 s apart (1.3) or the last one is more than 0.5 s before the end; uDetail is the interval in ms
+        continuity, // wrong continuity_counter (1.4); uDetail is expected << 4 | found one
+        pmtError, // PMT PID is scrambled (1.5)
+        pmtTimeout, // PM Sections on PID are more than 0.5 s apart (1.5) or before the end, like patTimeout
+        transportError, // transport_error_indicator is set (2.1)
+        TYPES_COUNT
+    };
+
+    uint64_t uPacketNum; // zero-based number of packet where the error is found
+    uint64_t uOffset; // offset of that packet, of the first garbage byte for syncLoss
+    uint32_t uDetail;
+    uint16_t PID; // NULL_PACKET for syncLoss
+    uint8_t type; // Type
+    uint8_t reserved;
+};
+
+// Section of PAT or PMT completed in TS; the interval since the previous one
+// on the same PID is checked by CTSChecker::Append().
+struct TABLE_ARRIVAL {
+    uint64_t uPacketNum;
+    uint64_t uOffset;
+    uint16_t PID;
+    uint8_t type; // TS_ERROR::patTimeout or TS_ERROR::pmtTimeout
+};
+
+class CTSChecker {
+public:
+    // constants
+    static const uint64_t TABLE_TIMEOUT_MS = 500; // PAT and PMT must be repeated at least this often
+
+public:
+    CTSChecker(void);
+
+    void Reset(size_t uMaxErrors = SIZE_MAX);
+    void Swap(CTSChecker& checker);
+
+    //
+    // CTSChecker::CheckPacket
+    //
+    // Checks transport_error_indicator and continuity_counter of the packet.
+    // Packets of each PID must be checked in the order they are met in TS.
+    // Null packets and packets with transport errors aren't checked for
+    // continuity: the counter of the first ones isn't defined and the header
+    // of the second ones can't be trusted, so the counter of the next packet
+    // of PID is taken as is.
+    void CheckPacket(const uint8_t* pb, uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset)
+    {
+        if ((pb[1] & 0x80) != 0) {
+            AddError(TS_ERROR::transportError, uPID, uPacketNum, uOffset);
+            m_CCStates[uPID] = CC_KNOWN | CC_RESYNC;
+            return;
+        }
+
+        if (uPID == CPacket::NULL_PACKET)
+            return;
+
+        uint16_t& uState = m_CCStates[uPID];
+        if (uState == 0) {
+            AddFirst(pb, uPID, uPacketNum, uOffset);
+            return;
+        }
+
+        uint8_t bExpected = 0;
+        if (!CheckCC(&uState, pb[3], IsDiscontinuity(pb), &bExpected))
+            AddError(TS_ERROR::continuity, uPID, uPacketNum, uOffset, (uint32_t)(bExpected << 4 | (pb[3] & 0x0F)));
+    }
+
+    void AddError(TS_ERROR::Type type, uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset, uint32_t uDetail = 0);
+    void Append(CTSChecker& checker, uint64_t uFirstPacketNum, const std::vector<TABLE_ARRIVAL>& arrivals, uint64_t uTimeoutPackets);
+    void CheckEnd(uint64_t uPacketsCount, uint64_t uLastOffset, uint64_t uTimeoutPackets, const CPIDMap& PIDs);
+    void ClearEnd(void);
+
+    void Save(std::vector<uint8_t>* pData) const;
+    bool Load(const uint8_t* pbData, size_t uSize);
+
+    uint64_t GetErrorsCount(int iType = -1) const;
+    uint64_t GetKeptErrorsCount(int iType = -1) const;
+    bool GetError(uint64_t uIndex, TS_ERROR* pError, int iType = -1) const;
+    uint64_t FindError(uint64_t uPacketNum, int iType = -1) const;
+
+    static const char* GetTypeName(int iType);
+
+private:
+    CTSChecker(const CTSChecker&);
+    CTSChecker& operator=(const CTSChecker&);
+
+    // state of continuity_counter of PID (see m_CCStates): 0 until the first packet
+    static const uint8_t CC_KNOWN = 0x80;
+    static const uint8_t CC_DUPLICATE = 0x10; // the last packet is repeated once
+    static const uint8_t CC_RESYNC = 0x20; // the last packet is broken, any counter is right
+    static const uint8_t CC_MASK = 0x0F;
+
+    // the first packet of PID in the checked packets; it's checked against
+    // the packets before them by Append()
+    struct FIRST_PACKET {
+        uint64_t uPacketNum;
+        uint64_t uOffset;
+        uint16_t PID;
+        uint8_t bHeader; // the 4th byte of the header: adaptation_field_control, continuity_counter
+        bool fDiscontinuity;
+    };
+
+    static bool IsDiscontinuity(const uint8_t* pb)
+    {
+        // discontinuity_indicator is the first flag of non-empty adaptation field
+        return (pb[3] & 0x20) != 0 && pb[4] != 0 && (pb[5] & 0x80) != 0;
+    }
+
+    //
+    // CTSChecker::CheckCC
+    //
+    // Checks continuity_counter in bHeader (the 4th byte of packet) against
+    // the state of its PID and updates the state. The counter grows by one in
+    // each packet with payload and stays the same in packets without it; one
+    // duplicate packet is allowed. Returns false and sets *pbExpected if the
+    // counter is wrong.
+    static bool CheckCC(uint16_t* puState, uint8_t bHeader, bool fDiscontinuity, uint8_t* pbExpected)
+    {
+        uint8_t bCC = bHeader & CC_MASK;
+        uint8_t bLast = *puState & CC_MASK;
+
+        if (*puState == 0 || (*puState & CC_RESYNC) != 0 || fDiscontinuity) {
+            *puState = CC_KNOWN | bCC;
+            return true;
+        }
+
+        if ((bHeader & 0x10) == 0) {
+            if (bCC == bLast)
+                return true;
+
+            *pbExpected = bLast;
+        } else if (bCC == ((bLast + 1) & CC_MASK)) {
+            *puState = CC_KNOWN | bCC;
+            return true;
+        } else if (bCC == bLast && (*puState & CC_DUPLICATE) == 0) {
+            *puState |= CC_DUPLICATE;
+            return true;
+        } else {
+            *pbExpected = (bLast + 1) & CC_MASK;
+        }
+
+        *puState = CC_KNOWN | bCC;
+        return false;
+    }
+
+    void AddFirst(const uint8_t* pb, uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset);
+    void Add(const TS_ERROR& error);
+
+private:
+    size_t m_uMaxErrors; // locations of the errors above this number aren't kept
+    std::vector<TS_ERROR> m_Errors; // in packet order
+    std::vector<uint64_t> m_TypeErrors[TS_ERROR::TYPES_COUNT]; // indexes in m_Errors for each type
+    uint64_t m_ErrorCounts[TS_ERROR::TYPES_COUNT]; // found errors, kept or not
+
+    std::vector<uint16_t> m_CCStates; // for each PID; not bytes, so that stores to them don't alias other data
+    std::vector<FIRST_PACKET> m_FirstPackets;
+    std::vector<uint64_t> m_TableNums; // number of packet with the last table on PID, UINT64_MAX if none
+    uint64_t m_uEndErrorsCount; // the last errors, found by CheckEnd()
+};
+
+#endif // _TS_CHECKER_H_
@@ -0,0 +1,284 @@
+/*******************************************************************************
+ * File: TSFile.cpp
+ *
+ * Description: CTSFile class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "ts_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 64-bit positioning in buffered mode; off_t is 64-bit because of
+// _FILE_OFFSET_BITS=64 (see CMakeLists.txt)
+#ifdef _WIN32
+#define FSEEK64(f, offset, origin) _fseeki64((f), (__int64)(offset), (origin))
+#define FTELL64(f) _ftelli64(f)
+#else
+#define FSEEK64(f, offset, origin) fseeko((f), (off_t)(offset), (origin))
+#define FTELL64(f) ftello(f)
+#endif
+
+CTSFile::CTSFile(void)
+{
+}
+
+CTSFile::~CTSFile(void)
+{
+    Close();
+}
+
+//
+// CTSFile::Open
+//
+// Tries to map a regular file into memory. If it's impossible, reads the file
+// through a buffer.
+//
+// Inputs that can be read only forward (pipes, FIFOs, sockets, some devices)
+// aren't opened: the index is built by reading the beginning of the file more
+// than once and sections are read back at their offsets. Returns false and
+// sets errno to ESPIPE for them; they are read by CTSStream.
+bool CTSFile::Open(const std::string& szFileName)
+{
+    Close();
+
+#ifndef _WIN32
+    struct stat st;
+    // a FIFO isn't even opened: its writer would lose the reader when it's
+    // closed, and the open would wait for a writer
+    if (stat(szFileName.c_str(), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))) {
+        errno = ESPIPE;
+        return false;
+    }
+
+    int fd = open(szFileName.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    // files larger than address space (on 32-bit systems) are read through a buffer
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX) {
+        void* pMap = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pMap != MAP_FAILED) {
+            m_pbMap = (const uint8_t*)pMap;
+            m_uSize = (uint64_t)st.st_size;
+            m_uMapSize = m_uSize;
+
+            // the descriptor is kept for Refresh()
+            m_iFile = fd;
+            return true;
+        }
+    }
+
+    // the descriptor is kept, so a device isn't opened twice
+    m_hFile = fdopen(fd, "rb");
+    if (m_hFile == nullptr) {
+        close(fd);
+        return false;
+    }
+#else
+    m_hFile = std::fopen(szFileName.c_str(), "rb");
+    if (m_hFile == nullptr)
+        return false;
+#endif
+
+    int64_t size = (FSEEK64(m_hFile, 0, SEEK_END) == 0) ? FTELL64(m_hFile) : -1;
+    if (size < 0 || FSEEK64(m_hFile, 0, SEEK_SET) != 0) {
+        Close();
+        errno = ESPIPE;
+        return false;
+    }
+
+    m_uSize = (uint64_t)size;
+    m_uPosition = 0;
+    return true;
+}
+
+void CTSFile::Close(void)
+{
+#ifndef _WIN32
+    if (m_pbMap != nullptr) {
+        munmap((void*)m_pbMap.load(), (size_t)m_uMapSize);
+        m_pbMap = nullptr;
+    }
+
+    for (size_t i = 0; i < m_OldMaps.size(); i++)
+        munmap((void*)m_OldMaps[i].first, (size_t)m_OldMaps[i].second);
+    m_OldMaps.clear();
+
+    if (m_iFile != -1) {
+        close(m_iFile);
+        m_iFile = -1;
+    }
+#endif
+
+    if (m_hFile != nullptr) {
+        fclose(m_hFile);
+        m_hFile = nullptr;
+    }
+
+    m_uSize = 0;
+    m_uMapSize = 0;
+    m_uPosition = 0;
+}
+
+//
+// CTSFile::Refresh
+//
+// Takes the data appended to the file since it was opened or refreshed, e.g.
+// by a recorder that is still writing it; GetSize() grows then. Pointers
+// returned by Read() before stay valid until Close().
+//
+// A mapped file is mapped again with a reserve beyond its end, so the file
+// that grows all the time is remapped only when it doubles. The reserve is
+// never read: Read() gives out only the bytes below GetSize().
+//
+// Returns false if the file became smaller (it's truncated or replaced) and
+// should be opened again; the old size is kept then.
+bool CTSFile::Refresh(void)
+{
+#ifndef _WIN32
+    if (m_pbMap != nullptr) {
+        struct stat st;
+        if (fstat(m_iFile, &st) != 0 || (uint64_t)st.st_size < m_uSize)
+            return false;
+
+        uint64_t uSize = (uint64_t)st.st_size;
+        if (uSize > m_uMapSize) {
+            uint64_t uMapSize = std::max(uSize, std::min<uint64_t>(m_uMapSize * 2, SIZE_MAX));
+            if (uMapSize > SIZE_MAX)
+                // can't be mapped on 32-bit systems; the appended data is unavailable
+                return true;
+
+            void* pMap = mmap(NULL, (size_t)uMapSize, PROT_READ, MAP_PRIVATE, m_iFile, 0);
+            if (pMap == MAP_FAILED)
+                return true;
+
+            // readers that took the old size still use the old mapping, so the
+            // mapping is replaced before the size grows
+            m_OldMaps.push_back(std::make_pair(m_pbMap.load(), m_uMapSize));
+            m_pbMap = (const uint8_t*)pMap;
+            m_uMapSize = uMapSize;
+        }
+
+        m_uSize = uSize;
+        return true;
+    }
+#endif
+
+    if (m_hFile == nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    int64_t size = (FSEEK64(m_hFile, 0, SEEK_END) == 0) ? FTELL64(m_hFile) : -1;
+    if (size < 0) {
+        // the position is unknown, so the next Read() seeks
+        clearerr(m_hFile);
+        m_uPosition = UINT64_MAX;
+        return false;
+    }
+
+    m_uPosition = (uint64_t)size;
+    if ((uint64_t)size < m_uSize)
+        return false;
+
+    m_uSize = (uint64_t)size;
+    return true;
+}
+
+bool CTSFile::IsOpened(void) const
+{
+    return (m_pbMap != nullptr || m_hFile != nullptr);
+}
+
+bool CTSFile::IsMapped(void) const
+{
+    return (m_pbMap != nullptr);
+}
+
+//
+// CTSFile::GetSize
+//
+// Returns size of the file in bytes.
+uint64_t CTSFile::GetSize(void) const
+{
+    return m_uSize;
+}
+
+//
+// CTSFile::Advise
+//
+// Tells the OS how the data is going to be accessed, so it can read ahead
+// (sequential) or avoid useless read ahead (random).
+void CTSFile::Advise(Access access) const
+{
+#ifndef _WIN32
+    if (m_pbMap != nullptr)
+        madvise((void*)m_pbMap.load(), (size_t)m_uSize, access == sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#if defined(POSIX_FADV_SEQUENTIAL)
+    else if (m_hFile != nullptr)
+        posix_fadvise(fileno(m_hFile), 0, 0, access == sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+#endif
+#else
+    (void)access;
+#endif
+}
+
+//
+// CTSFile::Read
+//
+// Gives access to uSize bytes starting at uOffset. If the file is mapped,
+// returns a pointer straight into the mapping and pbBuffer isn't used.
+// Otherwise reads the data into pbBuffer (at least uSize bytes) and returns it.
+//
+// On return uSize holds the number of bytes available, it's less than
+// requested at the end of file. Returns NULL if nothing can be read.
+const uint8_t* CTSFile::Read(uint64_t uOffset, size_t& uSize, uint8_t* pbBuffer) const
+{
+    // the size is taken before the mapping: Refresh() replaces the mapping
+    // first, so it's long enough for this size
+    uint64_t uFileSize = m_uSize;
+    const uint8_t* pbMap = m_pbMap;
+    if (pbMap != nullptr) {
+        if (uOffset >= uFileSize) {
+            uSize = 0;
+            return NULL;
+        }
+
+        if (uSize > uFileSize - uOffset)
+            uSize = (size_t)(uFileSize - uOffset);
+
+        return (pbMap + uOffset);
+    }
+
+    if (m_hFile == nullptr) {
+        uSize = 0;
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (uOffset != m_uPosition) {
+        if (FSEEK64(m_hFile, uOffset, SEEK_SET) != 0) {
+            uSize = 0;
+            return NULL;
+        }
+
+        m_uPosition = uOffset;
+    }
+
+    uSize = fread(pbBuffer, 1, uSize, m_hFile);
+    m_uPosition += uSize;
+
+    return (uSize ? pbBuffer : NULL);
+}
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ * File: TSFile.h
+ *
+ * Description:
+ *    CTSFile class definition. This class gives read-only access to a file
+ *    with MPEG-2 Transport Stream. Regular files are memory-mapped, so the
+ *    data is accessed in place without copying; other inputs that can be
+ *    seeked (devices, files larger than address space) are read through a
+ *    buffer. Inputs that can be read only forward, like pipes, are read by
+ *    CTSStream instead.
+ *
+ *    Read() can be called from several threads at once, also while Refresh()
+ *    takes the data appended to a growing file.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _TS_FILE_H_
+#define _TS_FILE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class CTSFile {
+public:
+    // hints about the way the data will be accessed
+    enum Access {
+        sequential,
+        random
+    };
+
+public:
+    CTSFile(void);
+    ~CTSFile(void);
+
+    bool Open(const std::string& szFileName);
+    void Close(void);
+    bool Refresh(void);
+
+    bool IsOpened(void) const;
+    bool IsMapped(void) const;
+    uint64_t GetSize(void) const;
+
+    void Advise(Access access) const;
+
+    const uint8_t* Read(uint64_t uOffset, size_t& uSize, uint8_t* pbBuffer) const;
+
+private:
+    CTSFile(const CTSFile&);
+    CTSFile& operator=(const CTSFile&);
+
+private:
+    // memory-mapped mode; the mapping may be longer than the file, so it
+    // isn't replaced each time the file grows (see Refresh)
+    std::atomic<const uint8_t*> m_pbMap { nullptr };
+    std::atomic<uint64_t> m_uSize { 0 };
+    uint64_t m_uMapSize = 0;
+    int m_iFile = -1; // descriptor of the mapped file
+    std::vector<std::pair<const uint8_t*, uint64_t>> m_OldMaps; // replaced by Refresh, still used by readers
+
+    // buffered mode, used when the file can't be mapped
+    std::FILE* m_hFile = nullptr;
+    mutable uint64_t m_uPosition = 0; // current position of m_hFile
+    mutable std::mutex m_Mutex; // guards m_hFile, it's read by several threads
+};
+
+#endif // _TS_FILE_H_
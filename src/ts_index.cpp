@@ -0,0 +1,2194 @@
+/*******************************************************************************
+ * File: TSIndex.cpp
+ *
+ * Description: CTSIndex class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "ts_index.h"
+#include "pmt_view.h"
+#include "psi_collector.h"
+#include "ts_sync.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+// number of packets in the block read at once while scanning the file
+static const size_t SCAN_BLOCK_PACKETS = 8192;
+
+// value of PMS_INDEX_ENTRY::uPAS for PM Sections met in a chunk before its
+// first PA Section; they are resolved when the chunk is appended to the index
+static const uint32_t UNKNOWN_PAS = UINT32_MAX;
+
+// a section left incomplete at the end of file is completed by Update() only
+// if it starts within this number of bytes before the end; PIDs that stopped
+// in the middle of a section would make each update rescan more data otherwise
+static const uint64_t RESUME_LIMIT = 1024 * 1024;
+
+// intervals between PCRs of a PID that are longer than this (or negative) are
+// discontinuities and aren't counted in the bitrate; the standard limits them
+// to 100 ms, but recordings aren't always that strict
+static const uint64_t MAX_PCR_INTERVAL = CPacket::PCR_CLOCK;
+
+// peaks are taken for each full block of packets (see ForEachPacket)
+static_assert(CTSIndex::PEAK_WINDOW_PACKETS == SCAN_BLOCK_PACKETS, "peak window must be a scan block");
+
+//
+// Saved index file (see CTSIndex::Save). Numbers are in the byte order of the
+// machine that wrote the file; a file with other byte order, version or size
+// of entries isn't loaded and is rewritten after the file is indexed again.
+//
+static const char INDEX_SIGNATURE[8] = { 'P', 'M', 'T', 'I', 'N', 'D', 'E', 'X' };
+static const uint32_t INDEX_VERSION = 10;
+static const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+// PMS entries are written and mapped as they are in memory
+static_assert(sizeof(PMS_INDEX_ENTRY) == 32, "PMS_INDEX_ENTRY must have no padding");
+
+struct INDEX_FILE_HEADER {
+    char signature[8];
+    uint32_t uVersion;
+    uint32_t uByteOrder;
+    uint32_t uHeaderSize;
+    uint32_t uEntrySize; // size of PMS_INDEX_ENTRY
+    INDEX_KEY key;
+    uint64_t uPacketSize;
+    uint64_t uPacketsCount;
+    uint64_t uSyncLossCount;
+    uint64_t uNextPacketOffset;
+    uint64_t uResumeOffset;
+    uint64_t uPMSCount;
+    uint64_t uPMSOffset; // array of PMS_INDEX_ENTRY, 8-byte aligned
+    uint64_t uProgramSectionsOffset; // uPMSCount indexes of PM Sections (uint64_t) grouped by program, 8-byte aligned
+    uint64_t uPASCount;
+    uint64_t uPASOffset; // PAS_RECORD, each one is followed by its programs
+    uint64_t uPASSize;
+    uint64_t uPeakWindowsCount;
+    uint64_t uPIDStatsCount;
+    uint64_t uPIDStatsOffset; // array of PID_RECORD for PIDs that have packets
+    uint64_t uPCRRatesCount;
+    uint64_t uPCRRatesOffset; // array of PCR_RECORD
+    uint64_t uCheckerSize;
+    uint64_t uCheckerOffset; // see CTSChecker::Save
+    uint64_t uPCRIndexCount;
+    uint64_t uPCRIndexOffset; // array of PCR_INDEX_RECORD, grouped by PID
+    uint64_t uPMSChangesCount;
+    uint64_t uPMSChangesOffset; // array of uint64_t, indexes of PM Sections where programs change
+    uint64_t uProgramsCount;
+    uint64_t uProgramsOffset; // array of PROGRAM_SECTIONS_RECORD, in order of program sections
+};
+
+// program_number takes 16 bits
+static const size_t PROGRAM_NUMBERS_COUNT = 0x10000;
+
+struct PAS_RECORD {
+    uint8_t table_id;
+    uint8_t section_syntax_indicator;
+    uint8_t bit_null;
+    uint8_t reserved_1;
+    uint8_t reserved_2;
+    uint8_t version_number;
+    uint8_t current_next_indicator;
+    uint8_t section_number;
+    uint8_t last_section_number;
+    uint16_t section_length;
+    uint16_t transport_stream_id;
+    uint32_t uProgramsCount;
+    uint32_t CRC_32;
+};
+
+struct PROGRAM_RECORD {
+    uint16_t program_number;
+    uint16_t reserved;
+    uint16_t PID;
+};
+
+struct PID_RECORD {
+    uint16_t PID;
+    uint16_t reserved;
+    uint32_t uPeakCount;
+    uint64_t uPacketsCount;
+};
+
+struct PCR_RECORD {
+    uint16_t PID;
+    uint16_t reserved[3];
+    uint64_t uPackets;
+    uint64_t uTicks;
+};
+
+struct PCR_INDEX_RECORD {
+    uint16_t PID;
+    uint16_t reserved[3];
+    PCR_INDEX_ENTRY entry;
+};
+
+struct PROGRAM_SECTIONS_RECORD {
+    uint16_t program_number;
+    uint16_t reserved[3];
+    uint64_t uSectionsCount;
+};
+
+// PCR met in a chunk; Append() counts it if PID is PCR PID by then
+struct PCR_SAMPLE {
+    uint64_t uPacketNum;
+    uint64_t uOffset;
+    uint64_t uPCR;
+    uint16_t PID;
+};
+
+// PM Section of a chunk that names PCR PID; PCRs of PID are counted after the
+// packet that completes the section
+struct PCR_PID_ENTRY {
+    size_t uPMS; // number of the section in CHUNK::PMSIndex
+    uint64_t uPacketNum;
+    uint16_t PID;
+};
+
+//
+// Result of scanning one chunk of a file. uPAS of PM Section entries refers
+// to PASections of the chunk.
+//
+// Packets before uIndexedEnd are already in the index (the chunk is scanned by
+// Update() from CTSIndex::m_uResumeOffset or from the last window of peak
+// bitrate); they are scanned only to complete the sections that were
+// incomplete at the end of file and that window, and aren't counted.
+//
+struct CTSIndex::CHUNK {
+    void Swap(CHUNK& chunk)
+    {
+        std::swap(fCompleted, chunk.fCompleted);
+        std::swap(uIndexedEnd, chunk.uIndexedEnd);
+        std::swap(uPacketsCount, chunk.uPacketsCount);
+        std::swap(uFirstPASOffset, chunk.uFirstPASOffset);
+        std::swap(uFirstPacketOffset, chunk.uFirstPacketOffset);
+        std::swap(uNextPacketOffset, chunk.uNextPacketOffset);
+        std::swap(uSyncLossCount, chunk.uSyncLossCount);
+        std::swap(uResumeOffset, chunk.uResumeOffset);
+        PMSIndex.swap(chunk.PMSIndex);
+        PASections.swap(chunk.PASections);
+        PIDCounts.swap(chunk.PIDCounts);
+        PIDPeakCounts.swap(chunk.PIDPeakCounts);
+        std::swap(uPeakWindowsCount, chunk.uPeakWindowsCount);
+        PCRs.swap(chunk.PCRs);
+        PCRPIDs.swap(chunk.PCRPIDs);
+        Checker.Swap(chunk.Checker);
+        PATArrivals.swap(chunk.PATArrivals);
+    }
+
+    bool fCompleted = false; // chunk is scanned up to the end, not canceled
+    uint64_t uIndexedEnd = 0;
+    uint64_t uPacketsCount = 0;
+    uint64_t uFirstPASOffset = UINT64_MAX; // offset of packet that completes the first PA Section
+    uint64_t uFirstPacketOffset = UINT64_MAX; // UINT64_MAX if there are no packets in the chunk
+    uint64_t uNextPacketOffset = UINT64_MAX; // offset of the packet expected after the chunk
+    uint64_t uSyncLossCount = 0; // sync losses inside the chunk
+    uint64_t uResumeOffset = UINT64_MAX; // offset of the first section left incomplete at the end of file or uNextPacketOffset
+    std::vector<PMS_INDEX_ENTRY> PMSIndex;
+    std::vector<PA_SECTION> PASections;
+
+    // statistics of the chunk, merged by Append()
+    std::vector<uint64_t> PIDCounts;
+    std::vector<uint32_t> PIDPeakCounts;
+    uint64_t uPeakWindowsCount = 0;
+    std::vector<PCR_SAMPLE> PCRs; // PCRs of each PID, in order of packets
+    std::vector<PCR_PID_ENTRY> PCRPIDs; // in order of packets
+
+    // errors in the chunk; the numbers of packets start from its first one
+    CTSChecker Checker;
+    std::vector<TABLE_ARRIVAL> PATArrivals; // PA Sections, for timeouts
+};
+
+static bool IsSamePAS(const PA_SECTION& a, const PA_SECTION& b)
+{
+    return (a.version_number == b.version_number && a.CRC_32 == b.CRC_32);
+}
+
+//
+// GetPCRTicks
+//
+// Returns the ticks of PCR clock from uFromPCR to uToPCR; PCR wraps around.
+static uint64_t GetPCRTicks(uint64_t uFromPCR, uint64_t uToPCR)
+{
+    return (uToPCR >= uFromPCR) ? uToPCR - uFromPCR : uToPCR + CPacket::PCR_PERIOD - uFromPCR;
+}
+
+//
+// IsValidPCRIndex
+//
+// Returns true if the saved PCR index is grouped by PID and the entries of
+// each PID go in order of packets and time, as binary search needs.
+static bool IsValidPCRIndex(const std::vector<PCR_INDEX_RECORD>& records)
+{
+    std::vector<bool> PIDs(CPIDMap::PID_COUNT);
+    for (size_t i = 0; i < records.size(); i++) {
+        const PCR_INDEX_RECORD& record = records[i];
+        if (record.PID >= CPIDMap::PID_COUNT)
+            return false;
+
+        if (i != 0 && record.PID == records[i - 1].PID) {
+            if (record.entry.uPacketNum <= records[i - 1].entry.uPacketNum || record.entry.uTime < records[i - 1].entry.uTime)
+                return false;
+        } else {
+            if (PIDs[record.PID])
+                return false;
+
+            PIDs[record.PID] = true;
+        }
+    }
+
+    return true;
+}
+
+//
+// IsValidPMSChanges
+//
+// Returns true if the saved PM Sections where programs change are indexes of
+// PM Sections in increasing order.
+static bool IsValidPMSChanges(const std::vector<uint64_t>& changes, uint64_t uPMSCount)
+{
+    for (size_t i = 0; i < changes.size(); i++)
+        if (changes[i] >= uPMSCount || (i != 0 && changes[i] <= changes[i - 1]))
+            return false;
+
+    return true;
+}
+
+//
+// IsValidPrograms
+//
+// Returns true if each saved program is met once, has sections and all PM
+// Sections belong to the programs.
+static bool IsValidPrograms(const std::vector<PROGRAM_SECTIONS_RECORD>& records, uint64_t uPMSCount)
+{
+    std::vector<bool> programs(PROGRAM_NUMBERS_COUNT);
+    uint64_t uSectionsCount = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        const PROGRAM_SECTIONS_RECORD& record = records[i];
+        if (programs[record.program_number] || record.uSectionsCount == 0 || record.uSectionsCount > uPMSCount - uSectionsCount)
+            return false;
+
+        programs[record.program_number] = true;
+        uSectionsCount += record.uSectionsCount;
+    }
+
+    return uSectionsCount == uPMSCount;
+}
+
+//
+// IsValidProgramSections
+//
+// Returns true if the saved sections of the program are indexes of PM
+// Sections of program_number in increasing order. pSeen marks the sections
+// met, so each PM Section must belong to one program only.
+static bool IsValidProgramSections(const uint64_t* pSections, uint64_t uCount, uint16_t program_number,
+    const PMS_INDEX_ENTRY* pEntries, uint64_t uPMSCount, std::vector<bool>* pSeen)
+{
+    if (uCount != 0 && pSections == NULL)
+        return false;
+
+    for (uint64_t i = 0; i < uCount; i++) {
+        uint64_t uPMS = pSections[i];
+        if (uPMS >= uPMSCount || (i != 0 && uPMS <= pSections[i - 1]) || (*pSeen)[(size_t)uPMS]
+            || pEntries[uPMS].program_number != program_number)
+            return false;
+
+        (*pSeen)[(size_t)uPMS] = true;
+    }
+
+    return true;
+}
+
+//
+// AddPCREntry
+//
+// Adds the entry of the last PCR met to the PCR index of PID. The index keeps
+// the first PCR in each PCR_INDEX_INTERVAL of time from the beginning of the
+// file and the last PCR, so the last entry is replaced if it's in the same
+// interval as the one before it. The intervals don't depend on where indexing
+// is resumed, so Update() keeps the same PCRs as Build().
+static void AddPCREntry(std::vector<PCR_INDEX_ENTRY>* pEntries, const PCR_INDEX_ENTRY& entry)
+{
+    size_t uCount = pEntries->size();
+    if (uCount >= 2 && (*pEntries)[uCount - 1].uTime / CTSIndex::PCR_INDEX_INTERVAL == (*pEntries)[uCount - 2].uTime / CTSIndex::PCR_INDEX_INTERVAL)
+        pEntries->back() = entry;
+    else
+        pEntries->push_back(entry);
+}
+
+//
+// ReadRecords
+//
+// Reads uCount records of the saved index starting from uOffset. Returns
+// false if the file is shorter.
+template <class T>
+static bool ReadRecords(const CTSFile& file, uint64_t uOffset, uint64_t uCount, std::vector<T>* pRecords)
+{
+    pRecords->resize((size_t)uCount);
+
+    size_t uSize = pRecords->size() * sizeof(T);
+    if (uSize == 0)
+        return true;
+
+    const uint8_t* pb = file.Read(uOffset, uSize, (uint8_t*)pRecords->data());
+    if (pb == NULL || uSize != pRecords->size() * sizeof(T))
+        return false;
+
+    if (pb != (const uint8_t*)pRecords->data())
+        memcpy(pRecords->data(), pb, uSize);
+
+    return true;
+}
+
+CTSIndex::CTSIndex(void)
+{
+}
+
+//
+// CTSIndex::Build
+//
+// Scans the whole file and builds the index. Packet size (188, 192 or 204
+// bytes) is detected first, then the file is scanned in parallel by uThreads
+// threads (see Scan).
+//
+// Returns true if the whole file is indexed. Returns false if the file isn't
+// MPEG-2 TS (packets must be found in the first CTSSync::SYNC_SEARCH_LIMIT
+// bytes) or if indexing is canceled; in the last case the index keeps the
+// part of the file that was indexed. Garbage between packets is skipped (see
+// GetSyncLossCount).
+bool CTSIndex::Build(const CTSFile& file, const Progress& progress /* = Progress() */, unsigned int uThreads /* = 0 */)
+{
+    Clear();
+
+    size_t uPacketSize = CTSSync::DetectPacketSize(file, CTSSync::SYNC_SEARCH_LIMIT);
+    if (uPacketSize == 0) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_uSearchedSize = file.GetSize();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_uPacketSize = uPacketSize;
+        m_fIsMPEG2TS = true;
+    }
+
+    bool fResult = Scan(file, 0, 0, progress, uThreads);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_fIsComplete = fResult;
+
+    return fResult;
+}
+
+//
+// CTSIndex::Update
+//
+// Indexes the data appended to the file since the last Build() or Update()
+// (call CTSFile::Refresh() first). Scanning starts from the first section
+// that was incomplete at the end of file (see RESUME_LIMIT) or from the last
+// window of peak bitrate, so the time depends only on the size of new data.
+// The result is the same as the index built by Build() for the whole file.
+//
+// An index that was canceled is continued the same way. If no packets were
+// found by Build() because the file was too short yet (empty file that is
+// just created, for example), the whole file is built again once it grows.
+// Returns false if the file isn't MPEG-2 TS or if indexing is canceled.
+bool CTSIndex::Update(const CTSFile& file, const Progress& progress /* = Progress() */, unsigned int uThreads /* = 0 */)
+{
+    bool fIsMPEG2TS = false;
+    uint64_t uSearchedSize = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        fIsMPEG2TS = m_fIsMPEG2TS;
+        uSearchedSize = m_uSearchedSize;
+    }
+
+    if (!fIsMPEG2TS) {
+        // packets are searched only in the first SYNC_SEARCH_LIMIT bytes, so
+        // the file can't become TS once they are written
+        if (file.GetSize() <= uSearchedSize || uSearchedSize >= CTSSync::SYNC_SEARCH_LIMIT)
+            return false;
+        return Build(file, progress, uThreads);
+    }
+
+    uint64_t uBegin = 0;
+    uint64_t uIndexedEnd = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+
+        // the index grows in m_PMSIndex, so the loaded entries are moved there
+        if (m_pSavedPMSIndex != nullptr) {
+            m_PMSIndex.assign(m_pSavedPMSIndex, m_pSavedPMSIndex + m_uSavedPMSCount);
+            m_pSavedPMSIndex = nullptr;
+            m_uSavedPMSCount = 0;
+
+            for (size_t i = 0; i < m_Programs.size(); i++) {
+                PROGRAM_INDEX& program = m_Programs[i];
+                program.sections.assign(program.pSavedSections, program.pSavedSections + program.uSavedSectionsCount);
+                program.pSavedSections = nullptr;
+                program.uSavedSectionsCount = 0;
+            }
+
+            m_SavedIndex.Close();
+        }
+
+        // the last window of peak bitrate may be incomplete, so its packets are
+        // scanned again together with the new ones (see ScanChunk)
+        uint64_t uWindowSize = PEAK_WINDOW_PACKETS * m_uPacketSize;
+        uBegin = std::min(m_uResumeOffset, m_uNextPacketOffset / uWindowSize * uWindowSize);
+        uIndexedEnd = m_uNextPacketOffset;
+    }
+
+    // nothing is appended
+    if (file.GetSize() <= uIndexedEnd)
+        return IsComplete();
+
+    bool fResult = Scan(file, uBegin, uIndexedEnd, progress, uThreads);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_fIsComplete = fResult;
+
+    return fResult;
+}
+
+//
+// CTSIndex::Scan
+//
+// Scans the file from uBegin up to the end and appends the found sections to
+// the index. The range is split into chunks that are scanned by uThreads
+// threads (0 means number of CPU cores). Only memory-mapped files are scanned
+// in parallel, other ones are read by one thread. Packets before uIndexedEnd
+// are already indexed (see CHUNK).
+//
+// Chunks are scanned by ScanChunk() instantiated for the packet size.
+// Scanned chunks are appended to the index by the calling thread in file
+// order, then progress is called.
+//
+// Returns false if indexing is canceled; the index keeps the part of the
+// file that was indexed.
+bool CTSIndex::Scan(const CTSFile& file, uint64_t uBegin, uint64_t uIndexedEnd, const Progress& progress, unsigned int uThreads)
+{
+    size_t uPacketSize = GetPacketSize();
+
+    ScanFunc scanChunk = &CTSIndex::ScanChunk<CPacket::PACKET_SIZE>;
+    if (uPacketSize == CPacket::M2TS_PACKET_SIZE)
+        scanChunk = &CTSIndex::ScanChunk<CPacket::M2TS_PACKET_SIZE>;
+    else if (uPacketSize == CPacket::RS_PACKET_SIZE)
+        scanChunk = &CTSIndex::ScanChunk<CPacket::RS_PACKET_SIZE>;
+
+    uint64_t uSize = file.GetSize();
+    uint64_t uChunks = std::max<uint64_t>(1, (uSize - std::min(uSize, uBegin) + CHUNK_SIZE - 1) / CHUNK_SIZE);
+
+    if (uThreads == 0)
+        uThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (!file.IsMapped())
+        uThreads = 1;
+    if (uThreads > uChunks)
+        uThreads = (unsigned int)uChunks;
+
+    std::vector<CHUNK> chunks((size_t)uChunks);
+    std::vector<char> done((size_t)uChunks, 0); // chunk is scanned
+    std::mutex mutex; // guards done
+    std::condition_variable cvDone;
+    std::atomic<bool> fCancel(false);
+
+    for (size_t i = 0; i < chunks.size(); i++)
+        chunks[i].uIndexedEnd = uIndexedEnd;
+
+    // the timeouts at the end of the indexed packets are checked again when
+    // more packets are appended
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Checker.ClearEnd();
+    }
+
+    file.Advise(CTSFile::sequential);
+
+    // each thread takes next chunk until all chunks are scanned
+    std::atomic<uint64_t> uNextChunk(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned int i = 0; i < uThreads; i++)
+        threads.push_back(std::thread([&]() {
+            for (uint64_t uChunk = uNextChunk++; uChunk < uChunks && !fCancel; uChunk = uNextChunk++) {
+                uint64_t uEnd = std::min(uSize, uBegin + (uChunk + 1) * CHUNK_SIZE);
+                scanChunk(file, uBegin + uChunk * CHUNK_SIZE, uEnd, &chunks[(size_t)uChunk], &fCancel);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                done[(size_t)uChunk] = 1;
+                cvDone.notify_all();
+            }
+        }));
+
+    bool fResult = true;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cvDone.wait(lock, [&]() { return done[i] != 0; });
+        }
+
+        if (!chunks[i].fCompleted) {
+            fResult = false;
+            break;
+        }
+
+        uint64_t uPMSCount = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            Append(chunks[i]);
+            uPMSCount = m_PMSIndex.size();
+        }
+
+        // the chunk isn't needed anymore
+        CHUNK().Swap(chunks[i]);
+
+        uint64_t uBytes = std::min(uSize, uBegin + (i + 1) * CHUNK_SIZE);
+        if (progress && !progress(uBytes, uPMSCount)) {
+            fCancel = true;
+            fResult = false;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    // tables may stop before the end of the indexed packets
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        CPIDMap PIDs;
+        if (!m_PASections.empty())
+            PIDs.Set(m_PASections.back().m_PAT);
+
+        m_Checker.CheckEnd(m_uPacketsCount, m_uNextPacketOffset - std::min<uint64_t>(m_uNextPacketOffset, m_uPacketSize), CalcTimeoutPackets(), PIDs);
+    }
+
+    // from now on PM Sections are read from the index positions
+    file.Advise(CTSFile::random);
+
+    return fResult;
+}
+
+void CTSIndex::Clear(void)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    m_fIsMPEG2TS = false;
+    m_fIsComplete = false;
+    m_uPacketsCount = 0;
+    m_uSyncLossCount = 0;
+    m_uNextPacketOffset = 0;
+    m_uResumeOffset = 0;
+    m_uSearchedSize = 0;
+    m_uPacketSize = 0;
+    m_PMSIndex.clear();
+    m_PASections.clear();
+
+    m_PIDCounts.assign(CPIDMap::PID_COUNT, 0);
+    m_PIDPeakCounts.assign(CPIDMap::PID_COUNT, 0);
+    m_uPeakWindowsCount = 0;
+    m_PCRRates.clear();
+    m_PCRTimelines.clear();
+    m_Checker.Reset();
+    m_Programs.clear();
+    m_ProgramSlots.clear();
+    m_PMSChanges.clear();
+
+    m_pSavedPMSIndex = nullptr;
+    m_uSavedPMSCount = 0;
+    m_SavedIndex.Close();
+}
+
+//
+// CTSIndex::Save
+//
+// Writes the complete index to the file, so it can be loaded by Load()
+// instead of indexing the file again. key identifies the indexed file. The
+// data is written to a temporary file that then replaces szFileName, so the
+// file being read by others isn't changed.
+bool CTSIndex::Save(const std::string& szFileName, const INDEX_KEY& key) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (!m_fIsComplete)
+        return false;
+
+    std::vector<uint8_t> PAS;
+    for (size_t i = 0; i < m_PASections.size(); i++) {
+        const PA_SECTION& section = m_PASections[i];
+
+        PAS_RECORD record;
+        memset(&record, 0, sizeof(record));
+        record.table_id = section.table_id;
+        record.section_syntax_indicator = section.section_syntax_indicator;
+        record.bit_null = section.bit_null;
+        record.reserved_1 = section.reserved_1;
+        record.reserved_2 = section.reserved_2;
+        record.version_number = section.version_number;
+        record.current_next_indicator = section.current_next_indicator;
+        record.section_number = section.section_number;
+        record.last_section_number = section.last_section_number;
+        record.section_length = section.section_length;
+        record.transport_stream_id = section.transport_stream_id;
+        record.uProgramsCount = (uint32_t)section.m_PAT.size();
+        record.CRC_32 = section.CRC_32;
+        PAS.insert(PAS.end(), (const uint8_t*)&record, (const uint8_t*)(&record + 1));
+
+        for (PATable::const_iterator iter = section.m_PAT.begin(); iter != section.m_PAT.end(); iter++) {
+            PROGRAM_RECORD program = { iter->program_number, iter->reserved, iter->PID };
+            PAS.insert(PAS.end(), (const uint8_t*)&program, (const uint8_t*)(&program + 1));
+        }
+    }
+
+    std::vector<PID_RECORD> PIDStats;
+    for (uint16_t i = 0; i < CPIDMap::PID_COUNT; i++)
+        if (m_PIDCounts[i] != 0) {
+            PID_RECORD record = { i, 0, m_PIDPeakCounts[i], m_PIDCounts[i] };
+            PIDStats.push_back(record);
+        }
+
+    std::vector<PCR_RECORD> PCRRates(m_PCRRates.size());
+    for (size_t i = 0; i < m_PCRRates.size(); i++) {
+        memset(&PCRRates[i], 0, sizeof(PCR_RECORD));
+        PCRRates[i].PID = m_PCRRates[i].PID;
+        PCRRates[i].uPackets = m_PCRRates[i].uPackets;
+        PCRRates[i].uTicks = m_PCRRates[i].uTicks;
+    }
+
+    std::vector<uint8_t> checker;
+    m_Checker.Save(&checker);
+
+    std::vector<PCR_INDEX_RECORD> PCRIndex;
+    for (size_t i = 0; i < m_PCRTimelines.size(); i++)
+        for (size_t j = 0; j < m_PCRTimelines[i].entries.size(); j++) {
+            PCR_INDEX_RECORD record;
+            memset(&record, 0, sizeof(record));
+            record.PID = m_PCRTimelines[i].PID;
+            record.entry = m_PCRTimelines[i].entries[j];
+            PCRIndex.push_back(record);
+        }
+
+    const PMS_INDEX_ENTRY* pPMSIndex = GetPMSEntries();
+    uint64_t uPMSCount = GetPMSEntriesCount();
+
+    std::vector<PROGRAM_SECTIONS_RECORD> programs(m_Programs.size());
+    for (size_t i = 0; i < m_Programs.size(); i++) {
+        memset(&programs[i], 0, sizeof(PROGRAM_SECTIONS_RECORD));
+        programs[i].program_number = m_Programs[i].program_number;
+        GetProgramSections(m_Programs[i], &programs[i].uSectionsCount);
+    }
+
+    INDEX_FILE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.signature, INDEX_SIGNATURE, sizeof(header.signature));
+    header.uVersion = INDEX_VERSION;
+    header.uByteOrder = INDEX_BYTE_ORDER;
+    header.uHeaderSize = sizeof(header);
+    header.uEntrySize = sizeof(PMS_INDEX_ENTRY);
+    header.key = key;
+    header.uPacketSize = m_uPacketSize;
+    header.uPacketsCount = m_uPacketsCount;
+    header.uSyncLossCount = m_uSyncLossCount;
+    header.uNextPacketOffset = m_uNextPacketOffset;
+    header.uResumeOffset = m_uResumeOffset;
+    header.uPMSCount = uPMSCount;
+    header.uPMSOffset = sizeof(header);
+    header.uProgramSectionsOffset = header.uPMSOffset + uPMSCount * sizeof(PMS_INDEX_ENTRY);
+    header.uPASCount = m_PASections.size();
+    header.uPASOffset = header.uProgramSectionsOffset + uPMSCount * sizeof(uint64_t);
+    header.uPASSize = PAS.size();
+    header.uPeakWindowsCount = m_uPeakWindowsCount;
+    header.uPIDStatsCount = PIDStats.size();
+    header.uPIDStatsOffset = header.uPASOffset + header.uPASSize;
+    header.uPCRRatesCount = PCRRates.size();
+    header.uPCRRatesOffset = header.uPIDStatsOffset + header.uPIDStatsCount * sizeof(PID_RECORD);
+    header.uCheckerSize = checker.size();
+    header.uCheckerOffset = header.uPCRRatesOffset + header.uPCRRatesCount * sizeof(PCR_RECORD);
+    header.uPCRIndexCount = PCRIndex.size();
+    header.uPCRIndexOffset = header.uCheckerOffset + header.uCheckerSize;
+    header.uPMSChangesCount = m_PMSChanges.size();
+    header.uPMSChangesOffset = header.uPCRIndexOffset + header.uPCRIndexCount * sizeof(PCR_INDEX_RECORD);
+    header.uProgramsCount = programs.size();
+    header.uProgramsOffset = header.uPMSChangesOffset + header.uPMSChangesCount * sizeof(uint64_t);
+
+    std::string szTempFileName = szFileName + ".tmp";
+    std::FILE* hFile = std::fopen(szTempFileName.c_str(), "wb");
+    if (hFile == nullptr)
+        return false;
+
+    bool fResult = (fwrite(&header, sizeof(header), 1, hFile) == 1)
+        && (uPMSCount == 0 || fwrite(pPMSIndex, sizeof(PMS_INDEX_ENTRY), (size_t)uPMSCount, hFile) == uPMSCount);
+
+    for (size_t i = 0; fResult && i < m_Programs.size(); i++) {
+        uint64_t uCount = 0;
+        const uint64_t* pSections = GetProgramSections(m_Programs[i], &uCount);
+        fResult = fwrite(pSections, sizeof(uint64_t), (size_t)uCount, hFile) == uCount;
+    }
+
+    fResult = fResult
+        && (PAS.empty() || fwrite(PAS.data(), PAS.size(), 1, hFile) == 1)
+        && (PIDStats.empty() || fwrite(PIDStats.data(), sizeof(PID_RECORD), PIDStats.size(), hFile) == PIDStats.size())
+        && (PCRRates.empty() || fwrite(PCRRates.data(), sizeof(PCR_RECORD), PCRRates.size(), hFile) == PCRRates.size())
+        && fwrite(checker.data(), checker.size(), 1, hFile) == 1
+        && (PCRIndex.empty() || fwrite(PCRIndex.data(), sizeof(PCR_INDEX_RECORD), PCRIndex.size(), hFile) == PCRIndex.size())
+        && (m_PMSChanges.empty() || fwrite(m_PMSChanges.data(), sizeof(uint64_t), m_PMSChanges.size(), hFile) == m_PMSChanges.size())
+        && (programs.empty() || fwrite(programs.data(), sizeof(PROGRAM_SECTIONS_RECORD), programs.size(), hFile) == programs.size());
+
+    if (fclose(hFile) != 0)
+        fResult = false;
+
+#ifdef _WIN32
+    // rename() doesn't replace existing file
+    if (fResult)
+        std::remove(szFileName.c_str());
+#endif
+
+    if (!fResult || std::rename(szTempFileName.c_str(), szFileName.c_str()) != 0) {
+        std::remove(szTempFileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+//
+// CTSIndex::Load
+//
+// Loads the index written by Save(). Returns false if the file can't be read,
+// is broken or was written for other contents of the indexed file (key
+// differs); the index is empty then. If the file can be memory-mapped, PMS
+// entries are used right from it instead of being copied; the sections of
+// programs are checked against them, so a broken file can't make the index
+// read outside the entries.
+bool CTSIndex::Load(const std::string& szFileName, const INDEX_KEY& key)
+{
+    Clear();
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (!m_SavedIndex.Open(szFileName))
+        return false;
+
+    INDEX_FILE_HEADER header;
+    size_t uSize = sizeof(header);
+    const uint8_t* pb = m_SavedIndex.Read(0, uSize, (uint8_t*)&header);
+    if (pb == NULL || uSize != sizeof(header)) {
+        m_SavedIndex.Close();
+        return false;
+    }
+
+    if (pb != (const uint8_t*)&header)
+        memcpy(&header, pb, sizeof(header));
+
+    uint64_t uFileSize = m_SavedIndex.GetSize();
+    bool fValid = memcmp(header.signature, INDEX_SIGNATURE, sizeof(header.signature)) == 0
+        && header.uVersion == INDEX_VERSION
+        && header.uByteOrder == INDEX_BYTE_ORDER
+        && header.uHeaderSize == sizeof(header)
+        && header.uEntrySize == sizeof(PMS_INDEX_ENTRY)
+        && memcmp(&header.key, &key, sizeof(key)) == 0
+        && (header.uPacketSize == CPacket::PACKET_SIZE || header.uPacketSize == CPacket::M2TS_PACKET_SIZE || header.uPacketSize == CPacket::RS_PACKET_SIZE)
+        && header.uResumeOffset <= header.uNextPacketOffset
+        && header.uPMSOffset == sizeof(header)
+        && header.uPMSCount <= (uFileSize - header.uPMSOffset) / sizeof(PMS_INDEX_ENTRY)
+        && header.uProgramSectionsOffset == header.uPMSOffset + header.uPMSCount * sizeof(PMS_INDEX_ENTRY)
+        && header.uPMSCount <= (uFileSize - header.uProgramSectionsOffset) / sizeof(uint64_t)
+        && header.uPASOffset == header.uProgramSectionsOffset + header.uPMSCount * sizeof(uint64_t)
+        && header.uPASSize <= uFileSize - header.uPASOffset
+        && header.uPIDStatsOffset == header.uPASOffset + header.uPASSize
+        && header.uPIDStatsCount <= std::min<uint64_t>(CPIDMap::PID_COUNT, (uFileSize - header.uPIDStatsOffset) / sizeof(PID_RECORD))
+        && header.uPCRRatesOffset == header.uPIDStatsOffset + header.uPIDStatsCount * sizeof(PID_RECORD)
+        && header.uPCRRatesCount <= std::min<uint64_t>(CPIDMap::PID_COUNT, (uFileSize - header.uPCRRatesOffset) / sizeof(PCR_RECORD))
+        && header.uCheckerOffset == header.uPCRRatesOffset + header.uPCRRatesCount * sizeof(PCR_RECORD)
+        && header.uCheckerSize <= uFileSize - header.uCheckerOffset
+        && header.uPCRIndexOffset == header.uCheckerOffset + header.uCheckerSize
+        && header.uPCRIndexCount <= (uFileSize - header.uPCRIndexOffset) / sizeof(PCR_INDEX_RECORD)
+        && header.uPMSChangesOffset == header.uPCRIndexOffset + header.uPCRIndexCount * sizeof(PCR_INDEX_RECORD)
+        && header.uPMSChangesCount <= std::min(header.uPMSCount, (uFileSize - header.uPMSChangesOffset) / sizeof(uint64_t))
+        && header.uProgramsOffset == header.uPMSChangesOffset + header.uPMSChangesCount * sizeof(uint64_t)
+        && header.uProgramsCount <= std::min<uint64_t>(PROGRAM_NUMBERS_COUNT, (uFileSize - header.uProgramsOffset) / sizeof(PROGRAM_SECTIONS_RECORD));
+
+    // PA Sections are copied to the index
+    std::vector<uint8_t> buffer((size_t)(fValid ? header.uPASSize : 0));
+    uSize = buffer.size();
+    const uint8_t* pbPAS = (uSize == 0) ? buffer.data() : m_SavedIndex.Read(header.uPASOffset, uSize, buffer.data());
+    if (!fValid || (header.uPASSize != 0 && (pbPAS == NULL || uSize != header.uPASSize))) {
+        m_SavedIndex.Close();
+        return false;
+    }
+
+    const uint8_t* pbEnd = pbPAS + uSize;
+    for (uint64_t i = 0; i < header.uPASCount; i++) {
+        PAS_RECORD record;
+        if ((size_t)(pbEnd - pbPAS) < sizeof(record))
+            break;
+        memcpy(&record, pbPAS, sizeof(record));
+        pbPAS += sizeof(record);
+
+        if ((size_t)(pbEnd - pbPAS) / sizeof(PROGRAM_RECORD) < record.uProgramsCount)
+            break;
+
+        PA_SECTION section;
+        section.table_id = record.table_id;
+        section.section_syntax_indicator = record.section_syntax_indicator;
+        section.bit_null = record.bit_null;
+        section.reserved_1 = record.reserved_1;
+        section.reserved_2 = record.reserved_2;
+        section.version_number = record.version_number;
+        section.current_next_indicator = record.current_next_indicator;
+        section.section_number = record.section_number;
+        section.last_section_number = record.last_section_number;
+        section.section_length = record.section_length;
+        section.transport_stream_id = record.transport_stream_id;
+        section.CRC_32 = record.CRC_32;
+
+        for (uint32_t j = 0; j < record.uProgramsCount; j++, pbPAS += sizeof(PROGRAM_RECORD)) {
+            PROGRAM_RECORD program;
+            memcpy(&program, pbPAS, sizeof(program));
+
+            PROGRAM_DESCRIPTOR pd = {};
+            pd.program_number = program.program_number;
+            pd.reserved = program.reserved & 0x07;
+            pd.PID = program.PID & 0x1FFF;
+            section.m_PAT.push_back(pd);
+        }
+
+        m_PASections.push_back(std::move(section));
+    }
+
+    std::vector<PID_RECORD> PIDStats;
+    std::vector<PCR_RECORD> PCRRates;
+    std::vector<uint8_t> checker;
+    std::vector<PCR_INDEX_RECORD> PCRIndex;
+    std::vector<uint64_t> PMSChanges;
+    std::vector<PROGRAM_SECTIONS_RECORD> programs;
+    if (m_PASections.size() != header.uPASCount
+        || !ReadRecords(m_SavedIndex, header.uPIDStatsOffset, header.uPIDStatsCount, &PIDStats)
+        || !ReadRecords(m_SavedIndex, header.uPCRRatesOffset, header.uPCRRatesCount, &PCRRates)
+        || !ReadRecords(m_SavedIndex, header.uCheckerOffset, header.uCheckerSize, &checker)
+        || !ReadRecords(m_SavedIndex, header.uPCRIndexOffset, header.uPCRIndexCount, &PCRIndex)
+        || !ReadRecords(m_SavedIndex, header.uPMSChangesOffset, header.uPMSChangesCount, &PMSChanges)
+        || !ReadRecords(m_SavedIndex, header.uProgramsOffset, header.uProgramsCount, &programs)
+        || !m_Checker.Load(checker.data(), checker.size())
+        || !IsValidPCRIndex(PCRIndex)
+        || !IsValidPMSChanges(PMSChanges, header.uPMSCount)
+        || !IsValidPrograms(programs, header.uPMSCount)) {
+        m_Checker.Reset();
+        m_PCRTimelines.clear();
+        m_PASections.clear();
+        m_SavedIndex.Close();
+        return false;
+    }
+
+    for (size_t i = 0; i < programs.size(); i++)
+        AddProgram(programs[i].program_number);
+
+    bool fRead = true;
+    uint64_t uSectionsOffset = header.uProgramSectionsOffset;
+    if (m_SavedIndex.IsMapped()) {
+        size_t uPMSSize = (size_t)(header.uPMSCount * sizeof(PMS_INDEX_ENTRY));
+        m_pSavedPMSIndex = (const PMS_INDEX_ENTRY*)m_SavedIndex.Read(header.uPMSOffset, uPMSSize, NULL);
+        m_uSavedPMSCount = header.uPMSCount;
+
+        // sections of programs are used in place too
+        for (size_t i = 0; i < m_Programs.size(); i++) {
+            size_t uSectionsSize = (size_t)(programs[i].uSectionsCount * sizeof(uint64_t));
+            m_Programs[i].pSavedSections = (const uint64_t*)m_SavedIndex.Read(uSectionsOffset, uSectionsSize, NULL);
+            m_Programs[i].uSavedSectionsCount = programs[i].uSectionsCount;
+            uSectionsOffset += uSectionsSize;
+        }
+
+        fRead = (m_pSavedPMSIndex != NULL || header.uPMSCount == 0);
+    } else {
+        m_PMSIndex.resize((size_t)header.uPMSCount);
+        uSize = m_PMSIndex.size() * sizeof(PMS_INDEX_ENTRY);
+        fRead = uSize == 0 || m_SavedIndex.Read(header.uPMSOffset, uSize, (uint8_t*)m_PMSIndex.data()) != NULL;
+
+        for (size_t i = 0; fRead && i < m_Programs.size(); i++) {
+            fRead = ReadRecords(m_SavedIndex, uSectionsOffset, programs[i].uSectionsCount, &m_Programs[i].sections);
+            uSectionsOffset += programs[i].uSectionsCount * sizeof(uint64_t);
+        }
+
+        // the data is copied, so the file isn't needed anymore
+        m_SavedIndex.Close();
+    }
+
+    // sections of programs are used as indexes of PM Sections, so each one is
+    // checked (changes are checked by IsValidPMSChanges)
+    const PMS_INDEX_ENTRY* pPMSIndex = GetPMSEntries();
+    std::vector<bool> seen((size_t)(fRead ? header.uPMSCount : 0));
+    for (size_t i = 0; fRead && i < m_Programs.size(); i++) {
+        uint64_t uCount = 0;
+        const uint64_t* pSections = GetProgramSections(m_Programs[i], &uCount);
+        fRead = uCount == programs[i].uSectionsCount
+            && IsValidProgramSections(pSections, uCount, m_Programs[i].program_number, pPMSIndex, header.uPMSCount, &seen);
+    }
+
+    // only the changes are saved, they are given to their programs here
+    for (size_t i = 0; fRead && i < PMSChanges.size(); i++) {
+        uint32_t uSlot = m_ProgramSlots.empty() ? 0 : m_ProgramSlots[pPMSIndex[PMSChanges[i]].program_number];
+        fRead = (uSlot != 0);
+        if (fRead)
+            m_Programs[uSlot - 1].changes.push_back(PMSChanges[i]);
+    }
+
+    if (!fRead) {
+        m_PMSIndex.clear();
+        m_pSavedPMSIndex = nullptr;
+        m_uSavedPMSCount = 0;
+        m_Programs.clear();
+        m_ProgramSlots.clear();
+        m_PASections.clear();
+        m_Checker.Reset();
+        m_PCRTimelines.clear();
+        m_SavedIndex.Close();
+        return false;
+    }
+    m_PMSChanges.swap(PMSChanges);
+
+    m_uPacketSize = (size_t)header.uPacketSize;
+    m_uPacketsCount = header.uPacketsCount;
+    m_uSyncLossCount = header.uSyncLossCount;
+    m_uNextPacketOffset = header.uNextPacketOffset;
+    m_uResumeOffset = header.uResumeOffset;
+    m_uPeakWindowsCount = header.uPeakWindowsCount;
+
+    for (size_t i = 0; i < PIDStats.size(); i++) {
+        uint16_t uPID = PIDStats[i].PID & (CPIDMap::PID_COUNT - 1);
+        m_PIDCounts[uPID] = PIDStats[i].uPacketsCount;
+        m_PIDPeakCounts[uPID] = PIDStats[i].uPeakCount;
+    }
+
+    for (size_t i = 0; i < PCRRates.size(); i++) {
+        PCR_RATE rate = { (uint16_t)(PCRRates[i].PID & (CPIDMap::PID_COUNT - 1)), PCRRates[i].uPackets, PCRRates[i].uTicks };
+        m_PCRRates.push_back(rate);
+    }
+
+    for (size_t i = 0; i < PCRIndex.size(); i++) {
+        if (i == 0 || PCRIndex[i].PID != PCRIndex[i - 1].PID) {
+            PCR_TIMELINE timeline;
+            timeline.PID = PCRIndex[i].PID;
+            m_PCRTimelines.push_back(timeline);
+        }
+
+        m_PCRTimelines.back().entries.push_back(PCRIndex[i].entry);
+    }
+
+    m_fIsMPEG2TS = true;
+    m_fIsComplete = true;
+
+    return true;
+}
+
+bool CTSIndex::IsMPEG2TS(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_fIsMPEG2TS;
+}
+
+//
+// CTSIndex::IsComplete
+//
+// Returns true if the whole file is indexed, i.e. Build() isn't running and
+// it wasn't canceled.
+bool CTSIndex::IsComplete(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_fIsComplete;
+}
+
+//
+// CTSIndex::GetPacketSize
+//
+// Returns the distance between packets in the file: 188, 192 (M2TS) or 204
+// bytes, or 0 if the file isn't indexed. PMS_INDEX_ENTRY::uOffset is the
+// position of the 188-byte TS packet itself.
+size_t CTSIndex::GetPacketSize(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_uPacketSize;
+}
+
+uint64_t CTSIndex::GetPacketsCount(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_uPacketsCount;
+}
+
+//
+// CTSIndex::GetSyncLossCount
+//
+// Returns the number of places where packets are interrupted by garbage and
+// then continue (the beginning of the file isn't counted).
+uint64_t CTSIndex::GetSyncLossCount(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_uSyncLossCount;
+}
+
+//
+// CTSIndex::GetBitrate
+//
+// Returns the bitrate of TS in bits per second of 188-byte packets, measured
+// by PCR, or 0 if there are no PCRs in the indexed part of the file.
+uint64_t CTSIndex::GetBitrate(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return CalcBitrate();
+}
+
+//
+// CTSIndex::GetPIDStats
+//
+// Fills pStats with statistics of each PID that has packets in the indexed
+// part of the file, in order of PIDs. Packets of PID in percent of all ones
+// are uPacketsCount * 100 / GetPacketsCount().
+//
+// Average bitrate of PID is its share of packets by the bitrate of TS. Peak
+// bitrate is its largest share in a window of PEAK_WINDOW_PACKETS packets by
+// the same bitrate, so it's exact for TS of constant bitrate, as broadcast one
+// is. Files shorter than a window get the average one.
+void CTSIndex::GetPIDStats(std::vector<PID_STATS>* pStats) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    pStats->clear();
+
+    double dBitrate = (double)CalcBitrate();
+    for (uint16_t i = 0; i < CPIDMap::PID_COUNT; i++) {
+        if (m_PIDCounts[i] == 0)
+            continue;
+
+        PID_STATS stats;
+        stats.PID = i;
+        stats.uPacketsCount = m_PIDCounts[i];
+        stats.uBitrate = (uint64_t)(dBitrate * m_PIDCounts[i] / m_uPacketsCount);
+        stats.uPeakBitrate = stats.uBitrate;
+        if (m_uPeakWindowsCount != 0)
+            stats.uPeakBitrate = std::max(stats.uBitrate, (uint64_t)(dBitrate * m_PIDPeakCounts[i] / PEAK_WINDOW_PACKETS));
+
+        pStats->push_back(stats);
+    }
+}
+
+//
+// CTSIndex::GetErrorsCount
+//
+// Returns the number of errors of iType (TS_ERROR::Type), or of all types if
+// iType is -1, found in the indexed part of the file (see
+// CTSChecker::GetErrorsCount). Locations of at most MAX_CHUNK_ERRORS errors
+// are kept per chunk; GetKeptErrorsCount() returns how many are there.
+uint64_t CTSIndex::GetErrorsCount(int iType /* = -1 */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Checker.GetErrorsCount(iType);
+}
+
+uint64_t CTSIndex::GetKeptErrorsCount(int iType /* = -1 */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Checker.GetKeptErrorsCount(iType);
+}
+
+bool CTSIndex::GetError(uint64_t uIndex, TS_ERROR* pError, int iType /* = -1 */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Checker.GetError(uIndex, pError, iType);
+}
+
+//
+// CTSIndex::FindError
+//
+// Returns the index of the first kept error of iType at packet uPacketNum or
+// after it (see CTSChecker::FindError); the time is logarithmic.
+uint64_t CTSIndex::FindError(uint64_t uPacketNum, int iType /* = -1 */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Checker.FindError(uPacketNum, iType);
+}
+
+//
+// CTSIndex::GetPCRPIDs
+//
+// Fills pPIDs with PCR PIDs that have PCRs in the indexed part of the file, in
+// order they are met.
+void CTSIndex::GetPCRPIDs(std::vector<uint16_t>* pPIDs) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    pPIDs->clear();
+    for (size_t i = 0; i < m_PCRTimelines.size(); i++)
+        pPIDs->push_back(m_PCRTimelines[i].PID);
+}
+
+//
+// CTSIndex::GetPCRIndex
+//
+// Fills pEntries with the PCR index of PCR PID (see FindTimeline): the first
+// PCR in each PCR_INDEX_INTERVAL and the last one. The bitrate of TS between two
+// entries is their packets by their time.
+void CTSIndex::GetPCRIndex(uint16_t uPCRPID, std::vector<PCR_INDEX_ENTRY>* pEntries) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const PCR_TIMELINE* pTimeline = FindTimeline(uPCRPID);
+    if (pTimeline != NULL)
+        *pEntries = pTimeline->entries;
+    else
+        pEntries->clear();
+}
+
+//
+// CTSIndex::GetPacketTime
+//
+// Sets *puTime to the time of packet by PCRs of PCR PID (see FindTimeline) in
+// ticks of PCR clock from the beginning of the file. The time between indexed
+// PCRs is interpolated, the time before the first one and after the last one
+// is extrapolated by the bitrate. Returns false if there are no PCRs.
+bool CTSIndex::GetPacketTime(uint64_t uPacketNum, uint64_t* puTime, uint16_t uPCRPID /* = CPacket::NULL_PACKET */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const PCR_TIMELINE* pTimeline = FindTimeline(uPCRPID);
+    if (pTimeline == NULL)
+        return false;
+
+    const std::vector<PCR_INDEX_ENTRY>& entries = pTimeline->entries;
+    std::vector<PCR_INDEX_ENTRY>::const_iterator next = std::upper_bound(entries.begin(), entries.end(), uPacketNum,
+        [](uint64_t uNum, const PCR_INDEX_ENTRY& entry) { return uNum < entry.uPacketNum; });
+
+    if (next == entries.begin()) {
+        uint64_t uTicks = (uint64_t)((next->uPacketNum - uPacketNum) * GetTicksPerPacket(pTimeline->PID));
+        *puTime = next->uTime - std::min(uTicks, next->uTime);
+    } else if (next == entries.end()) {
+        const PCR_INDEX_ENTRY& last = entries.back();
+        *puTime = last.uTime + (uint64_t)((uPacketNum - last.uPacketNum) * GetTicksPerPacket(pTimeline->PID));
+    } else {
+        const PCR_INDEX_ENTRY& prev = *(next - 1);
+        *puTime = prev.uTime + (uint64_t)((double)(uPacketNum - prev.uPacketNum) * (next->uTime - prev.uTime) / (next->uPacketNum - prev.uPacketNum));
+    }
+
+    return true;
+}
+
+//
+// CTSIndex::FindPacketByTime
+//
+// Sets *puPacketNum to the number of packet at uTime (see GetPacketTime); the
+// PCR index is searched by binary search. Times after the indexed packets
+// give the last one. Returns false if there are no PCRs.
+bool CTSIndex::FindPacketByTime(uint64_t uTime, uint64_t* puPacketNum, uint16_t uPCRPID /* = CPacket::NULL_PACKET */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const PCR_TIMELINE* pTimeline = FindTimeline(uPCRPID);
+    if (pTimeline == NULL)
+        return false;
+
+    const std::vector<PCR_INDEX_ENTRY>& entries = pTimeline->entries;
+    std::vector<PCR_INDEX_ENTRY>::const_iterator next = std::upper_bound(entries.begin(), entries.end(), uTime,
+        [](uint64_t uValue, const PCR_INDEX_ENTRY& entry) { return uValue < entry.uTime; });
+
+    double dTicksPerPacket = GetTicksPerPacket(pTimeline->PID);
+    uint64_t uPacketNum = 0;
+    if (next == entries.begin()) {
+        uint64_t uPackets = (dTicksPerPacket != 0) ? (uint64_t)((next->uTime - uTime) / dTicksPerPacket) : 0;
+        uPacketNum = next->uPacketNum - std::min(uPackets, next->uPacketNum);
+    } else if (next == entries.end()) {
+        const PCR_INDEX_ENTRY& last = entries.back();
+        uPacketNum = last.uPacketNum + ((dTicksPerPacket != 0) ? (uint64_t)((uTime - last.uTime) / dTicksPerPacket) : 0);
+    } else {
+        // the entries before next are earlier than uTime, so the interval isn't empty
+        const PCR_INDEX_ENTRY& prev = *(next - 1);
+        uPacketNum = prev.uPacketNum + (uint64_t)((double)(uTime - prev.uTime) * (next->uPacketNum - prev.uPacketNum) / (next->uTime - prev.uTime));
+    }
+
+    *puPacketNum = std::min(uPacketNum, std::max<uint64_t>(m_uPacketsCount, 1) - 1);
+    return true;
+}
+
+uint64_t CTSIndex::GetPMSCount(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (m_pSavedPMSIndex != nullptr)
+        return m_uSavedPMSCount;
+
+    return m_PMSIndex.size();
+}
+
+bool CTSIndex::GetPMSection(uint64_t uIndex, PMS_INDEX_ENTRY* pEntry) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (m_pSavedPMSIndex != nullptr) {
+        if (uIndex >= m_uSavedPMSCount)
+            return false;
+
+        *pEntry = m_pSavedPMSIndex[uIndex];
+        return true;
+    }
+
+    if (uIndex >= m_PMSIndex.size())
+        return false;
+
+    *pEntry = m_PMSIndex[(size_t)uIndex];
+    return true;
+}
+
+//
+// CTSIndex::FindPMSection
+//
+// Returns the index of the PM Section that starts last at packet uPacketNum
+// or before it, GetPMSCount() if there is no such one. Sections are indexed
+// in order they end, which isn't the order they start in when sections of
+// several PIDs are interleaved, so the last section of each program is found
+// by binary search (see CountStartedSections); the time is logarithmic for
+// each program.
+uint64_t CTSIndex::FindPMSection(uint64_t uPacketNum) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const PMS_INDEX_ENTRY* pEntries = GetPMSEntries();
+    uint64_t uResult = GetPMSEntriesCount();
+
+    for (size_t i = 0; i < m_Programs.size(); i++) {
+        uint64_t uCount = CountStartedSections(m_Programs[i], uPacketNum);
+        if (uCount == 0)
+            continue;
+
+        uint64_t uSectionsCount = 0;
+        uint64_t uPMS = GetProgramSections(m_Programs[i], &uSectionsCount)[uCount - 1];
+
+        // of the sections that start in one packet the last indexed one is taken
+        if (uResult == GetPMSEntriesCount() || pEntries[uPMS].uPacketNum > pEntries[uResult].uPacketNum
+            || (pEntries[uPMS].uPacketNum == pEntries[uResult].uPacketNum && uPMS > uResult))
+            uResult = uPMS;
+    }
+
+    return uResult;
+}
+
+//
+// CTSIndex::GetProgramNumbers
+//
+// Gets program_number of each program that has PM Sections, in order the
+// programs are met in TS.
+void CTSIndex::GetProgramNumbers(std::vector<uint16_t>* pPrograms) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    pPrograms->clear();
+    for (size_t i = 0; i < m_Programs.size(); i++)
+        pPrograms->push_back(m_Programs[i].program_number);
+}
+
+uint64_t CTSIndex::GetProgramPMSCount(uint16_t program_number) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    uint64_t uCount = 0;
+    const PROGRAM_INDEX* pProgram = FindProgram(program_number);
+    if (pProgram != NULL)
+        GetProgramSections(*pProgram, &uCount);
+
+    return uCount;
+}
+
+//
+// CTSIndex::GetProgramPMSection
+//
+// Gets the index of PM Section (see GetPMSection) that is the section uIndex
+// of the program; the time is constant, however many programs TS carries.
+bool CTSIndex::GetProgramPMSection(uint16_t program_number, uint64_t uIndex, uint64_t* puPMS) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const PROGRAM_INDEX* pProgram = FindProgram(program_number);
+    if (pProgram == NULL)
+        return false;
+
+    uint64_t uCount = 0;
+    const uint64_t* pSections = GetProgramSections(*pProgram, &uCount);
+    if (uIndex >= uCount)
+        return false;
+
+    *puPMS = pSections[uIndex];
+    return true;
+}
+
+//
+// CTSIndex::FindProgramPMSection
+//
+// Returns the number of the first section of the program that is PM Section
+// uPMS or comes after it, GetProgramPMSCount() if there is no such one; the
+// time is logarithmic.
+uint64_t CTSIndex::FindProgramPMSection(uint16_t program_number, uint64_t uPMS) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const PROGRAM_INDEX* pProgram = FindProgram(program_number);
+    if (pProgram == NULL)
+        return 0;
+
+    uint64_t uCount = 0;
+    const uint64_t* pSections = GetProgramSections(*pProgram, &uCount);
+    return std::lower_bound(pSections, pSections + uCount, uPMS) - pSections;
+}
+
+//
+// CTSIndex::FindProgramPMSectionByPacket
+//
+// Returns the number of the last section of the program that starts at
+// packet uPacketNum or before it, GetProgramPMSCount() if there is no such
+// one; the time is logarithmic.
+uint64_t CTSIndex::FindProgramPMSectionByPacket(uint16_t program_number, uint64_t uPacketNum) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const PROGRAM_INDEX* pProgram = FindProgram(program_number);
+    if (pProgram == NULL)
+        return 0;
+
+    uint64_t uSectionsCount = 0;
+    GetProgramSections(*pProgram, &uSectionsCount);
+
+    uint64_t uCount = CountStartedSections(*pProgram, uPacketNum);
+    return (uCount != 0) ? uCount - 1 : uSectionsCount;
+}
+
+//
+// CTSIndex::GetPMSChangesCount
+//
+// Returns the number of PM Sections where programs change: the first section
+// of each program and each section that differs from the previous one of the
+// same program in PID, version_number or CRC_32. CRC_32 of indexed sections
+// is checked, so it tells the sections with other contents apart. iProgram
+// is program_number to count only its changes, -1 for all programs.
+uint64_t CTSIndex::GetPMSChangesCount(int iProgram /* = -1 */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (iProgram < 0)
+        return m_PMSChanges.size();
+
+    const PROGRAM_INDEX* pProgram = FindProgram((uint16_t)iProgram);
+    return (pProgram != NULL) ? pProgram->changes.size() : 0;
+}
+
+//
+// CTSIndex::GetPMSChange
+//
+// Gets the index of PM Section (see GetPMSection) where the change uIndex of
+// program iProgram is; the changes of all programs (-1) go in order of PM
+// Sections.
+bool CTSIndex::GetPMSChange(uint64_t uIndex, uint64_t* puPMS, int iProgram /* = -1 */) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const std::vector<uint64_t>* pChanges = &m_PMSChanges;
+    if (iProgram >= 0) {
+        const PROGRAM_INDEX* pProgram = FindProgram((uint16_t)iProgram);
+        if (pProgram == NULL)
+            return false;
+
+        pChanges = &pProgram->changes;
+    }
+
+    if (uIndex >= pChanges->size())
+        return false;
+
+    *puPMS = (*pChanges)[(size_t)uIndex];
+    return true;
+}
+
+//
+// CTSIndex::FindNextPMSChange
+//
+// Returns the index of the first PM Section after PM Section uPMS where its
+// program changes, UINT64_MAX if the program doesn't change after it.
+uint64_t CTSIndex::FindNextPMSChange(uint64_t uPMS) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (uPMS >= GetPMSEntriesCount())
+        return UINT64_MAX;
+
+    const PROGRAM_INDEX* pProgram = FindProgram(GetPMSEntries()[uPMS].program_number);
+    if (pProgram == NULL)
+        return UINT64_MAX;
+
+    std::vector<uint64_t>::const_iterator iter = std::upper_bound(pProgram->changes.begin(), pProgram->changes.end(), uPMS);
+    return (iter == pProgram->changes.end()) ? UINT64_MAX : *iter;
+}
+
+//
+// CTSIndex::FindPrevPMSChange
+//
+// Returns the index of the last PM Section before PM Section uPMS where its
+// program changes, UINT64_MAX if there is no such one. For a section that
+// repeats the previous one this is the section where the repeated contents
+// begin.
+uint64_t CTSIndex::FindPrevPMSChange(uint64_t uPMS) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (uPMS >= GetPMSEntriesCount())
+        return UINT64_MAX;
+
+    const PROGRAM_INDEX* pProgram = FindProgram(GetPMSEntries()[uPMS].program_number);
+    if (pProgram == NULL)
+        return UINT64_MAX;
+
+    std::vector<uint64_t>::const_iterator iter = std::lower_bound(pProgram->changes.begin(), pProgram->changes.end(), uPMS);
+    return (iter == pProgram->changes.begin()) ? UINT64_MAX : *(iter - 1);
+}
+
+uint32_t CTSIndex::GetPASCount(void) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return (uint32_t)m_PASections.size();
+}
+
+bool CTSIndex::GetPASection(uint32_t uNum, PA_SECTION* pPAS) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (uNum >= m_PASections.size())
+        return false;
+
+    *pPAS = m_PASections[uNum];
+    return true;
+}
+
+//
+// Position of packets in the file while it's scanned.
+//
+struct SCAN_STATE {
+    uint64_t uNextOffset; // offset of the packet expected after the last scanned one
+    uint64_t uSyncLossCount; // sync losses that are followed by packets in the range
+};
+
+//
+// ForEachPacket
+//
+// Calls func(pbPacket, uOffset) for each packet that starts in [uBegin, uEnd)
+// bytes range of the file, until func returns false. uBegin must be an offset
+// of a packet, STRIDE is the packet size. The file is read by blocks; if it's
+// memory-mapped, packets are accessed in place.
+//
+// sync_byte is checked for whole blocks at once. If it's wrong, the packets
+// are searched again after the bad one, so garbage in the file is skipped.
+//
+// onBlock(uPackets) is called after the packets of each block. Blocks end at
+// the ends of windows of peak bitrate (offsets that are multiples of
+// PEAK_WINDOW_PACKETS * STRIDE), so uPackets is SCAN_BLOCK_PACKETS unless the
+// block starts inside a window or it's cut by sync loss or by the end.
+//
+// Returns false if func stopped the loop or if indexing is canceled.
+template <size_t STRIDE, class Func, class BlockFunc>
+static bool ForEachPacket(const CTSFile& file, uint64_t uBegin, uint64_t uEnd, std::vector<uint8_t>& buffer,
+    const std::atomic<bool>* pfCancel, SCAN_STATE* pState, Func func, BlockFunc onBlock)
+{
+    const uint64_t uWindowSize = CTSIndex::PEAK_WINDOW_PACKETS * STRIDE;
+    uint64_t uOffset = uBegin;
+    pState->uNextOffset = uBegin;
+
+    while (uOffset < uEnd) {
+        if (*pfCancel)
+            return false;
+
+        // the last packet may start before uEnd and end after it
+        uint64_t uWindowEnd = (uOffset / uWindowSize + 1) * uWindowSize;
+        uint64_t uPackets = std::min<uint64_t>(SCAN_BLOCK_PACKETS, (std::min(uEnd, uWindowEnd) - uOffset + STRIDE - 1) / STRIDE);
+        size_t uSize = (size_t)uPackets * STRIDE;
+        size_t uRequested = uSize;
+        const uint8_t* pbBlock = file.Read(uOffset, uSize, buffer.data());
+        if (pbBlock == NULL)
+            // reached end of file
+            break;
+
+        size_t uCount = CTSSync::GetPacketsCount<STRIDE>(uSize);
+        size_t uSynced = CTSSync::CountSynced<STRIDE>(pbBlock, uCount);
+
+        const uint8_t* pb = pbBlock;
+        for (size_t i = 0; i < uSynced; i++, pb += STRIDE)
+            if (!func(pb, uOffset + (pb - pbBlock))) {
+                pState->uNextOffset = uOffset + (pb - pbBlock) + STRIDE;
+                return false;
+            }
+
+        uOffset += uSynced * STRIDE;
+        pState->uNextOffset = uOffset;
+        onBlock(uSynced);
+
+        if (uSynced < uCount) {
+            // lost sync; find where packets start again
+            uOffset = CTSSync::Find<STRIDE>(file, uOffset + 1, uEnd, buffer);
+            if (uOffset == UINT64_MAX)
+                break;
+
+            pState->uSyncLossCount++;
+            pState->uNextOffset = uOffset;
+        } else if (uSize < uRequested) {
+            // reached end of file
+            break;
+        }
+    }
+
+    return true;
+}
+
+template <size_t STRIDE, class Func>
+static bool ForEachPacket(const CTSFile& file, uint64_t uBegin, uint64_t uEnd, std::vector<uint8_t>& buffer,
+    const std::atomic<bool>* pfCancel, SCAN_STATE* pState, Func func)
+{
+    return ForEachPacket<STRIDE>(file, uBegin, uEnd, buffer, pfCancel, pState, func, [](size_t) {});
+}
+
+//
+// CTSIndex::ScanChunk
+//
+// Scans packets that start in [uBegin, uEnd) bytes range of the file; STRIDE
+// is the packet size. uBegin doesn't have to be at a packet boundary: the
+// first packet of the chunk is searched by sync_byte (see CTSSync::Find).
+//
+// Sections are collected from packets of PAT PID and PMT PIDs. Sections that
+// start in the chunk but end after it are completed by reading packets of
+// their PIDs after the end of the chunk.
+//
+// PAT active at the beginning of the chunk is unknown, so until the first
+// PA Section of the chunk every PID where a PM Section starts is considered
+// as PMT PID. PM Sections completed before the first PA Section get
+// UNKNOWN_PAS; Append() then drops the ones that don't belong to PAT (see
+// also CHUNK::uFirstPASOffset).
+//
+// Packets of each PID are counted by one increment per packet in counters of
+// the chunk, which Append() merges. Peaks are taken in windows of
+// PEAK_WINDOW_PACKETS * STRIDE bytes aligned to the beginning of the file, so
+// they don't depend on where chunks and updates start: the chunk takes the
+// windows that start in it, reading packets after its end to complete the
+// last one, and only the windows with PEAK_WINDOW_PACKETS packets. PCRs of
+// all PIDs are collected together with PM Sections that name PCR PIDs: PCR
+// PIDs may be named before the chunk, so Append() chooses PCRs of the PIDs
+// known by then, measures the bitrate and makes the PCR index.
+//
+// Each packet is checked by the checker of the chunk (see CTSChecker); sync
+// losses, PAT and PMT errors are added to it here.
+template <size_t STRIDE>
+void CTSIndex::ScanChunk(const CTSFile& file, uint64_t uBegin, uint64_t uEnd, CHUNK* pChunk, const std::atomic<bool>* pfCancel)
+{
+    CPacket packet;
+    CPSICollector collector;
+    const CSectionAssembler& assembler = collector.GetAssembler();
+    std::vector<bool> candidates(CPIDMap::PID_COUNT); // PIDs where PM Section starts before the first PA Section
+
+    // buffer is used only if the file isn't mapped
+    std::vector<uint8_t> buffer(file.IsMapped() ? 0 : SCAN_BLOCK_PACKETS * STRIDE);
+    uint16_t uPID = 0; // PID of current packet
+    uint64_t uOffset = 0; // offset of current packet
+    uint64_t uPacketNum = 0; // number of current packet in the chunk
+
+    std::vector<uint64_t>& PIDCounts = pChunk->PIDCounts;
+    std::vector<uint32_t>& PIDPeakCounts = pChunk->PIDPeakCounts;
+    std::vector<uint64_t> indexedCounts(CPIDMap::PID_COUNT); // packets before uIndexedEnd, not counted
+    PIDCounts.assign(CPIDMap::PID_COUNT, 0);
+    PIDPeakCounts.assign(CPIDMap::PID_COUNT, 0);
+
+    std::vector<bool> PCRPIDs(CPIDMap::PID_COUNT); // PCR PIDs named by the kept PM Sections of the chunk
+
+    CTSChecker& checker = pChunk->Checker;
+    checker.Reset(MAX_CHUNK_ERRORS);
+
+    // packets before uIndexedEnd; numbers of the next packets are counted
+    // from the first packet after them
+    uint64_t uIndexedCount = 0;
+    uint64_t uIndexedSyncLossCount = 0;
+
+    // called for each section completed on PAT PID or PMT PID
+    auto onSection = [&](PCBYTE pbSection, size_t uSize, uint64_t uTag, uint64_t uStartNum) {
+        if (uTag >= uEnd)
+            // the section starts in next chunk
+            return;
+
+        if (uOffset < pChunk->uIndexedEnd)
+            // the section is completed before, so it's in the index already
+            return;
+
+        uStartNum -= uIndexedCount;
+
+        if (uPID == 0 && pbSection[0] != 0x00) {
+            checker.AddError(TS_ERROR::patError, uPID, uStartNum, uTag);
+        } else if (uPID == 0) {
+            TABLE_ARRIVAL arrival = { uStartNum, uTag, uPID, TS_ERROR::patTimeout };
+            pChunk->PATArrivals.push_back(arrival);
+
+            if (collector.AddPAS(pbSection, uSize)) {
+                if (pChunk->PASections.empty())
+                    pChunk->uFirstPASOffset = uOffset;
+
+                pChunk->PASections.push_back(collector.GetPAT());
+            }
+        } else if (pbSection[0] == 0x02) {
+            CPMTView PMS(pbSection, uSize);
+            if (!PMS.IsValid())
+                return;
+
+            uint16_t uPCRPID = PMS.GetPCRPID();
+            if (uPCRPID != CPacket::NULL_PACKET && !PCRPIDs[uPCRPID]) {
+                PCR_PID_ENTRY PCRPID = { pChunk->PMSIndex.size(), uPacketNum - uIndexedCount, uPCRPID };
+                pChunk->PCRPIDs.push_back(PCRPID);
+
+                // Append() may drop the sections met before the first PA Section,
+                // so PID is named again by the next ones
+                PCRPIDs[uPCRPID] = !pChunk->PASections.empty();
+            }
+
+            PMS_INDEX_ENTRY entry = CPSICollector::MakePMSEntry(PMS, uPID, uTag, uStartNum);
+            entry.uPAS = pChunk->PASections.empty() ? UNKNOWN_PAS : (uint32_t)pChunk->PASections.size() - 1;
+            pChunk->PMSIndex.push_back(entry);
+        }
+    };
+
+    uint64_t uFirstOffset = CTSSync::Find<STRIDE>(file, uBegin, uEnd, buffer);
+    if (uFirstOffset == UINT64_MAX) {
+        // the whole chunk is garbage
+        pChunk->fCompleted = !*pfCancel;
+        return;
+    }
+
+    SCAN_STATE state = { uFirstOffset, 0 };
+    auto onPacket = [&](const uint8_t* pb, uint64_t uPacketOffset) {
+        packet.Set(pb);
+        uOffset = uPacketOffset;
+        uPID = packet.GetPID();
+        uPacketNum = pChunk->uPacketsCount++;
+        PIDCounts[uPID]++;
+
+        if (uOffset < pChunk->uIndexedEnd) {
+            // the packet is counted and checked in the index already; it's
+            // counted here only in its window of peak bitrate
+            uIndexedCount++;
+            indexedCounts[uPID]++;
+        } else {
+            if (pChunk->uFirstPacketOffset == UINT64_MAX) {
+                // garbage before this packet is counted by Append() if the packet
+                // doesn't continue the index
+                pChunk->uFirstPacketOffset = uOffset;
+                uIndexedSyncLossCount = state.uSyncLossCount;
+            }
+
+            checker.CheckPacket(pb, uPID, uPacketNum - uIndexedCount, uOffset);
+        }
+
+        // PCR is only in the adaptation field; most packets don't have it
+        uint64_t uPCR = 0;
+        if ((pb[3] & 0x20) != 0 && uOffset >= pChunk->uIndexedEnd && packet.GetPCR(&uPCR)) {
+            PCR_SAMPLE sample = { uPacketNum - uIndexedCount, uOffset, uPCR, uPID };
+            pChunk->PCRs.push_back(sample);
+        }
+
+        CPIDMap::Type type = collector.GetType(uPID);
+        if (type != CPIDMap::pat && type != CPIDMap::pmt) {
+            if (!pChunk->PASections.empty())
+                return true;
+
+            if (!candidates[uPID]) {
+                if (!packet.IsPMS())
+                    return true;
+
+                candidates[uPID] = true;
+            }
+        }
+
+        // PSI must not be scrambled
+        if ((pb[3] & 0xC0) != 0 && uOffset >= pChunk->uIndexedEnd && type != CPIDMap::other)
+            checker.AddError((type == CPIDMap::pat) ? TS_ERROR::patError : TS_ERROR::pmtError, uPID, uPacketNum - uIndexedCount, uOffset);
+
+        collector.Push(pb, uPID, uOffset, uPacketNum, onSection);
+        return true;
+    };
+
+    // current window of peak bitrate; blocks end at the end of window, so
+    // each block is in one window
+    const uint64_t uWindowSize = PEAK_WINDOW_PACKETS * STRIDE;
+    uint64_t uWindow = UINT64_MAX; // number of the window, its offset / uWindowSize
+    uint64_t uWindowPackets = 0;
+    bool fNewWindow = false; // the window has packets after uIndexedEnd, so it isn't in the index
+    std::vector<uint64_t> windowCounts(CPIDMap::PID_COUNT); // PIDCounts at the beginning of the window
+    std::vector<uint64_t> blockCounts(CPIDMap::PID_COUNT); // PIDCounts at the beginning of current block
+
+    // takes the peaks of the window that ends with counts
+    auto endWindow = [&](const std::vector<uint64_t>& counts) {
+        if (uWindowPackets != PEAK_WINDOW_PACKETS || !fNewWindow || uWindow * uWindowSize < uBegin)
+            // the window is cut by garbage, or it's taken by the index or by the previous chunk
+            return;
+
+        for (size_t i = 0; i < CPIDMap::PID_COUNT; i++)
+            PIDPeakCounts[i] = std::max(PIDPeakCounts[i], (uint32_t)(counts[i] - windowCounts[i]));
+
+        pChunk->uPeakWindowsCount++;
+    };
+
+    // called after each block of packets; blocks end at sync loss, so the
+    // garbage is between blocks
+    uint64_t uBlockSyncLossCount = 0; // sync losses before current block
+    uint64_t uGarbageOffset = 0; // offset after the previous block
+    auto onBlock = [&](size_t uPackets) {
+        if (uPackets == 0) {
+            blockCounts = PIDCounts;
+            return;
+        }
+
+        uint64_t uBlockOffset = state.uNextOffset - uPackets * STRIDE;
+        if (uBlockOffset / uWindowSize != uWindow) {
+            endWindow(blockCounts);
+
+            uWindow = uBlockOffset / uWindowSize;
+            uWindowPackets = 0;
+            fNewWindow = false;
+            windowCounts.swap(blockCounts);
+        }
+
+        uWindowPackets += uPackets;
+        fNewWindow = fNewWindow || (state.uNextOffset - STRIDE >= pChunk->uIndexedEnd);
+        blockCounts = PIDCounts;
+
+        // the garbage before the first packet of the chunk is counted by Append()
+        if (state.uSyncLossCount != uBlockSyncLossCount && uBlockOffset >= pChunk->uIndexedEnd && uBlockOffset != pChunk->uFirstPacketOffset)
+            checker.AddError(TS_ERROR::syncLoss, CPacket::NULL_PACKET, pChunk->uPacketsCount - uPackets - uIndexedCount, uGarbageOffset,
+                (uint32_t)std::min<uint64_t>(uBlockOffset - uGarbageOffset, UINT32_MAX));
+
+        uBlockSyncLossCount = state.uSyncLossCount;
+        uGarbageOffset = state.uNextOffset;
+    };
+
+    bool fResult = ForEachPacket<STRIDE>(file, uFirstOffset, uEnd, buffer, pfCancel, &state, onPacket, onBlock);
+
+    if (!fResult)
+        // canceled
+        return;
+
+    pChunk->uNextPacketOffset = state.uNextOffset;
+    pChunk->uSyncLossCount = state.uSyncLossCount - uIndexedSyncLossCount;
+
+    // complete the last window by the packets after the chunk; they are
+    // counted only there
+    uint64_t uWindowEnd = (uWindow + 1) * uWindowSize;
+    if (uWindow != UINT64_MAX && uWindowEnd > state.uNextOffset && uWindow * uWindowSize >= uBegin) {
+        std::vector<uint64_t> counts = PIDCounts;
+        SCAN_STATE stateAfter = { state.uNextOffset, 0 };
+        ForEachPacket<STRIDE>(file, state.uNextOffset, uWindowEnd, buffer, pfCancel, &stateAfter, [&](const uint8_t* pb, uint64_t) {
+            counts[CPacket(pb).GetPID()]++;
+            return true;
+        }, [&](size_t uPackets) {
+            uWindowPackets += uPackets;
+            fNewWindow = fNewWindow || (uPackets != 0 && stateAfter.uNextOffset - STRIDE >= pChunk->uIndexedEnd);
+        });
+
+        endWindow(counts);
+    } else {
+        endWindow(PIDCounts);
+    }
+
+    if (uIndexedCount != 0)
+        for (size_t i = 0; i < CPIDMap::PID_COUNT; i++)
+            PIDCounts[i] -= indexedCounts[i];
+
+    // complete the sections that are started in the chunk
+    std::vector<bool> pending(CPIDMap::PID_COUNT);
+    size_t uPendingCount = 0;
+    for (uint16_t i = 0; i < CPIDMap::PID_COUNT; i++)
+        if (i != 0 && assembler.IsPending(i) && assembler.GetPendingTag(i) < uEnd) {
+            pending[i] = true;
+            uPendingCount++;
+        }
+
+    if (uPendingCount != 0) {
+        SCAN_STATE stateAfter = { state.uNextOffset, 0 };
+        ForEachPacket<STRIDE>(file, state.uNextOffset, uEnd + CHUNK_SIZE, buffer, pfCancel, &stateAfter, [&](const uint8_t* pb, uint64_t uPacketOffset) {
+            packet.Set(pb);
+            uOffset = uPacketOffset;
+            uPID = packet.GetPID();
+
+            if (!pending[uPID])
+                return true;
+
+            collector.Push(pb, uPID, uOffset, uPacketNum, onSection);
+            if (!assembler.IsPending(uPID) || assembler.GetPendingTag(uPID) >= uEnd) {
+                pending[uPID] = false;
+                uPendingCount--;
+            }
+
+            return (uPendingCount != 0);
+        });
+    }
+
+    // sections that are still incomplete reach the end of file (or they are
+    // broken); Update() continues from the first of them
+    pChunk->uResumeOffset = state.uNextOffset;
+    for (uint16_t i = 0; i < CPIDMap::PID_COUNT; i++)
+        if (assembler.IsPending(i)) {
+            uint64_t uTag = assembler.GetPendingTag(i);
+            if (uTag < pChunk->uResumeOffset && uTag + RESUME_LIMIT >= state.uNextOffset)
+                pChunk->uResumeOffset = uTag;
+        }
+
+    // packets before uIndexedEnd are counted in the index; the numbers of
+    // sections that start there are "negative" and are made right by Append()
+    pChunk->uPacketsCount -= uIndexedCount;
+
+    pChunk->fCompleted = !*pfCancel;
+}
+
+//
+// CTSIndex::Append
+//
+// Appends the chunk to the index. Chunks must be appended in file order and
+// m_Mutex must be locked.
+void CTSIndex::Append(CHUNK& chunk)
+{
+    // PA Section that was active at the beginning of the chunk
+    bool fPASAtBegin = !m_PASections.empty();
+    uint32_t uPASAtBegin = (uint32_t)m_PASections.size() - 1;
+
+    CPIDMap PIDs;
+    if (fPASAtBegin)
+        PIDs.Set(m_PASections[uPASAtBegin].m_PAT);
+
+    // numbers of chunk PA Sections in the index
+    std::vector<uint32_t> PASNums(chunk.PASections.size());
+    for (size_t i = 0; i < chunk.PASections.size(); i++) {
+        if (m_PASections.empty() || !IsSamePAS(m_PASections.back(), chunk.PASections[i]))
+            m_PASections.push_back(chunk.PASections[i]);
+
+        PASNums[i] = (uint32_t)m_PASections.size() - 1;
+    }
+
+    // packets of the chunk don't continue the previous ones, so there is
+    // garbage between the chunks
+    if (chunk.uFirstPacketOffset != UINT64_MAX) {
+        if (m_uPacketsCount != 0 && chunk.uFirstPacketOffset != m_uNextPacketOffset) {
+            m_uSyncLossCount++;
+            m_Checker.AddError(TS_ERROR::syncLoss, CPacket::NULL_PACKET, m_uPacketsCount, m_uNextPacketOffset,
+                (uint32_t)std::min<uint64_t>(chunk.uFirstPacketOffset - m_uNextPacketOffset, UINT32_MAX));
+        }
+
+        m_uNextPacketOffset = chunk.uNextPacketOffset;
+        m_uResumeOffset = chunk.uResumeOffset;
+    }
+    m_uSyncLossCount += chunk.uSyncLossCount;
+
+    // the capacity grows geometrically, so small chunks appended by Update()
+    // don't copy the whole index each time
+    size_t uCount = m_PMSIndex.size() + chunk.PMSIndex.size();
+    if (uCount > m_PMSIndex.capacity())
+        m_PMSIndex.reserve(std::max(uCount, m_PMSIndex.capacity() * 2));
+
+    std::vector<TABLE_ARRIVAL>& arrivals = chunk.PATArrivals; // then PM Sections, for timeouts
+    std::vector<bool> kept(chunk.PMSIndex.size());
+    for (size_t i = 0; i < chunk.PMSIndex.size(); i++) {
+        PMS_INDEX_ENTRY& entry = chunk.PMSIndex[i];
+
+        if (entry.uOffset < chunk.uFirstPASOffset && (!fPASAtBegin || !PIDs.IsPMT(entry.PID)))
+            // the section starts when there is no PAT yet or PID isn't PMT PID,
+            // so it's not a PM Section
+            continue;
+
+        kept[i] = true;
+
+        TABLE_ARRIVAL arrival = { entry.uPacketNum, entry.uOffset, entry.PID, TS_ERROR::pmtTimeout };
+        arrivals.push_back(arrival);
+
+        entry.uPAS = (entry.uPAS == UNKNOWN_PAS) ? uPASAtBegin : PASNums[entry.uPAS];
+        entry.uPacketNum += m_uPacketsCount;
+
+        AddProgramSection(m_PMSIndex.size(), entry);
+        m_PMSIndex.push_back(entry);
+    }
+
+    // each chunk is counted by its own thread, the sums are made here
+    if (!chunk.PIDCounts.empty())
+        for (size_t i = 0; i < CPIDMap::PID_COUNT; i++) {
+            m_PIDCounts[i] += chunk.PIDCounts[i];
+            m_PIDPeakCounts[i] = std::max(m_PIDPeakCounts[i], chunk.PIDPeakCounts[i]);
+        }
+    m_uPeakWindowsCount += chunk.uPeakWindowsCount;
+
+    // PCRs are counted on PIDs named PCR PID by the PM Sections before them,
+    // in this chunk or in the previous ones
+    size_t uNextPCRPID = 0;
+    auto addPCRPIDs = [&](uint64_t uPacketNum) {
+        for (; uNextPCRPID < chunk.PCRPIDs.size() && chunk.PCRPIDs[uNextPCRPID].uPacketNum < uPacketNum; uNextPCRPID++) {
+            const PCR_PID_ENTRY& PCRPID = chunk.PCRPIDs[uNextPCRPID];
+            if (kept[PCRPID.uPMS] && FindRate(PCRPID.PID) == NULL) {
+                PCR_RATE rate = { PCRPID.PID, 0, 0 };
+                m_PCRRates.push_back(rate);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < chunk.PCRs.size(); i++) {
+        const PCR_SAMPLE& sample = chunk.PCRs[i];
+        addPCRPIDs(sample.uPacketNum);
+        AddPCR(sample.PID, m_uPacketsCount + sample.uPacketNum, sample.uOffset, sample.uPCR);
+    }
+    addPCRPIDs(UINT64_MAX);
+
+    // tables must be repeated each TABLE_TIMEOUT_MS at the bitrate known so far
+    m_Checker.Append(chunk.Checker, m_uPacketsCount, arrivals, CalcTimeoutPackets());
+
+    m_uPacketsCount += chunk.uPacketsCount;
+}
+
+//
+// CTSIndex::AddPCR
+//
+// Adds PCR of the packet to the bitrate and to the PCR index of PID; PCRs of
+// PIDs that aren't PCR PIDs (see Append) are skipped. m_Mutex must be locked.
+void CTSIndex::AddPCR(uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset, uint64_t uPCR)
+{
+    PCR_RATE* pRate = NULL;
+    for (size_t i = 0; i < m_PCRRates.size() && pRate == NULL; i++)
+        if (m_PCRRates[i].PID == uPID)
+            pRate = &m_PCRRates[i];
+
+    if (pRate == NULL)
+        return;
+
+    size_t j = 0;
+    while (j < m_PCRTimelines.size() && m_PCRTimelines[j].PID != uPID)
+        j++;
+
+    if (j == m_PCRTimelines.size()) {
+        m_PCRTimelines.push_back(PCR_TIMELINE());
+        m_PCRTimelines.back().PID = uPID;
+    }
+
+    std::vector<PCR_INDEX_ENTRY>& entries = m_PCRTimelines[j].entries;
+    PCR_INDEX_ENTRY entry = { uPacketNum, uOffset, 0, uPCR };
+    if (entries.empty()) {
+        // the time before the first PCR passes as the bitrate of TS says
+        entry.uTime = (uint64_t)(uPacketNum * GetTicksPerPacket(uPID));
+    } else {
+        const PCR_INDEX_ENTRY& last = entries.back();
+        uint64_t uPackets = uPacketNum - last.uPacketNum;
+        uint64_t uTicks = GetPCRTicks(last.uPCR, uPCR);
+        if (uTicks != 0 && uTicks <= MAX_PCR_INTERVAL) {
+            if (pRate->uPackets == 0 && entries.front().uTime == 0) {
+                // the bitrate was unknown at the first PCR, so the time before it
+                // is estimated by the first interval
+                uint64_t uBeforeTicks = (uint64_t)((double)entries.front().uPacketNum * uTicks / uPackets);
+                for (size_t i = 0; i < entries.size(); i++)
+                    entries[i].uTime += uBeforeTicks;
+            }
+
+            pRate->uPackets += uPackets;
+            pRate->uTicks += uTicks;
+        } else if (pRate->uPackets != 0) {
+            // discontinuity; the time passes as the bitrate measured so far says
+            uTicks = (uint64_t)((double)uPackets * pRate->uTicks / pRate->uPackets);
+        } else {
+            uTicks = 0;
+        }
+
+        entry.uTime = last.uTime + uTicks;
+    }
+
+    AddPCREntry(&entries, entry);
+}
+
+//
+// CTSIndex::CalcBitrate
+//
+// Returns the bitrate of TS measured by PCRs of the PID where they cover the
+// longest time (see GetBitrate). m_Mutex must be locked.
+uint64_t CTSIndex::CalcBitrate(void) const
+{
+    const PCR_RATE* pRate = FindRate(CPacket::NULL_PACKET);
+    if (pRate == NULL || pRate->uTicks == 0)
+        return 0;
+
+    return (uint64_t)((double)pRate->uPackets * CPacket::PACKET_SIZE * 8 * CPacket::PCR_CLOCK / pRate->uTicks);
+}
+
+//
+// CTSIndex::CalcTimeoutPackets
+//
+// Returns the number of packets sent in CTSChecker::TABLE_TIMEOUT_MS at the
+// bitrate of TS, 0 if the bitrate is unknown. m_Mutex must be locked.
+uint64_t CTSIndex::CalcTimeoutPackets(void) const
+{
+    return CalcBitrate() * CTSChecker::TABLE_TIMEOUT_MS / (1000 * CPacket::PACKET_SIZE * 8);
+}
+
+//
+// CTSIndex::FindRate
+//
+// Returns the rate of PCR PID, or of the PID where PCRs cover the longest time
+// if uPCRPID is NULL_PACKET; NULL if there is no such one. m_Mutex must be
+// locked.
+const CTSIndex::PCR_RATE* CTSIndex::FindRate(uint16_t uPCRPID) const
+{
+    const PCR_RATE* pRate = NULL;
+    for (size_t i = 0; i < m_PCRRates.size(); i++)
+        if (uPCRPID == CPacket::NULL_PACKET ? (m_PCRRates[i].uTicks != 0 && (pRate == NULL || m_PCRRates[i].uTicks > pRate->uTicks))
+                                            : (m_PCRRates[i].PID == uPCRPID))
+            pRate = &m_PCRRates[i];
+
+    return pRate;
+}
+
+//
+// CTSIndex::FindTimeline
+//
+// Returns the PCR index of PCR PID. If uPCRPID is NULL_PACKET or has no PCRs
+// (e.g. the program isn't indexed yet), the index of the PID that measures
+// the bitrate of TS is returned; NULL if there are no PCRs. m_Mutex must be
+// locked.
+const CTSIndex::PCR_TIMELINE* CTSIndex::FindTimeline(uint16_t uPCRPID) const
+{
+    for (int iPass = 0; iPass < 2; iPass++) {
+        for (size_t i = 0; i < m_PCRTimelines.size(); i++)
+            if (m_PCRTimelines[i].PID == uPCRPID && !m_PCRTimelines[i].entries.empty())
+                return &m_PCRTimelines[i];
+
+        const PCR_RATE* pRate = FindRate(CPacket::NULL_PACKET);
+        if (pRate == NULL)
+            break;
+
+        uPCRPID = pRate->PID;
+    }
+
+    return NULL;
+}
+
+//
+// CTSIndex::GetTicksPerPacket
+//
+// Returns the ticks of PCR clock per packet of TS measured on PCR PID, or by
+// the bitrate of TS if PID has no measured intervals; 0 if the bitrate is
+// unknown. m_Mutex must be locked.
+double CTSIndex::GetTicksPerPacket(uint16_t uPCRPID) const
+{
+    const PCR_RATE* pRate = FindRate(uPCRPID);
+    if (pRate == NULL || pRate->uPackets == 0)
+        pRate = FindRate(CPacket::NULL_PACKET);
+
+    if (pRate == NULL || pRate->uPackets == 0)
+        return 0;
+
+    return (double)pRate->uTicks / pRate->uPackets;
+}
+
+//
+// CTSIndex::GetPMSEntries
+//
+// Returns the indexed PM Sections, loaded or built ones. m_Mutex must be
+// locked.
+const PMS_INDEX_ENTRY* CTSIndex::GetPMSEntries(void) const
+{
+    return (m_pSavedPMSIndex != nullptr) ? m_pSavedPMSIndex : m_PMSIndex.data();
+}
+
+uint64_t CTSIndex::GetPMSEntriesCount(void) const
+{
+    return (m_pSavedPMSIndex != nullptr) ? m_uSavedPMSCount : m_PMSIndex.size();
+}
+
+//
+// CTSIndex::AddProgramSection
+//
+// Adds PM Section uPMS to the sections of its program, and to the changes if
+// it's the first section of the program or differs from the last change.
+// Sections must be added in order and m_Mutex must be locked.
+void CTSIndex::AddProgramSection(uint64_t uPMS, const PMS_INDEX_ENTRY& entry)
+{
+    PROGRAM_INDEX* pProgram = AddProgram(entry.program_number);
+    pProgram->sections.push_back(uPMS);
+
+    if (!pProgram->changes.empty()) {
+        // sections that repeat the last change cost just this comparison
+        const PMS_INDEX_ENTRY& last = GetPMSEntries()[pProgram->changes.back()];
+        if (last.PID == entry.PID && last.version_number == entry.version_number && last.CRC_32 == entry.CRC_32)
+            return;
+    }
+
+    pProgram->changes.push_back(uPMS);
+    m_PMSChanges.push_back(uPMS);
+}
+
+//
+// CTSIndex::AddProgram
+//
+// Returns the sections of the program, empty ones if it's met first. m_Mutex
+// must be locked.
+CTSIndex::PROGRAM_INDEX* CTSIndex::AddProgram(uint16_t program_number)
+{
+    if (m_ProgramSlots.empty())
+        m_ProgramSlots.assign(PROGRAM_NUMBERS_COUNT, 0);
+
+    uint32_t& uSlot = m_ProgramSlots[program_number];
+    if (uSlot == 0) {
+        PROGRAM_INDEX program;
+        program.program_number = program_number;
+        program.pSavedSections = nullptr;
+        program.uSavedSectionsCount = 0;
+        m_Programs.push_back(program);
+        uSlot = (uint32_t)m_Programs.size();
+    }
+
+    return &m_Programs[uSlot - 1];
+}
+
+//
+// CTSIndex::FindProgram
+//
+// Returns the sections of the program, NULL if it has no PM Sections. The
+// time is constant. m_Mutex must be locked.
+const CTSIndex::PROGRAM_INDEX* CTSIndex::FindProgram(uint16_t program_number) const
+{
+    if (m_ProgramSlots.empty() || m_ProgramSlots[program_number] == 0)
+        return NULL;
+
+    return &m_Programs[m_ProgramSlots[program_number] - 1];
+}
+
+//
+// CTSIndex::CountStartedSections
+//
+// Returns the number of sections of the program that start at packet
+// uPacketNum or before it. The sections of a program are on its PMT PID, and
+// sections of one PID end in order they start, so they are sorted by the
+// packets they start in. m_Mutex must be locked.
+uint64_t CTSIndex::CountStartedSections(const PROGRAM_INDEX& program, uint64_t uPacketNum) const
+{
+    const PMS_INDEX_ENTRY* pEntries = GetPMSEntries();
+
+    uint64_t uCount = 0;
+    const uint64_t* pSections = GetProgramSections(program, &uCount);
+    return std::upper_bound(pSections, pSections + uCount, uPacketNum,
+               [pEntries](uint64_t uNum, uint64_t uPMS) { return uNum < pEntries[uPMS].uPacketNum; })
+        - pSections;
+}
+
+//
+// CTSIndex::GetProgramSections
+//
+// Returns the sections of the program, loaded or built ones. m_Mutex must be
+// locked.
+const uint64_t* CTSIndex::GetProgramSections(const PROGRAM_INDEX& program, uint64_t* puCount) const
+{
+    if (program.pSavedSections != nullptr) {
+        *puCount = program.uSavedSectionsCount;
+        return program.pSavedSections;
+    }
+
+    *puCount = program.sections.size();
+    return program.sections.data();
+}
@@ -0,0 +1,250 @@
+/*******************************************************************************
+ * File: TSIndex.h
+ *
+ * Description:
+ *    CTSIndex class definition. This class scans a file with MPEG-2 Transport
+ *    Stream once and remembers where PA and PM Sections are, so the sections
+ *    can be accessed later without scanning the file again.
+ *
+ *    Large files are split into packet-aligned chunks that are scanned in
+ *    parallel; the results are stitched together in file order, so the index
+ *    is the same as the one built by a sequential scan.
+ *
+ *    The index can be read from other threads while it's being built: each
+ *    chunk becomes visible as soon as it and all chunks before it are scanned.
+ *
+ *    A file that is still being written can be indexed further by Update():
+ *    only the data appended since the last pass is scanned.
+ *
+ *    The same pass counts packets of each PID and measures the bitrate of TS
+ *    by PCR, so per-PID statistics cost no extra reading of the file. It also
+ *    checks the packets for errors (see CTSChecker) and keeps a sparse index
+ *    of PCRs of each PCR PID, so a packet at any time of TS (and the time of
+ *    any packet) is found by binary search.
+ *
+ *    PM Sections of each program_number are also listed separately, so the
+ *    sections of one program of MPTS are walked without the others. Most of
+ *    them repeat the previous one; the sections where the program changes
+ *    (other PID, version_number or CRC_32) are listed too, so the changes are
+ *    found without stepping through the repeats.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _TS_INDEX_H_
+#define _TS_INDEX_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "packet.h"
+#include "ts_checker.h"
+#include "ts_file.h"
+
+//
+// Class and structures defined in this file
+//
+class CTSIndex;
+
+struct PMS_INDEX_ENTRY;
+struct PID_STATS;
+struct PCR_INDEX_ENTRY;
+struct INDEX_KEY;
+
+//
+// Class and structures definitions
+//
+
+// Describes one PM Section found in TS by the indexing pass. PAS is a zero-based
+// number of PA Section (see CTSIndex::GetPASections) that was active when the
+// PM Section was met.
+struct PMS_INDEX_ENTRY {
+    uint64_t uPacketNum; // zero-based number of packet that contains PM Section
+    uint64_t uOffset; // offset in bytes of that packet (of its sync_byte) from the beginning of file
+    uint16_t PID;
+    uint16_t program_number;
+    uint8_t version_number;
+    uint8_t reserved[3]; // 0; the entries are saved as is, so there is no padding
+    uint32_t CRC_32;
+    uint32_t uPAS;
+};
+
+// Packets of one PID counted by the indexing pass (see CTSIndex::GetPIDStats).
+// Bitrates are in bits per second of 188-byte packets; they are 0 if the
+// bitrate of TS is unknown (there are no PCRs).
+struct PID_STATS {
+    uint16_t PID;
+    uint64_t uPacketsCount;
+    uint64_t uBitrate; // average
+    uint64_t uPeakBitrate; // the highest one in PEAK_WINDOW_PACKETS packets of TS
+};
+
+// PCR of one PCR PID kept by the indexing pass (see CTSIndex::GetPCRIndex).
+// uTime is in ticks of PCR clock from the beginning of the file: wrap-arounds
+// and discontinuities of PCR are removed from it, so it only grows. The time
+// of a discontinuity and the time before the first PCR of PID are estimated
+// by the bitrate of TS.
+struct PCR_INDEX_ENTRY {
+    uint64_t uPacketNum; // zero-based number of packet with PCR
+    uint64_t uOffset; // offset of that packet
+    uint64_t uTime;
+    uint64_t uPCR; // PCR of the packet as is, PCR_base * 300 + PCR_extension
+};
+
+// Identifies the contents of the indexed file for the saved index (see
+// CTSIndex::Save); the index is loaded only if all fields are the same.
+struct INDEX_KEY {
+    uint64_t uFileSize;
+    int64_t iModificationTime; // nanoseconds since 1970-01-01
+    uint32_t uHeadCRC; // CRC_32 of the beginning of the file
+    uint32_t uTailCRC; // CRC_32 of the end of the file
+};
+
+class CTSIndex {
+public:
+    // constants
+    static const uint64_t CHUNK_SIZE = CPacket::PACKET_SIZE * 262144; // ~47 MB per task
+    static const uint64_t PEAK_WINDOW_PACKETS = 8192; // window of peak bitrate, packets of TS
+    static const size_t MAX_CHUNK_ERRORS = 16384; // locations of errors kept per chunk, the rest are only counted
+    static const uint64_t PCR_INDEX_INTERVAL = CPacket::PCR_CLOCK; // one PCR of each PCR PID is kept per this time
+
+    // Called by Build() each time the index grows: uBytes bytes from the
+    // beginning of file are indexed and uPMSCount PM Sections are found so far.
+    // Return false to cancel indexing.
+    typedef std::function<bool(uint64_t uBytes, uint64_t uPMSCount)> Progress;
+
+public:
+    CTSIndex(void);
+
+    bool Build(const CTSFile& file, const Progress& progress = Progress(), unsigned int uThreads = 0);
+    bool Update(const CTSFile& file, const Progress& progress = Progress(), unsigned int uThreads = 0);
+    void Clear(void);
+
+    bool Save(const std::string& szFileName, const INDEX_KEY& key) const;
+    bool Load(const std::string& szFileName, const INDEX_KEY& key);
+
+    bool IsMPEG2TS(void) const;
+    bool IsComplete(void) const;
+    size_t GetPacketSize(void) const;
+    uint64_t GetPacketsCount(void) const;
+    uint64_t GetSyncLossCount(void) const;
+    uint64_t GetBitrate(void) const;
+    void GetPIDStats(std::vector<PID_STATS>* pStats) const;
+
+    uint64_t GetErrorsCount(int iType = -1) const;
+    uint64_t GetKeptErrorsCount(int iType = -1) const;
+    bool GetError(uint64_t uIndex, TS_ERROR* pError, int iType = -1) const;
+    uint64_t FindError(uint64_t uPacketNum, int iType = -1) const;
+
+    void GetPCRPIDs(std::vector<uint16_t>* pPIDs) const;
+    void GetPCRIndex(uint16_t uPCRPID, std::vector<PCR_INDEX_ENTRY>* pEntries) const;
+    bool GetPacketTime(uint64_t uPacketNum, uint64_t* puTime, uint16_t uPCRPID = CPacket::NULL_PACKET) const;
+    bool FindPacketByTime(uint64_t uTime, uint64_t* puPacketNum, uint16_t uPCRPID = CPacket::NULL_PACKET) const;
+
+    uint64_t GetPMSCount(void) const;
+    bool GetPMSection(uint64_t uIndex, PMS_INDEX_ENTRY* pEntry) const;
+    uint64_t FindPMSection(uint64_t uPacketNum) const;
+
+    void GetProgramNumbers(std::vector<uint16_t>* pPrograms) const;
+    uint64_t GetProgramPMSCount(uint16_t program_number) const;
+    bool GetProgramPMSection(uint16_t program_number, uint64_t uIndex, uint64_t* puPMS) const;
+    uint64_t FindProgramPMSection(uint16_t program_number, uint64_t uPMS) const;
+    uint64_t FindProgramPMSectionByPacket(uint16_t program_number, uint64_t uPacketNum) const;
+
+    uint64_t GetPMSChangesCount(int iProgram = -1) const;
+    bool GetPMSChange(uint64_t uIndex, uint64_t* puPMS, int iProgram = -1) const;
+    uint64_t FindNextPMSChange(uint64_t uPMS) const;
+    uint64_t FindPrevPMSChange(uint64_t uPMS) const;
+
+    uint32_t GetPASCount(void) const;
+    bool GetPASection(uint32_t uNum, PA_SECTION* pPAS) const;
+
+private:
+    struct CHUNK;
+
+    // uTicks of PCR clock pass on PID while uPackets packets of TS are sent;
+    // only the intervals between consecutive PCRs that look right are summed
+    struct PCR_RATE {
+        uint16_t PID;
+        uint64_t uPackets;
+        uint64_t uTicks;
+    };
+
+    // PM Sections of one program_number, as indexes of PM Sections in the
+    // index; changes are the ones where the program changes, the first
+    // section of the program is a change too
+    struct PROGRAM_INDEX {
+        uint16_t program_number;
+        std::vector<uint64_t> sections;
+        const uint64_t* pSavedSections; // sections in the memory-mapped saved index, used instead of sections
+        uint64_t uSavedSectionsCount;
+        std::vector<uint64_t> changes;
+    };
+
+    // PCR index of one PCR PID; the last entry is always the last PCR met
+    struct PCR_TIMELINE {
+        uint16_t PID;
+        std::vector<PCR_INDEX_ENTRY> entries;
+    };
+
+    typedef void (*ScanFunc)(const CTSFile& file, uint64_t uBegin, uint64_t uEnd, CHUNK* pChunk, const std::atomic<bool>* pfCancel);
+
+    template <size_t STRIDE>
+    static void ScanChunk(const CTSFile& file, uint64_t uBegin, uint64_t uEnd, CHUNK* pChunk, const std::atomic<bool>* pfCancel);
+    bool Scan(const CTSFile& file, uint64_t uBegin, uint64_t uIndexedEnd, const Progress& progress, unsigned int uThreads);
+    void Append(CHUNK& chunk);
+    void AddPCR(uint16_t uPID, uint64_t uPacketNum, uint64_t uOffset, uint64_t uPCR);
+    uint64_t CalcBitrate(void) const;
+    uint64_t CalcTimeoutPackets(void) const;
+    const PCR_RATE* FindRate(uint16_t uPCRPID) const;
+    const PCR_TIMELINE* FindTimeline(uint16_t uPCRPID) const;
+    double GetTicksPerPacket(uint16_t uPCRPID) const;
+    const PMS_INDEX_ENTRY* GetPMSEntries(void) const;
+    uint64_t GetPMSEntriesCount(void) const;
+    void AddProgramSection(uint64_t uPMS, const PMS_INDEX_ENTRY& entry);
+    PROGRAM_INDEX* AddProgram(uint16_t program_number);
+    const PROGRAM_INDEX* FindProgram(uint16_t program_number) const;
+    const uint64_t* GetProgramSections(const PROGRAM_INDEX& program, uint64_t* puCount) const;
+    uint64_t CountStartedSections(const PROGRAM_INDEX& program, uint64_t uPacketNum) const;
+
+private:
+    mutable std::mutex m_Mutex; // guards all members below
+
+    bool m_fIsMPEG2TS = false;
+    bool m_fIsComplete = false;
+    size_t m_uPacketSize = 0;
+    uint64_t m_uPacketsCount = 0;
+    uint64_t m_uSyncLossCount = 0;
+    uint64_t m_uNextPacketOffset = 0; // offset of the packet expected after the indexed ones
+    uint64_t m_uResumeOffset = 0; // where Update() starts: sections that start here may be incomplete yet
+    uint64_t m_uSearchedSize = 0; // size of the file where Build() found no packets
+    std::vector<PMS_INDEX_ENTRY> m_PMSIndex;
+    std::vector<PA_SECTION> m_PASections; // each distinct PA Section met in TS
+
+    // per-PID statistics
+    std::vector<uint64_t> m_PIDCounts = std::vector<uint64_t>(CPIDMap::PID_COUNT); // packets of each PID
+    std::vector<uint32_t> m_PIDPeakCounts = std::vector<uint32_t>(CPIDMap::PID_COUNT); // the most packets of each PID in a window
+    uint64_t m_uPeakWindowsCount = 0; // windows of PEAK_WINDOW_PACKETS packets counted in m_PIDPeakCounts
+    std::vector<PCR_RATE> m_PCRRates; // for each PCR PID named by the indexed PM Sections, even without PCRs
+    std::vector<PCR_TIMELINE> m_PCRTimelines; // for each PCR PID
+
+    CTSChecker m_Checker; // errors found in the indexed packets
+
+    // PM Sections of each program
+    std::vector<PROGRAM_INDEX> m_Programs; // in order the programs are met
+    std::vector<uint32_t> m_ProgramSlots; // one-based number in m_Programs for each program_number, empty until the first PM Section
+    std::vector<uint64_t> m_PMSChanges; // indexes of PM Sections where any program changes
+
+    // index loaded from a memory-mapped file: PMS entries are used in place
+    // instead of m_PMSIndex
+    CTSFile m_SavedIndex;
+    const PMS_INDEX_ENTRY* m_pSavedPMSIndex = nullptr;
+    uint64_t m_uSavedPMSCount = 0;
+};
+
+#endif // _TS_INDEX_H_
@@ -0,0 +1,259 @@
+/*******************************************************************************
+ * File: TSReplayer.cpp
+ *
+ * Description: CTSReplayer class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "ts_replayer.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "packet.h"
+#include "ts_sync.h"
+#include "udp_source.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+const size_t CTSReplayer::PACKETS_PER_DATAGRAM;
+const uint8_t CTSReplayer::RTP_PAYLOAD_TYPE;
+const int CTSReplayer::MULTICAST_TTL;
+
+// RTP timestamp clock for MPEG-2 TS, see RFC 2250
+static const uint32_t RTP_CLOCK = 90000;
+
+// number of packets read from the file at once
+static const size_t READ_PACKETS = 1024;
+
+CTSReplayer::CTSReplayer(void)
+{
+    m_iSocket = -1;
+    m_fRTP = false;
+    m_uSequence = 0;
+    m_uSSRC = 0;
+    m_uTimestamp = 0;
+    m_uDatagramsCount = 0;
+    m_uPacketsCount = 0;
+}
+
+CTSReplayer::~CTSReplayer(void)
+{
+    Close();
+}
+
+//
+// CTSReplayer::Open
+//
+// Prepares to send to "udp://host:port" or "rtp://host:port" (see
+// CUDPSource). Multicast datagrams are looped back, so the receivers on this
+// machine get them too.
+bool CTSReplayer::Open(const std::string& szAddress)
+{
+    Close();
+
+#ifdef _WIN32
+    (void)szAddress;
+    return false;
+#else
+    uint32_t uHost = 0, uSource = 0;
+    uint16_t uPort = 0;
+    if (!CUDPSource::ParseAddress(szAddress, &uHost, &uSource, &uPort) || uHost == INADDR_ANY)
+        return false;
+
+    m_iSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_iSocket == -1)
+        return false;
+
+    if (IN_MULTICAST(uHost)) {
+        int iValue = MULTICAST_TTL;
+        setsockopt(m_iSocket, IPPROTO_IP, IP_MULTICAST_TTL, &iValue, sizeof(iValue));
+        unsigned char bLoop = 1;
+        setsockopt(m_iSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &bLoop, sizeof(bLoop));
+    }
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(uPort);
+    address.sin_addr.s_addr = htonl(uHost);
+
+    if (connect(m_iSocket, (const sockaddr*)&address, sizeof(address)) != 0) {
+        Close();
+        return false;
+    }
+
+    m_fRTP = (szAddress.compare(0, 6, "rtp://") == 0);
+    m_uSSRC = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    return true;
+#endif
+}
+
+void CTSReplayer::Close(void)
+{
+#ifndef _WIN32
+    if (m_iSocket != -1)
+        close(m_iSocket);
+#endif
+
+    m_iSocket = -1;
+    m_fRTP = false;
+    m_uSequence = 0;
+    m_uTimestamp = 0;
+    m_uDatagramsCount = 0;
+    m_uPacketsCount = 0;
+}
+
+//
+// CTSReplayer::Send
+//
+// Sends the packets of the file uLoops times (0 means until canceled). Packets
+// of 192 and 204 bytes are sent as 188-byte ones; garbage is skipped.
+// uBitrate is the rate of TS in bits per second, 0 sends as fast as possible.
+// The datagrams are paced by the time they are due from the beginning, so
+// the average rate is kept even if some of them are late.
+//
+// Returns false if the file isn't MPEG-2 TS, a datagram can't be sent or
+// sending is canceled.
+bool CTSReplayer::Send(const CTSFile& file, uint64_t uBitrate, unsigned int uLoops /* = 1 */, const std::atomic<bool>* pfCancel /* = NULL */)
+{
+    if (!IsOpened())
+        return false;
+
+    uint64_t uFirstOffset = 0;
+    size_t uStride = CTSSync::DetectPacketSize(file, CTSSync::SYNC_SEARCH_LIMIT, &uFirstOffset);
+    if (uStride == 0)
+        return false;
+
+    // buffers are used only if the file isn't mapped
+    std::vector<uint8_t> buffer(file.IsMapped() ? 0 : READ_PACKETS * uStride);
+    std::vector<uint8_t> findBuffer;
+
+    // packets are collected after the room for RTP header
+    uint8_t abDatagram[CUDPSource::RTP_HEADER_SIZE + PACKETS_PER_DATAGRAM * CPacket::PACKET_SIZE];
+    size_t uPackets = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t uSentBits = 0;
+
+    auto sendDatagram = [&](void) {
+        if (pfCancel != NULL && *pfCancel)
+            return false;
+
+        double dTime = 0; // seconds from the beginning when the datagram is due
+        if (uBitrate != 0) {
+            dTime = (double)uSentBits / (double)uBitrate;
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(dTime)));
+        } else {
+            dTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        m_uTimestamp = (uint32_t)(uint64_t)(dTime * RTP_CLOCK);
+        uSentBits += (uint64_t)uPackets * CPacket::PACKET_SIZE * 8;
+
+        bool fResult = SendDatagram(abDatagram, uPackets);
+        uPackets = 0;
+        return fResult;
+    };
+
+    for (unsigned int uLoop = 0; uLoops == 0 || uLoop < uLoops; uLoop++) {
+        uint64_t uOffset = uFirstOffset;
+
+        for (;;) {
+            size_t uSize = READ_PACKETS * uStride;
+            const uint8_t* pbBlock = file.Read(uOffset, uSize, buffer.data());
+            if (pbBlock == NULL)
+                break;
+
+            // the last packet needs only its 188 bytes
+            size_t uCount = (uSize + uStride - CPacket::PACKET_SIZE) / uStride;
+            size_t i = 0;
+            for (; i < uCount; i++) {
+                const uint8_t* pb = pbBlock + i * uStride;
+                if (pb[0] != CPacket::SYNC_BYTE)
+                    break;
+
+                memcpy(abDatagram + CUDPSource::RTP_HEADER_SIZE + uPackets * CPacket::PACKET_SIZE, pb, CPacket::PACKET_SIZE);
+                if (++uPackets == PACKETS_PER_DATAGRAM && !sendDatagram())
+                    return false;
+            }
+
+            uOffset += i * uStride;
+
+            if (i < uCount) {
+                // lost sync; find where packets start again
+                uOffset = CTSSync::Find(file, uStride, uOffset + 1, UINT64_MAX, findBuffer);
+                if (uOffset == UINT64_MAX)
+                    break;
+            } else if (uSize < READ_PACKETS * uStride) {
+                // reached end of file
+                break;
+            }
+        }
+    }
+
+    // the rest of packets
+    if (uPackets != 0 && !sendDatagram())
+        return false;
+
+    return true;
+}
+
+//
+// CTSReplayer::SendDatagram
+//
+// Sends uPackets packets that follow CUDPSource::RTP_HEADER_SIZE bytes at
+// pbDatagram; RTP header is written there if it's needed.
+bool CTSReplayer::SendDatagram(uint8_t* pbDatagram, size_t uPackets)
+{
+#ifdef _WIN32
+    (void)pbDatagram;
+    (void)uPackets;
+    return false;
+#else
+    const uint8_t* pb = pbDatagram + CUDPSource::RTP_HEADER_SIZE;
+    size_t uSize = uPackets * CPacket::PACKET_SIZE;
+
+    if (m_fRTP) {
+        // version 2, no padding, extension and CSRC, marker isn't used
+        pbDatagram[0] = 0x80;
+        pbDatagram[1] = RTP_PAYLOAD_TYPE;
+        pbDatagram[2] = (uint8_t)(m_uSequence >> 8);
+        pbDatagram[3] = (uint8_t)m_uSequence;
+        pbDatagram[4] = (uint8_t)(m_uTimestamp >> 24);
+        pbDatagram[5] = (uint8_t)(m_uTimestamp >> 16);
+        pbDatagram[6] = (uint8_t)(m_uTimestamp >> 8);
+        pbDatagram[7] = (uint8_t)m_uTimestamp;
+        pbDatagram[8] = (uint8_t)(m_uSSRC >> 24);
+        pbDatagram[9] = (uint8_t)(m_uSSRC >> 16);
+        pbDatagram[10] = (uint8_t)(m_uSSRC >> 8);
+        pbDatagram[11] = (uint8_t)m_uSSRC;
+        m_uSequence++;
+
+        pb = pbDatagram;
+        uSize += CUDPSource::RTP_HEADER_SIZE;
+    }
+
+    for (;;) {
+        if (send(m_iSocket, pb, uSize, 0) == (ssize_t)uSize)
+            break;
+
+        // the queue of the interface is full for a moment
+        if (errno != EINTR && errno != ENOBUFS)
+            return false;
+    }
+
+    m_uDatagramsCount++;
+    m_uPacketsCount += uPackets;
+    return true;
+#endif
+}
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ * File: TSReplayer.h
+ *
+ * Description:
+ *    CTSReplayer class definition. This class sends a file with MPEG-2
+ *    Transport Stream over UDP at the given bitrate, 7 packets per datagram,
+ *    as IPTV headends do. With "rtp://" address the datagrams are wrapped in
+ *    RTP. It stands in for a live source, so CUDPSource can be tested and
+ *    measured on one machine (e.g. "udp://127.0.0.1:1234" or a multicast
+ *    group, which is looped back to local receivers).
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _TS_REPLAYER_H_
+#define _TS_REPLAYER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ts_file.h"
+
+//
+// Class defined in this file
+//
+class CTSReplayer;
+
+//
+// Class definitions
+//
+
+class CTSReplayer {
+public:
+    // constants
+    static const size_t PACKETS_PER_DATAGRAM = 7;
+    static const uint8_t RTP_PAYLOAD_TYPE = 33; // MP2T, see RFC 3551
+    static const int MULTICAST_TTL = 1; // multicast doesn't leave the local network
+
+public:
+    CTSReplayer(void);
+    ~CTSReplayer(void);
+
+    bool Open(const std::string& szAddress);
+    void Close(void);
+    bool IsOpened(void) const { return (m_iSocket != -1); }
+
+    bool Send(const CTSFile& file, uint64_t uBitrate, unsigned int uLoops = 1, const std::atomic<bool>* pfCancel = NULL);
+
+    uint64_t GetDatagramsCount(void) const { return m_uDatagramsCount; }
+    uint64_t GetPacketsCount(void) const { return m_uPacketsCount; }
+
+private:
+    CTSReplayer(const CTSReplayer&);
+    CTSReplayer& operator=(const CTSReplayer&);
+
+    bool SendDatagram(uint8_t* pbDatagram, size_t uPackets);
+
+private:
+    int m_iSocket; // -1 if the replayer isn't opened
+    bool m_fRTP;
+    uint16_t m_uSequence; // RTP sequence_number
+    uint32_t m_uSSRC; // RTP synchronization source
+    uint32_t m_uTimestamp; // RTP timestamp, 90 kHz
+
+    uint64_t m_uDatagramsCount;
+    uint64_t m_uPacketsCount;
+};
+
+#endif // _TS_REPLAYER_H_
@@ -0,0 +1,353 @@
+/*******************************************************************************
+ * File: TSStream.cpp
+ *
+ * Description: CTSStream class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "ts_stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "ts_sync.h"
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#define OPEN_READ(szName) _open((szName), _O_RDONLY | _O_BINARY)
+#define READ(fd, pb, uSize) _read((fd), (pb), (unsigned int)(uSize))
+#define CLOSE(fd) _close(fd)
+#define STDIN_FD 0
+#else
+#include <unistd.h>
+#define OPEN_READ(szName) open((szName), O_RDONLY)
+#define READ(fd, pb, uSize) read((fd), (pb), (uSize))
+#define CLOSE(fd) close(fd)
+#define STDIN_FD STDIN_FILENO
+#endif
+
+const size_t CTSStream::BUFFER_SIZE;
+
+CTSStream::CTSStream(void)
+{
+    m_iFile = -1;
+    m_fStdIn = false;
+    m_iIdleTimeout = -1;
+    Reset();
+}
+
+CTSStream::~CTSStream(void)
+{
+    Close();
+}
+
+//
+// CTSStream::Open
+//
+// Opens the file, FIFO or device for reading; "-" is standard input and
+// "udp://..." or "rtp://..." is UDP source (see CUDPSource). The input isn't
+// seeked, so anything that can be read forward will do.
+bool CTSStream::Open(const std::string& szFileName)
+{
+    Close();
+
+    if (CUDPSource::IsAddress(szFileName)) {
+        if (!m_UDP.Open(szFileName))
+            return false;
+    } else if (szFileName == "-") {
+#ifdef _WIN32
+        _setmode(STDIN_FD, _O_BINARY);
+#endif
+        m_iFile = STDIN_FD;
+        m_fStdIn = true;
+    } else {
+        m_iFile = OPEN_READ(szFileName.c_str());
+        if (m_iFile == -1)
+            return false;
+    }
+
+    m_Buffer.resize(BUFFER_SIZE);
+    return true;
+}
+
+void CTSStream::Close(void)
+{
+    if (m_iFile != -1 && !m_fStdIn)
+        CLOSE(m_iFile);
+
+    m_iFile = -1;
+    m_fStdIn = false;
+    m_UDP.Close();
+
+    std::vector<uint8_t>().swap(m_Buffer);
+    Reset();
+}
+
+void CTSStream::Reset(void)
+{
+    m_uSize = 0;
+    m_uBufferOffset = 0;
+    m_fEnd = false;
+    m_fReadError = false;
+
+    m_pOnPAT = NULL;
+    m_pOnPMS = NULL;
+    m_fStop = false;
+    m_Collector.Reset();
+    m_uPID = 0;
+    m_uOffset = 0;
+    m_uPacketNum = 0;
+
+    m_uPacketSize = 0;
+    m_uBytesCount = 0;
+    m_uPacketsCount = 0;
+    m_uSyncLossCount = 0;
+    m_uPASCount = 0;
+    m_uPMSCount = 0;
+}
+
+//
+// CTSStream::Run
+//
+// Reads the stream up to its end and calls the handlers for the sections met
+// there. The handlers are called from this thread while the stream is read,
+// so a live source is reported as it goes. Packet size is detected by the
+// first CTSSync::SYNC_SEARCH_LIMIT bytes; garbage between packets is skipped and
+// counted as sync loss, as CTSIndex does.
+//
+// The stream can be read only once. Returns true if it's read to the end.
+// Returns false if it isn't MPEG-2 TS, if it can't be read or if a handler
+// stopped reading.
+bool CTSStream::Run(const PATHandler& onPAT, const PMSHandler& onPMS)
+{
+    if (!IsOpened() || m_uBytesCount != 0 || m_fEnd)
+        return false;
+
+    m_pOnPAT = &onPAT;
+    m_pOnPMS = &onPMS;
+
+    // packet size is detected as soon as DETECT_COUNT packets are received;
+    // the bytes after the checked ones are needed to choose between sizes
+    const size_t uOverlap = CTSSync::GetFindOverlap<CPacket::RS_PACKET_SIZE>();
+    size_t uFirstOffset = 0;
+    for (;;) {
+        size_t uLimit = CTSSync::SYNC_SEARCH_LIMIT;
+        if (!m_fEnd && m_uSize < CTSSync::SYNC_SEARCH_LIMIT + uOverlap)
+            uLimit = (m_uSize > uOverlap) ? m_uSize - uOverlap : 0;
+
+        if (uLimit != 0) {
+            m_uPacketSize = CTSSync::DetectPacketSize(m_Buffer.data(), m_uSize, uLimit, &uFirstOffset);
+            if (m_uPacketSize != 0)
+                break;
+        }
+
+        if (m_fEnd || uLimit == CTSSync::SYNC_SEARCH_LIMIT)
+            // not MPEG-2 TS
+            return false;
+
+        Fill();
+    }
+
+    bool fResult = false;
+    switch (m_uPacketSize) {
+    case CPacket::PACKET_SIZE:
+        fResult = Scan<CPacket::PACKET_SIZE>(uFirstOffset);
+        break;
+    case CPacket::M2TS_PACKET_SIZE:
+        fResult = Scan<CPacket::M2TS_PACKET_SIZE>(uFirstOffset);
+        break;
+    case CPacket::RS_PACKET_SIZE:
+        fResult = Scan<CPacket::RS_PACKET_SIZE>(uFirstOffset);
+        break;
+    }
+
+    m_pOnPAT = NULL;
+    m_pOnPMS = NULL;
+    return fResult;
+}
+
+//
+// CTSStream::Fill
+//
+// Reads the next part of the stream after the bytes in the buffer. Waits
+// until some data arrive, but not until the buffer is full. Returns false at
+// the end of stream; UDP stream ends when nothing arrives for the idle
+// timeout (see SetIdleTimeout).
+bool CTSStream::Fill(void)
+{
+    if (m_fEnd || m_uSize == m_Buffer.size())
+        return false;
+
+    if (m_UDP.IsOpened()) {
+        int iReceived = m_UDP.Receive(m_Buffer.data() + m_uSize, m_Buffer.size() - m_uSize, m_iIdleTimeout);
+        if (iReceived > 0) {
+            m_uSize += (size_t)iReceived;
+            m_uBytesCount += (uint64_t)iReceived;
+            return true;
+        }
+
+        m_fReadError = (iReceived < 0);
+        m_fEnd = true;
+        return false;
+    }
+
+    for (;;) {
+        auto iRead = READ(m_iFile, m_Buffer.data() + m_uSize, m_Buffer.size() - m_uSize);
+        if (iRead > 0) {
+            m_uSize += (size_t)iRead;
+            m_uBytesCount += (uint64_t)iRead;
+            return true;
+        }
+
+        if (iRead < 0 && errno == EINTR)
+            continue;
+
+        if (iRead < 0)
+            m_fReadError = true;
+
+        m_fEnd = true;
+        return false;
+    }
+}
+
+//
+// CTSStream::Discard
+//
+// Drops uSize bytes from the beginning of the buffer; the rest is moved to
+// its beginning. Only a few packets are left in the buffer when it's called,
+// so little is moved.
+void CTSStream::Discard(size_t uSize)
+{
+    uSize = std::min(uSize, m_uSize);
+    if (uSize == 0)
+        return;
+
+    memmove(m_Buffer.data(), m_Buffer.data() + uSize, m_uSize - uSize);
+    m_uSize -= uSize;
+    m_uBufferOffset += uSize;
+}
+
+//
+// CTSStream::Scan
+//
+// Processes packets in the buffer up to the end of stream; STRIDE is the
+// packet size and uDetectedOffset is where the size is detected. sync_byte is
+// checked for all packets in the buffer at once; if it's wrong, the packets
+// are searched again after the bad one (see CTSSync::Find). Whole packets
+// that are processed are dropped from the buffer before it's filled again.
+// Returns false if a handler stopped reading or the stream can't be read.
+template <size_t STRIDE>
+bool CTSStream::Scan(size_t uDetectedOffset)
+{
+    // bytes kept before the position where packets are searched, so Find()
+    // can confirm them by the packets before
+    const size_t uHistory = (CTSSync::CONFIRM_COUNT - 1) * STRIDE;
+    const size_t uOverlap = CTSSync::GetFindOverlap<STRIDE>();
+
+    // the first packet is searched from the beginning as CTSIndex does: a few
+    // packets before early garbage are too few to detect the size, but they
+    // are packets; the buffer holds the bytes Find() needs after them
+    size_t uPos = CTSSync::Find<STRIDE>(m_Buffer.data(), m_uSize, 0, uDetectedOffset + 1);
+    bool fSynced = true;
+
+    for (;;) {
+        if (fSynced) {
+            size_t uCount = (m_uSize > uPos) ? CTSSync::GetPacketsCount<STRIDE>(m_uSize - uPos) : 0;
+            size_t uSynced = CTSSync::CountSynced<STRIDE>(m_Buffer.data() + uPos, uCount);
+
+            for (size_t i = 0; i < uSynced; i++, uPos += STRIDE)
+                if (!OnPacket(m_Buffer.data() + uPos, m_uBufferOffset + uPos))
+                    return false;
+
+            if (uSynced < uCount) {
+                // lost sync; find where packets start again
+                fSynced = false;
+                uPos++;
+            }
+        }
+
+        if (!fSynced) {
+            // offsets near the end are searched again when more data arrive,
+            // unless the stream ends there
+            size_t uLimit = m_fEnd ? m_uSize : ((m_uSize > uOverlap) ? m_uSize - uOverlap : 0);
+            if (uPos < uLimit) {
+                size_t uFound = CTSSync::Find<STRIDE>(m_Buffer.data(), m_uSize, uPos, uLimit);
+                if (uFound != CTSSync::NOT_FOUND) {
+                    uPos = uFound;
+                    fSynced = true;
+                    m_uSyncLossCount++;
+                    continue;
+                }
+
+                uPos = uLimit;
+            }
+        }
+
+        if (m_fEnd)
+            break;
+
+        size_t uDiscarded = std::min((uPos > uHistory) ? uPos - uHistory : 0, m_uSize);
+        Discard(uDiscarded);
+        uPos -= uDiscarded;
+
+        Fill();
+    }
+
+    return !m_fReadError;
+}
+
+//
+// CTSStream::OnPacket
+//
+// Passes the packet to the collector if it's on PAT PID or PMT PID. Until the
+// first PAT only PAT PID is collected: PIDs of PM Sections aren't known yet.
+bool CTSStream::OnPacket(const uint8_t* pbPacket, uint64_t uOffset)
+{
+    m_uOffset = uOffset;
+    m_uPID = CPacket(pbPacket).GetPID();
+    m_uPacketNum = m_uPacketsCount++;
+
+    CPIDMap::Type type = m_Collector.GetType(m_uPID);
+    if (type != CPIDMap::pat && type != CPIDMap::pmt)
+        return true;
+
+    m_Collector.Push(pbPacket, m_uPID, uOffset, m_uPacketNum, [this](PCBYTE pbSection, size_t uSize, uint64_t uTag, uint64_t uStartNum) {
+        OnSection(pbSection, uSize, uTag, uStartNum);
+    });
+
+    return !m_fStop;
+}
+
+//
+// CTSStream::OnSection
+//
+// Called for each section completed on PAT PID or PMT PID; uTag is the offset
+// of the packet the section starts in and uStartNum is its number.
+void CTSStream::OnSection(PCBYTE pbSection, size_t uSize, uint64_t uTag, uint64_t uStartNum)
+{
+    if (m_fStop)
+        return;
+
+    if (m_uPID == 0 && pbSection[0] == 0x00) {
+        // the table is reported only if it differs from the previous one
+        if (m_Collector.AddPAS(pbSection, uSize)) {
+            m_uPASCount++;
+            if (*m_pOnPAT && !(*m_pOnPAT)(m_Collector.GetPAT(), m_uOffset))
+                m_fStop = true;
+        }
+    } else if (m_uPID != 0 && pbSection[0] == 0x02) {
+        CPMTView PMS(pbSection, uSize);
+        if (!PMS.IsValid())
+            return;
+
+        PMS_INDEX_ENTRY entry = CPSICollector::MakePMSEntry(PMS, m_uPID, uTag, uStartNum);
+        entry.uPAS = (uint32_t)m_uPASCount - 1;
+        m_uPMSCount++;
+
+        if (*m_pOnPMS && !(*m_pOnPMS)(entry, PMS))
+            m_fStop = true;
+    }
+}
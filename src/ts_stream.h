@@ -0,0 +1,124 @@
+/*******************************************************************************
+ * File: TSStream.h
+ *
+ * Description:
+ *    CTSStream class definition. This class reads MPEG-2 Transport Stream
+ *    forward only, e.g. from a pipe, FIFO, standard input or UDP (see
+ *    CUDPSource), and reports PA and PM Sections as soon as they arrive. The
+ *    stream is read into a buffer of fixed size and nothing is kept per
+ *    section, so memory doesn't grow with the length of the stream.
+ *
+ *    Sections are collected by CPSICollector as CTSIndex does for files, so
+ *    the reported sections are the same as in the index of the stream saved
+ *    to a file.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _TS_STREAM_H_
+#define _TS_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "packet.h"
+#include "pmt_view.h"
+#include "psi_collector.h"
+#include "ts_index.h"
+#include "udp_source.h"
+
+//
+// Class defined in this file
+//
+class CTSStream;
+
+//
+// Class definitions
+//
+
+class CTSStream {
+public:
+    // constants
+    static const size_t BUFFER_SIZE = 2 * 1024 * 1024;
+
+    // Called by Run() when PAT differs from the previous one; uOffset is the
+    // offset of the packet that completes it. Return false to stop reading.
+    typedef std::function<bool(const PA_SECTION& PAT, uint64_t uOffset)> PATHandler;
+
+    // Called by Run() for each PM Section. entry is filled as in the index
+    // (uPAS is the number of PAT reported before); PMS is valid only during
+    // the call. Return false to stop reading.
+    typedef std::function<bool(const PMS_INDEX_ENTRY& entry, const CPMTView& PMS)> PMSHandler;
+
+public:
+    CTSStream(void);
+    ~CTSStream(void);
+
+    bool Open(const std::string& szFileName);
+    void Close(void);
+    bool IsOpened(void) const { return (m_iFile != -1 || m_UDP.IsOpened()); }
+    void SetIdleTimeout(int iTimeout) { m_iIdleTimeout = iTimeout; }
+
+    bool Run(const PATHandler& onPAT, const PMSHandler& onPMS);
+
+    size_t GetPacketSize(void) const { return m_uPacketSize; }
+    uint64_t GetBytesCount(void) const { return m_uBytesCount; }
+    uint64_t GetPacketsCount(void) const { return m_uPacketsCount; }
+    uint64_t GetSyncLossCount(void) const { return m_uSyncLossCount; }
+    uint64_t GetPASCount(void) const { return m_uPASCount; }
+    uint64_t GetPMSCount(void) const { return m_uPMSCount; }
+    uint64_t GetCRCErrorsCount(void) const { return m_Collector.GetAssembler().GetCRCErrorsCount(); }
+    bool IsReadError(void) const { return m_fReadError; }
+    const CUDPSource& GetUDPSource(void) const { return m_UDP; }
+
+private:
+    CTSStream(const CTSStream&);
+    CTSStream& operator=(const CTSStream&);
+
+    void Reset(void);
+    bool Fill(void);
+    void Discard(size_t uSize);
+
+    template <size_t STRIDE>
+    bool Scan(size_t uDetectedOffset);
+
+    bool OnPacket(const uint8_t* pbPacket, uint64_t uOffset);
+    void OnSection(PCBYTE pbSection, size_t uSize, uint64_t uTag, uint64_t uStartNum);
+
+private:
+    int m_iFile; // -1 if the stream isn't opened or it's received by m_UDP
+    bool m_fStdIn;
+    CUDPSource m_UDP;
+    int m_iIdleTimeout; // milliseconds without datagrams that end UDP stream, -1 for none
+
+    // the stream is read into the buffer and processed in place; the bytes
+    // that are processed are dropped from its beginning (see Discard)
+    std::vector<uint8_t> m_Buffer;
+    size_t m_uSize; // bytes in the buffer
+    uint64_t m_uBufferOffset; // offset of the first byte of the buffer in the stream
+    bool m_fEnd; // end of stream is reached
+    bool m_fReadError;
+
+    // state of the sections
+    const PATHandler* m_pOnPAT;
+    const PMSHandler* m_pOnPMS;
+    bool m_fStop; // a handler stopped reading
+    CPSICollector m_Collector;
+    uint16_t m_uPID; // PID of current packet
+    uint64_t m_uOffset; // offset of current packet
+    uint64_t m_uPacketNum; // number of current packet
+
+    // statistics
+    size_t m_uPacketSize; // 0 until it's detected
+    uint64_t m_uBytesCount;
+    uint64_t m_uPacketsCount;
+    uint64_t m_uSyncLossCount;
+    uint64_t m_uPASCount; // reported PATs
+    uint64_t m_uPMSCount;
+};
+
+#endif // _TS_STREAM_H_
@@ -0,0 +1,346 @@
+/*******************************************************************************
+ * File: TSSync.cpp
+ *
+ * Description: CTSSync class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "ts_sync.h"
+#include "packet.h"
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TS_SYNC_HAVE_AVX2
+#define TS_SYNC_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define TS_SYNC_HAVE_AVX2
+#define TS_SYNC_AVX2_TARGET
+#include <intrin.h>
+#endif
+
+static const size_t PACKET_SIZE = CPacket::PACKET_SIZE;
+
+const size_t CTSSync::CONFIRM_COUNT;
+const size_t CTSSync::RESOLVE_COUNT;
+const size_t CTSSync::DETECT_COUNT;
+const size_t CTSSync::SYNC_SEARCH_LIMIT;
+const size_t CTSSync::NOT_FOUND;
+const size_t CTSSync::WINDOW_SIZE;
+
+//
+// CountSyncedScalar
+//
+// Checks 8 packets per step; differences from sync_byte are ORed, so there
+// is one branch per step.
+template <size_t STRIDE>
+static size_t CountSyncedScalar(const uint8_t* pb, size_t uPackets)
+{
+    const uint8_t S = CPacket::SYNC_BYTE;
+    size_t i = 0;
+
+    for (; i + 8 <= uPackets; i += 8, pb += 8 * STRIDE)
+        if (((pb[0] ^ S) | (pb[STRIDE] ^ S) | (pb[2 * STRIDE] ^ S) | (pb[3 * STRIDE] ^ S)
+                | (pb[4 * STRIDE] ^ S) | (pb[5 * STRIDE] ^ S) | (pb[6 * STRIDE] ^ S) | (pb[7 * STRIDE] ^ S))
+            != 0)
+            break;
+
+    for (; i < uPackets; i++, pb += STRIDE)
+        if (*pb != S)
+            break;
+
+    return i;
+}
+
+#ifdef TS_SYNC_HAVE_AVX2
+
+//
+// CountSyncedAVX2
+//
+// Gathers the first 4 bytes of 8 packets and compares their low bytes with
+// sync_byte.
+template <size_t STRIDE>
+TS_SYNC_AVX2_TARGET static size_t CountSyncedAVX2(const uint8_t* pb, size_t uPackets)
+{
+    const __m256i offsets = _mm256_setr_epi32(0, 1 * STRIDE, 2 * STRIDE, 3 * STRIDE,
+        4 * STRIDE, 5 * STRIDE, 6 * STRIDE, 7 * STRIDE);
+    const __m256i lowByte = _mm256_set1_epi32(0xFF);
+    const __m256i sync = _mm256_set1_epi32(CPacket::SYNC_BYTE);
+    size_t i = 0;
+
+    for (; i + 8 <= uPackets; i += 8, pb += 8 * STRIDE) {
+        __m256i v = _mm256_i32gather_epi32((const int*)pb, offsets, 1);
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(v, lowByte), sync);
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(eq)) != 0xFF)
+            break;
+    }
+
+    return i + CountSyncedScalar<STRIDE>(pb, uPackets - i);
+}
+
+static bool DetectAVX2(void)
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, 7, 0);
+    return ((info[1] & (1 << 5)) != 0);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // TS_SYNC_HAVE_AVX2
+
+bool CTSSync::HasAVX2(void)
+{
+#ifdef TS_SYNC_HAVE_AVX2
+    static const bool fHasAVX2 = DetectAVX2();
+    return fHasAVX2;
+#else
+    return false;
+#endif
+}
+
+//
+// CTSSync::CountSynced
+//
+// Returns the number of packets at the beginning of pb (uPackets packets at
+// most) that start with sync_byte.
+template <size_t STRIDE>
+size_t CTSSync::CountSynced(const uint8_t* pb, size_t uPackets)
+{
+#ifdef TS_SYNC_HAVE_AVX2
+    if (HasAVX2())
+        return CountSyncedAVX2<STRIDE>(pb, uPackets);
+#endif
+
+    return CountSyncedScalar<STRIDE>(pb, uPackets);
+}
+
+//
+// Resolve
+//
+// Packets bigger than 188 bytes have a header or a trailer that may contain
+// sync_byte at the same place in many packets in a row (e.g. a byte of M2TS
+// timestamp), so an offset found by sync_byte may be up to STRIDE - 188 bytes
+// before the real one. The candidates are compared by the number of packets
+// in a row that start with sync_byte: such bytes change sooner or later.
+template <size_t STRIDE>
+static size_t Resolve(const uint8_t* pb, size_t uSize, size_t uOffset)
+{
+    const size_t uExtra = STRIDE - PACKET_SIZE;
+    if (uExtra == 0 || uSize - uOffset < uExtra + PACKET_SIZE)
+        return uOffset;
+
+    // the same number of packets is checked for each candidate
+    size_t uPackets = std::min(CTSSync::GetPacketsCount<STRIDE>(uSize - uOffset - uExtra), CTSSync::RESOLVE_COUNT);
+
+    size_t uBest = uOffset;
+    size_t uBestCount = CountSyncedScalar<STRIDE>(pb + uOffset, uPackets);
+    for (size_t i = 1; i <= uExtra && uBestCount < uPackets; i++)
+        if (pb[uOffset + i] == CPacket::SYNC_BYTE) {
+            size_t uCount = CountSyncedScalar<STRIDE>(pb + uOffset + i, uPackets);
+            if (uCount > uBestCount) {
+                uBest = uOffset + i;
+                uBestCount = uCount;
+            }
+        }
+
+    return uBest;
+}
+
+//
+// CTSSync::Find
+//
+// Finds the first offset in [uBegin, uLimit) where packets start: sync_byte
+// must be at the offset and in the CONFIRM_COUNT - 1 packets after it or
+// before it. Packets before are checked too, so the last packets before
+// garbage are found as well as the first ones after it. Bytes before uBegin
+// are used only for this check. Near the end of the buffer fewer packets are
+// checked (all whole packets that fit in it), so the caller should pass a
+// buffer that extends CONFIRM_COUNT packets (RESOLVE_COUNT packets for
+// STRIDE > 188) beyond uLimit unless it ends at the end of the file. Returns
+// NOT_FOUND if there is no such offset.
+template <size_t STRIDE>
+size_t CTSSync::Find(const uint8_t* pb, size_t uSize, size_t uBegin, size_t uLimit)
+{
+    if (uSize < PACKET_SIZE)
+        return NOT_FOUND;
+
+    if (uLimit > uSize - PACKET_SIZE + 1)
+        uLimit = uSize - PACKET_SIZE + 1;
+
+    const size_t uHistory = (CONFIRM_COUNT - 1) * STRIDE;
+
+    for (size_t uOffset = uBegin; uOffset < uLimit; uOffset++) {
+        const uint8_t* pbSync = (const uint8_t*)memchr(pb + uOffset, CPacket::SYNC_BYTE, uLimit - uOffset);
+        if (pbSync == NULL)
+            break;
+
+        uOffset = pbSync - pb;
+
+        size_t uPackets = std::min(GetPacketsCount<STRIDE>(uSize - uOffset), CONFIRM_COUNT);
+        if (CountSyncedScalar<STRIDE>(pbSync, uPackets) == uPackets)
+            return Resolve<STRIDE>(pb, uSize, uOffset);
+
+        if (uOffset >= uHistory && CountSyncedScalar<STRIDE>(pbSync - uHistory, CONFIRM_COUNT - 1) == CONFIRM_COUNT - 1)
+            return uOffset;
+    }
+
+    return NOT_FOUND;
+}
+
+//
+// CTSSync::Find
+//
+// Finds the first offset in [uBegin, uEnd) bytes range of the file where
+// packets start (see above). The file is read by windows; buffer is used if
+// the file isn't memory-mapped. Returns UINT64_MAX if there is no such offset.
+template <size_t STRIDE>
+uint64_t CTSSync::Find(const CTSFile& file, uint64_t uBegin, uint64_t uEnd, std::vector<uint8_t>& buffer)
+{
+    // windows overlap, so that the offsets near the end of a window are
+    // confirmed by the packets after it; packets before uBegin are read to
+    // confirm the offsets at the beginning
+    const size_t uOverlap = GetFindOverlap<STRIDE>();
+    const size_t uHistory = (CONFIRM_COUNT - 1) * STRIDE;
+
+    if (!file.IsMapped() && buffer.size() < uHistory + WINDOW_SIZE + uOverlap)
+        buffer.resize(uHistory + WINDOW_SIZE + uOverlap);
+
+    for (uint64_t uOffset = uBegin; uOffset < uEnd; uOffset += WINDOW_SIZE) {
+        size_t uBack = (size_t)std::min<uint64_t>(uOffset, uHistory);
+        size_t uSize = uBack + WINDOW_SIZE + uOverlap;
+        const uint8_t* pb = file.Read(uOffset - uBack, uSize, buffer.data());
+        if (pb == NULL)
+            break;
+
+        size_t uLimit = uBack + (size_t)std::min<uint64_t>(WINDOW_SIZE, uEnd - uOffset);
+        size_t uFound = Find<STRIDE>(pb, uSize, uBack, uLimit);
+        if (uFound != NOT_FOUND)
+            return uOffset - uBack + uFound;
+
+        if (uSize < uBack + WINDOW_SIZE + uOverlap)
+            // reached end of file
+            break;
+    }
+
+    return UINT64_MAX;
+}
+
+//
+// CTSSync::Find
+//
+// Same as above for packet size known only at runtime.
+uint64_t CTSSync::Find(const CTSFile& file, size_t uStride, uint64_t uBegin, uint64_t uEnd, std::vector<uint8_t>& buffer)
+{
+    switch (uStride) {
+    case CPacket::PACKET_SIZE:
+        return Find<CPacket::PACKET_SIZE>(file, uBegin, uEnd, buffer);
+    case CPacket::M2TS_PACKET_SIZE:
+        return Find<CPacket::M2TS_PACKET_SIZE>(file, uBegin, uEnd, buffer);
+    case CPacket::RS_PACKET_SIZE:
+        return Find<CPacket::RS_PACKET_SIZE>(file, uBegin, uEnd, buffer);
+    }
+
+    return UINT64_MAX;
+}
+
+//
+// FindStrict
+//
+// Finds the first offset below uLimit where DETECT_COUNT packets in a row
+// (or all whole packets up to the end of the buffer) start with sync_byte.
+template <size_t STRIDE>
+static size_t FindStrict(const uint8_t* pb, size_t uSize, size_t uLimit)
+{
+    if (uSize < PACKET_SIZE)
+        return CTSSync::NOT_FOUND;
+
+    uLimit = std::min(uLimit, uSize - PACKET_SIZE + 1);
+
+    for (size_t uOffset = 0; uOffset < uLimit; uOffset++) {
+        const uint8_t* pbSync = (const uint8_t*)memchr(pb + uOffset, CPacket::SYNC_BYTE, uLimit - uOffset);
+        if (pbSync == NULL)
+            break;
+
+        uOffset = pbSync - pb;
+
+        size_t uPackets = std::min(CTSSync::GetPacketsCount<STRIDE>(uSize - uOffset), CTSSync::DETECT_COUNT);
+        if (CountSyncedScalar<STRIDE>(pbSync, uPackets) == uPackets)
+            return Resolve<STRIDE>(pb, uSize, uOffset);
+    }
+
+    return CTSSync::NOT_FOUND;
+}
+
+//
+// CTSSync::DetectPacketSize
+//
+// Detects the size of packets by the first DETECT_COUNT packets found in the
+// first uLimit bytes of the buffer; the buffer should extend DETECT_COUNT
+// packets of the biggest size beyond uLimit unless the stream ends there. If
+// several sizes fit, the one with the earliest first packet is taken. Returns
+// 0 if the data isn't MPEG-2 TS. puFirstOffset receives the position of
+// sync_byte of the first packet.
+size_t CTSSync::DetectPacketSize(const uint8_t* pb, size_t uSize, size_t uLimit, size_t* puFirstOffset /* = NULL */)
+{
+    size_t offsets[3] = {
+        FindStrict<CPacket::PACKET_SIZE>(pb, uSize, uLimit),
+        FindStrict<CPacket::M2TS_PACKET_SIZE>(pb, uSize, uLimit),
+        FindStrict<CPacket::RS_PACKET_SIZE>(pb, uSize, uLimit),
+    };
+    const size_t sizes[3] = { CPacket::PACKET_SIZE, CPacket::M2TS_PACKET_SIZE, CPacket::RS_PACKET_SIZE };
+
+    size_t uBest = 0;
+    for (size_t i = 1; i < 3; i++)
+        if (offsets[i] < offsets[uBest])
+            uBest = i;
+
+    if (offsets[uBest] == NOT_FOUND)
+        return 0;
+
+    if (puFirstOffset != NULL)
+        *puFirstOffset = offsets[uBest];
+
+    return sizes[uBest];
+}
+
+//
+// CTSSync::DetectPacketSize
+//
+// Detects the size of packets in the file by the first uLimit bytes (see
+// above).
+size_t CTSSync::DetectPacketSize(const CTSFile& file, uint64_t uLimit, uint64_t* puFirstOffset /* = NULL */)
+{
+    std::vector<uint8_t> buffer(file.IsMapped() ? 0 : (size_t)uLimit + DETECT_COUNT * CPacket::RS_PACKET_SIZE);
+    size_t uSize = buffer.size();
+    if (file.IsMapped())
+        uSize = (size_t)uLimit + DETECT_COUNT * CPacket::RS_PACKET_SIZE;
+
+    const uint8_t* pb = file.Read(0, uSize, buffer.data());
+    if (pb == NULL)
+        return 0;
+
+    size_t uFirstOffset = 0;
+    size_t uPacketSize = DetectPacketSize(pb, uSize, (size_t)uLimit, &uFirstOffset);
+    if (uPacketSize != 0 && puFirstOffset != NULL)
+        *puFirstOffset = uFirstOffset;
+
+    return uPacketSize;
+}
+
+// kernels are instantiated for each supported packet size
+template size_t CTSSync::CountSynced<CPacket::PACKET_SIZE>(const uint8_t*, size_t);
+template size_t CTSSync::CountSynced<CPacket::M2TS_PACKET_SIZE>(const uint8_t*, size_t);
+template size_t CTSSync::CountSynced<CPacket::RS_PACKET_SIZE>(const uint8_t*, size_t);
+template size_t CTSSync::Find<CPacket::PACKET_SIZE>(const uint8_t*, size_t, size_t, size_t);
+template size_t CTSSync::Find<CPacket::M2TS_PACKET_SIZE>(const uint8_t*, size_t, size_t, size_t);
+template size_t CTSSync::Find<CPacket::RS_PACKET_SIZE>(const uint8_t*, size_t, size_t, size_t);
+template uint64_t CTSSync::Find<CPacket::PACKET_SIZE>(const CTSFile&, uint64_t, uint64_t, std::vector<uint8_t>&);
+template uint64_t CTSSync::Find<CPacket::M2TS_PACKET_SIZE>(const CTSFile&, uint64_t, uint64_t, std::vector<uint8_t>&);
+template uint64_t CTSSync::Find<CPacket::RS_PACKET_SIZE>(const CTSFile&, uint64_t, uint64_t, std::vector<uint8_t>&);
@@ -0,0 +1,108 @@
+/*******************************************************************************
+ * File: TSSync.h
+ *
+ * Description:
+ *    CTSSync class definition. This class checks sync_byte of packets in
+ *    large blocks of TS and finds the position of the first packet when the
+ *    stream doesn't start at a packet boundary or after garbage. It also
+ *    detects the size of packets in a file: 188 bytes (plain TS), 192 bytes
+ *    (M2TS, 4-byte timestamp before each packet) or 204 bytes (16 bytes of
+ *    Reed-Solomon parity after each packet).
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _TS_SYNC_H_
+#define _TS_SYNC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "packet.h"
+#include "ts_file.h"
+
+//
+// Class defined in this file
+//
+class CTSSync;
+
+//
+// Class definitions
+//
+
+// Positions in a file are positions of sync_byte, i.e. of the 188-byte TS
+// packet inside the bigger one; STRIDE is the distance between packets. The
+// functions are instantiated for each supported STRIDE, so the loops of the
+// common 188-byte case have no runtime multiplications by the stride.
+//
+// sync_byte of packets that follow each other is checked 8 packets at once
+// with AVX2 gather if the CPU supports it (chosen at runtime), otherwise with
+// unrolled scalar code. The check reads one byte in each packet, so it runs at
+// memory bandwidth either way.
+class CTSSync {
+public:
+    // number of packets in a row that must start with sync_byte to accept
+    // the position as packet boundary
+    static const size_t CONFIRM_COUNT = 5;
+
+    // number of packets checked to choose between offsets that differ by less
+    // than the header or the trailer of bigger packets
+    static const size_t RESOLVE_COUNT = 256;
+
+    // number of packets in a row checked to detect packet size
+    static const size_t DETECT_COUNT = 16;
+
+    // packets must be found within this number of bytes from the beginning of
+    // a file or a stream, otherwise it isn't considered as MPEG-2 TS
+    static const size_t SYNC_SEARCH_LIMIT = 1024 * 1024;
+
+    static const size_t NOT_FOUND = SIZE_MAX;
+
+    // size of the part of a file searched at once by Find()
+    static const size_t WINDOW_SIZE = 188 * 4096;
+
+public:
+    template <size_t STRIDE>
+    static size_t CountSynced(const uint8_t* pb, size_t uPackets);
+    template <size_t STRIDE>
+    static size_t Find(const uint8_t* pb, size_t uSize, size_t uBegin, size_t uLimit);
+    template <size_t STRIDE>
+    static uint64_t Find(const CTSFile& file, uint64_t uBegin, uint64_t uEnd, std::vector<uint8_t>& buffer);
+
+    static uint64_t Find(const CTSFile& file, size_t uStride, uint64_t uBegin, uint64_t uEnd, std::vector<uint8_t>& buffer);
+    static size_t DetectPacketSize(const uint8_t* pb, size_t uSize, size_t uLimit, size_t* puFirstOffset = NULL);
+    static size_t DetectPacketSize(const CTSFile& file, uint64_t uLimit, uint64_t* puFirstOffset = NULL);
+
+    template <size_t STRIDE>
+    static size_t GetPacketsCount(size_t uSize);
+    template <size_t STRIDE>
+    static size_t GetFindOverlap(void);
+
+    static bool HasAVX2(void);
+};
+
+//
+// CTSSync::GetPacketsCount
+//
+// Returns the number of whole packets in uSize bytes that start at a packet;
+// the last one needs only its 188 bytes, not the whole stride.
+template <size_t STRIDE>
+inline size_t CTSSync::GetPacketsCount(size_t uSize)
+{
+    return (uSize + STRIDE - CPacket::PACKET_SIZE) / STRIDE;
+}
+
+//
+// CTSSync::GetFindOverlap
+//
+// Returns the number of bytes that Find() needs beyond uLimit to confirm the
+// offsets near it.
+template <size_t STRIDE>
+inline size_t CTSSync::GetFindOverlap(void)
+{
+    return ((STRIDE == CPacket::PACKET_SIZE) ? CONFIRM_COUNT : RESOLVE_COUNT) * STRIDE;
+}
+
+#endif // _TS_SYNC_H_
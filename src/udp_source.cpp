@@ -0,0 +1,378 @@
+/*******************************************************************************
+ * File: UDPSource.cpp
+ *
+ * Description: CUDPSource class implementation.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "udp_source.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "packet.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+const size_t CUDPSource::BATCH_SIZE;
+const size_t CUDPSource::MAX_DATAGRAM_SIZE;
+const int CUDPSource::RECEIVE_BUFFER_SIZE;
+const size_t CUDPSource::RTP_HEADER_SIZE;
+
+#ifndef _WIN32
+//
+// Resolve
+//
+// Converts the host name or IPv4 address to the address; an empty name is
+// INADDR_ANY.
+static bool Resolve(const std::string& szHost, in_addr* pAddress)
+{
+    if (szHost.empty()) {
+        pAddress->s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+
+    if (inet_pton(AF_INET, szHost.c_str(), pAddress) == 1)
+        return true;
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    addrinfo* pInfo = NULL;
+    if (getaddrinfo(szHost.c_str(), NULL, &hints, &pInfo) != 0 || pInfo == NULL)
+        return false;
+
+    *pAddress = ((const sockaddr_in*)pInfo->ai_addr)->sin_addr;
+    freeaddrinfo(pInfo);
+    return true;
+}
+#endif
+
+CUDPSource::CUDPSource(void)
+{
+    m_iSocket = -1;
+    m_uFirst = 0;
+    m_uCount = 0;
+    m_uDatagramsCount = 0;
+    m_uRTPCount = 0;
+    m_uLostCount = 0;
+    m_uTruncatedCount = 0;
+    m_iSequence = -1;
+}
+
+CUDPSource::~CUDPSource(void)
+{
+    Close();
+}
+
+//
+// CUDPSource::IsAddress
+//
+// Returns true if the name is an address of UDP source rather than a file name.
+bool CUDPSource::IsAddress(const std::string& szName)
+{
+    return (szName.compare(0, 6, "udp://") == 0 || szName.compare(0, 6, "rtp://") == 0);
+}
+
+//
+// CUDPSource::ParseAddress
+//
+// Splits "udp://[source@][host]:port" (or "rtp://...") to IPv4 addresses in
+// host byte order and the port; missing addresses are INADDR_ANY.
+bool CUDPSource::ParseAddress(const std::string& szAddress, uint32_t* puHost, uint32_t* puSource, uint16_t* puPort)
+{
+#ifdef _WIN32
+    (void)szAddress;
+    (void)puHost;
+    (void)puSource;
+    (void)puPort;
+    return false;
+#else
+    if (!IsAddress(szAddress))
+        return false;
+
+    std::string szRest = szAddress.substr(6);
+    std::string szSource;
+    size_t uAt = szRest.find('@');
+    if (uAt != std::string::npos) {
+        szSource = szRest.substr(0, uAt);
+        szRest = szRest.substr(uAt + 1);
+    }
+
+    size_t uColon = szRest.rfind(':');
+    if (uColon == std::string::npos)
+        return false;
+
+    char* pszEnd = NULL;
+    unsigned long uPort = strtoul(szRest.c_str() + uColon + 1, &pszEnd, 10);
+    if (*pszEnd != '\0' || uPort == 0 || uPort > 65535)
+        return false;
+
+    in_addr host, source;
+    if (!Resolve(szRest.substr(0, uColon), &host) || !Resolve(szSource, &source))
+        return false;
+
+    *puHost = ntohl(host.s_addr);
+    *puSource = ntohl(source.s_addr);
+    *puPort = (uint16_t)uPort;
+    return true;
+#endif
+}
+
+//
+// CUDPSource::Open
+//
+// Binds the socket to the port of the address and joins the multicast group
+// if the address is a multicast one. Both "udp://" and "rtp://" are accepted
+// for any stream: RTP header is recognized in each datagram.
+bool CUDPSource::Open(const std::string& szAddress)
+{
+    Close();
+
+#ifdef _WIN32
+    (void)szAddress;
+    return false;
+#else
+    uint32_t uGroup = 0, uSource = 0;
+    uint16_t uPort = 0;
+    if (!ParseAddress(szAddress, &uGroup, &uSource, &uPort))
+        return false;
+
+    in_addr group, source;
+    group.s_addr = htonl(uGroup);
+    source.s_addr = htonl(uSource);
+
+    m_iSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_iSocket == -1)
+        return false;
+
+    // several receivers of the same group may run on one machine; the buffer
+    // keeps the stream while the receiver is busy (it may be limited by the system)
+    int iValue = 1;
+    setsockopt(m_iSocket, SOL_SOCKET, SO_REUSEADDR, &iValue, sizeof(iValue));
+    iValue = RECEIVE_BUFFER_SIZE;
+    setsockopt(m_iSocket, SOL_SOCKET, SO_RCVBUF, &iValue, sizeof(iValue));
+
+    // the socket is bound to the group, so datagrams of other groups sent to
+    // the same port aren't received
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(uPort);
+    address.sin_addr = group;
+
+    bool fResult = (bind(m_iSocket, (const sockaddr*)&address, sizeof(address)) == 0);
+
+    if (fResult && IN_MULTICAST(ntohl(group.s_addr))) {
+        if (uSource == INADDR_ANY) {
+            ip_mreq request;
+            memset(&request, 0, sizeof(request));
+            request.imr_multiaddr = group;
+            request.imr_interface.s_addr = htonl(INADDR_ANY);
+            fResult = (setsockopt(m_iSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) == 0);
+        } else {
+            ip_mreq_source request;
+            memset(&request, 0, sizeof(request));
+            request.imr_multiaddr = group;
+            request.imr_sourceaddr = source;
+            request.imr_interface.s_addr = htonl(INADDR_ANY);
+            fResult = (setsockopt(m_iSocket, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, &request, sizeof(request)) == 0);
+        }
+    }
+
+    if (!fResult) {
+        Close();
+        return false;
+    }
+
+    m_Pool.resize(BATCH_SIZE * MAX_DATAGRAM_SIZE);
+    m_Payloads.resize(BATCH_SIZE);
+    return true;
+#endif
+}
+
+void CUDPSource::Close(void)
+{
+#ifndef _WIN32
+    if (m_iSocket != -1)
+        close(m_iSocket);
+#endif
+
+    m_iSocket = -1;
+    std::vector<uint8_t>().swap(m_Pool);
+    m_uFirst = 0;
+    m_uCount = 0;
+    m_uDatagramsCount = 0;
+    m_uRTPCount = 0;
+    m_uLostCount = 0;
+    m_uTruncatedCount = 0;
+    m_iSequence = -1;
+}
+
+//
+// CUDPSource::Receive
+//
+// Copies TS from the received datagrams to the buffer; a datagram is never
+// split, so uSize must be at least MAX_DATAGRAM_SIZE. Waits up to iTimeout
+// milliseconds (-1 means forever) if there are no datagrams. Returns the
+// number of copied bytes, 0 if nothing is received in time or -1 on error.
+int CUDPSource::Receive(uint8_t* pbBuffer, size_t uSize, int iTimeout)
+{
+    if (!IsOpened())
+        return -1;
+
+    size_t uCopied = 0;
+    while (uCopied == 0) {
+        if (m_uCount == 0) {
+            int iResult = ReceiveBatch(iTimeout);
+            if (iResult <= 0)
+                return iResult;
+        }
+
+        while (m_uCount != 0) {
+            const std::pair<size_t, size_t>& payload = m_Payloads[m_uFirst];
+            if (payload.second > uSize - uCopied) {
+                if (uCopied == 0)
+                    // the buffer is too small
+                    return -1;
+
+                break;
+            }
+
+            memcpy(pbBuffer + uCopied, &m_Pool[m_uFirst * MAX_DATAGRAM_SIZE + payload.first], payload.second);
+            uCopied += payload.second;
+            m_uFirst++;
+            m_uCount--;
+        }
+    }
+
+    return (int)uCopied;
+}
+
+//
+// CUDPSource::ReceiveBatch
+//
+// Waits for datagrams and receives all that are there, up to BATCH_SIZE, by
+// one call. Returns the number of datagrams, 0 on timeout or -1 on error.
+int CUDPSource::ReceiveBatch(int iTimeout)
+{
+#ifdef _WIN32
+    (void)iTimeout;
+    return -1;
+#else
+    m_uFirst = 0;
+    m_uCount = 0;
+
+    for (;;) {
+        pollfd fd = { m_iSocket, POLLIN, 0 };
+        int iResult = poll(&fd, 1, iTimeout);
+        if (iResult == 0)
+            return 0;
+
+        if (iResult < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+#ifdef __linux__
+        mmsghdr messages[BATCH_SIZE];
+        iovec vectors[BATCH_SIZE];
+        memset(messages, 0, sizeof(messages));
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            vectors[i].iov_base = &m_Pool[i * MAX_DATAGRAM_SIZE];
+            vectors[i].iov_len = MAX_DATAGRAM_SIZE;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        iResult = recvmmsg(m_iSocket, messages, BATCH_SIZE, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < iResult; i++) {
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+                m_uTruncatedCount++;
+
+            AddDatagram((size_t)i, messages[i].msg_len);
+        }
+#else
+        // one datagram per call where recvmmsg isn't available
+        iResult = 0;
+        while ((size_t)iResult < BATCH_SIZE) {
+            ssize_t iSize = recv(m_iSocket, &m_Pool[(size_t)iResult * MAX_DATAGRAM_SIZE], MAX_DATAGRAM_SIZE, MSG_DONTWAIT);
+            if (iSize < 0)
+                break;
+
+            AddDatagram((size_t)iResult++, (size_t)iSize);
+        }
+
+        if (iResult == 0)
+            iResult = -1;
+#endif
+
+        if (iResult > 0) {
+            m_uCount = (size_t)iResult;
+            return iResult;
+        }
+
+        // the datagram is gone after poll (e.g. it had wrong checksum)
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+    }
+#endif
+}
+
+//
+// CUDPSource::AddDatagram
+//
+// Finds TS in the datagram received to the buffer uSlot. A datagram that
+// starts with sync_byte is TS as is; RTP header (version 2) is removed
+// together with CSRC list, header extension and padding. Other datagrams
+// are passed as is: TS isn't found there, so the reader skips them as
+// garbage.
+void CUDPSource::AddDatagram(size_t uSlot, size_t uSize)
+{
+    const uint8_t* pb = &m_Pool[uSlot * MAX_DATAGRAM_SIZE];
+    uSize = std::min(uSize, MAX_DATAGRAM_SIZE);
+    m_uDatagramsCount++;
+
+    size_t uOffset = 0;
+    if (uSize >= RTP_HEADER_SIZE && pb[0] != CPacket::SYNC_BYTE && (pb[0] & 0xC0) == 0x80) {
+        m_uRTPCount++;
+
+        uOffset = RTP_HEADER_SIZE + 4 * (pb[0] & 0x0F);
+        if ((pb[0] & 0x10) && uOffset + 4 <= uSize)
+            // header extension: 16-bit profile data and 16-bit length in words
+            uOffset += 4 + 4 * (((size_t)pb[uOffset + 2] << 8) | pb[uOffset + 3]);
+
+        if ((pb[0] & 0x20) && uSize > uOffset)
+            // padding: the last byte is its length
+            uSize -= std::min<size_t>(pb[uSize - 1], uSize - uOffset);
+
+        uOffset = std::min(uOffset, uSize);
+
+        // datagrams lost on the way are seen by sequence_number; a step back
+        // is a reordered datagram or a restarted sender, it isn't counted
+        uint16_t uSequence = (uint16_t)(((uint16_t)pb[2] << 8) | pb[3]);
+        if (m_iSequence >= 0) {
+            uint16_t uStep = (uint16_t)(uSequence - m_iSequence);
+            if (uStep != 0 && uStep < 0x8000)
+                m_uLostCount += uStep - 1;
+        }
+        m_iSequence = uSequence;
+    }
+
+    // datagrams without TS are given out as empty ones
+    m_Payloads[uSlot] = std::make_pair(uOffset, uSize - uOffset);
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+ * File: UDPSource.h
+ *
+ * Description:
+ *    CUDPSource class definition. This class receives MPEG-2 Transport
+ *    Stream sent over UDP (usually multicast, 7 packets per datagram),
+ *    either as is or in RTP packets (RFC 3550, RFC 2250). Datagrams are
+ *    received by batches (recvmmsg where it's available) into buffers that
+ *    are allocated once, and their payloads are given out as a plain stream
+ *    of bytes with the RTP headers removed.
+ *
+ *    Addresses look like "udp://239.1.1.1:1234", "rtp://239.1.1.1:5004",
+ *    "udp://@:1234" (any address) or "udp://10.0.0.1@232.1.1.1:1234"
+ *    (source-specific multicast). IPv4 only.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#ifndef _UDP_SOURCE_H_
+#define _UDP_SOURCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// Class defined in this file
+//
+class CUDPSource;
+
+//
+// Class definitions
+//
+
+class CUDPSource {
+public:
+    // constants
+    static const size_t BATCH_SIZE = 64; // datagrams received at once
+    static const size_t MAX_DATAGRAM_SIZE = 9000; // jumbo frame; longer datagrams are truncated
+    static const int RECEIVE_BUFFER_SIZE = 8 * 1024 * 1024; // socket buffer asked from the system
+    static const size_t RTP_HEADER_SIZE = 12; // fixed part of RTP header, see section 5.1 in RFC 3550
+
+public:
+    CUDPSource(void);
+    ~CUDPSource(void);
+
+    static bool IsAddress(const std::string& szName);
+    static bool ParseAddress(const std::string& szAddress, uint32_t* puHost, uint32_t* puSource, uint16_t* puPort);
+
+    bool Open(const std::string& szAddress);
+    void Close(void);
+    bool IsOpened(void) const { return (m_iSocket != -1); }
+
+    int Receive(uint8_t* pbBuffer, size_t uSize, int iTimeout);
+
+    uint64_t GetDatagramsCount(void) const { return m_uDatagramsCount; }
+    uint64_t GetRTPCount(void) const { return m_uRTPCount; }
+    uint64_t GetLostCount(void) const { return m_uLostCount; }
+    uint64_t GetTruncatedCount(void) const { return m_uTruncatedCount; }
+
+private:
+    CUDPSource(const CUDPSource&);
+    CUDPSource& operator=(const CUDPSource&);
+
+    int ReceiveBatch(int iTimeout);
+    void AddDatagram(size_t uSlot, size_t uSize);
+
+private:
+    int m_iSocket; // -1 if the source isn't opened
+
+    // buffers for BATCH_SIZE datagrams; datagrams [m_uFirst, m_uFirst + m_uCount)
+    // are received but not given out yet
+    std::vector<uint8_t> m_Pool;
+    std::vector<std::pair<size_t, size_t>> m_Payloads; // offset and size of TS in each buffer
+    size_t m_uFirst;
+    size_t m_uCount;
+
+    // statistics
+    uint64_t m_uDatagramsCount;
+    uint64_t m_uRTPCount; // datagrams with RTP header
+    uint64_t m_uLostCount; // datagrams missed by RTP sequence_number
+    uint64_t m_uTruncatedCount; // datagrams longer than MAX_DATAGRAM_SIZE
+    int m_iSequence; // RTP sequence_number of the previous datagram, -1 if there was none
+};
+
+#endif // _UDP_SOURCE_H_
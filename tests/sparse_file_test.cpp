@@ -0,0 +1,246 @@
+/*******************************************************************************
+ * File: SparseFileTest.cpp
+ *
+ * Description:
+ *    Checks 64-bit offsets and counts on sparse files: packets are written
+ *    only at the beginning and near the end, the rest of the file is a hole
+ *    that takes no disk space and reads as zeros (garbage for the index).
+ *
+ *    A file over 4 TB checks the size, reading and sync search at offsets
+ *    above 42 bits; scanning its hole would take an hour, so the index is
+ *    checked end to end on a file over 4 GB, where offsets don't fit in
+ *    32 bits.
+ *
+ *    Returns 0 if all checks pass, 1 if some fail and 77 (skipped) if the
+ *    file system can't hold such files.
+ *
+ * Copyright (c) Ditenbir Pavel, 2007, 2024.
+ *
+ *******************************************************************************/
+
+#include "src/crc32.h"
+#include "src/transport_stream.h"
+#include "src/ts_file.h"
+#include "src/ts_sync.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const int SKIPPED = 77;
+
+static const uint16_t PMT_PID = 0x0100;
+static const uint16_t PCR_PID = 0x0101;
+static const uint16_t PROGRAM_NUMBER = 1;
+
+// packets written at the beginning and at the end of each file; PAT and PMT
+// are in the first two packets of each ten
+static const size_t PACKETS_COUNT = 100;
+static const size_t TABLES_PERIOD = 10;
+
+static int s_iFailed = 0;
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            s_iFailed++;                                                \
+        }                                                               \
+    } while (0)
+
+//
+// MakeSectionPacket
+//
+// Makes a packet of PID that carries the whole section; section_length and
+// CRC_32 are filled here.
+static void MakeSectionPacket(uint8_t* pb, uint16_t uPID, uint8_t uCC, std::vector<uint8_t> section)
+{
+    size_t uLength = section.size() - 3 + 4;
+    section[1] = (uint8_t)(0xB0 | (uLength >> 8));
+    section[2] = (uint8_t)uLength;
+
+    uint32_t uCRC = CCRC32::Calc(section.data(), section.size());
+    for (int i = 3; i >= 0; i--)
+        section.push_back((uint8_t)(uCRC >> (i * 8)));
+
+    memset(pb, 0xFF, CPacket::PACKET_SIZE);
+    pb[0] = CPacket::SYNC_BYTE;
+    pb[1] = (uint8_t)(0x40 | (uPID >> 8));
+    pb[2] = (uint8_t)uPID;
+    pb[3] = (uint8_t)(0x10 | (uCC & 0x0F));
+    pb[4] = 0; // pointer_field
+    memcpy(pb + 5, section.data(), section.size());
+}
+
+//
+// MakePackets
+//
+// Makes PACKETS_COUNT packets of one program: PAT, PMT and packets of its
+// stream.
+static std::vector<uint8_t> MakePackets(void)
+{
+    const std::vector<uint8_t> PAT = { 0x00, 0, 0, 0x00, 0x01, 0xC1, 0x00, 0x00,
+        (uint8_t)(PROGRAM_NUMBER >> 8), (uint8_t)PROGRAM_NUMBER, (uint8_t)(0xE0 | (PMT_PID >> 8)), (uint8_t)PMT_PID };
+    const std::vector<uint8_t> PMT = { 0x02, 0, 0, (uint8_t)(PROGRAM_NUMBER >> 8), (uint8_t)PROGRAM_NUMBER, 0xC1, 0x00, 0x00,
+        (uint8_t)(0xE0 | (PCR_PID >> 8)), (uint8_t)PCR_PID, 0xF0, 0x00,
+        0x02, (uint8_t)(0xE0 | (PCR_PID >> 8)), (uint8_t)PCR_PID, 0xF0, 0x00 };
+
+    std::vector<uint8_t> packets(PACKETS_COUNT * CPacket::PACKET_SIZE);
+    uint8_t uCC = 0;
+    for (size_t i = 0; i < PACKETS_COUNT; i++) {
+        uint8_t* pb = packets.data() + i * CPacket::PACKET_SIZE;
+
+        if (i % TABLES_PERIOD == 0) {
+            MakeSectionPacket(pb, 0, (uint8_t)(i / TABLES_PERIOD), PAT);
+        } else if (i % TABLES_PERIOD == 1) {
+            MakeSectionPacket(pb, PMT_PID, (uint8_t)(i / TABLES_PERIOD), PMT);
+        } else {
+            memset(pb, 0xFF, CPacket::PACKET_SIZE);
+            pb[0] = CPacket::SYNC_BYTE;
+            pb[1] = (uint8_t)(PCR_PID >> 8);
+            pb[2] = (uint8_t)PCR_PID;
+            pb[3] = (uint8_t)(0x10 | (uCC++ & 0x0F));
+        }
+    }
+
+    return packets;
+}
+
+//
+// CreateSparseFile
+//
+// Creates the file of uSize bytes with packets at its beginning and at
+// uTailOffset. Returns false if the file system can't hold it.
+static bool CreateSparseFile(const std::string& szFileName, uint64_t uSize, uint64_t uTailOffset)
+{
+    std::vector<uint8_t> packets = MakePackets();
+
+    int fd = open(szFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return false;
+
+    bool fResult = ftruncate(fd, (off_t)uSize) == 0
+        && pwrite(fd, packets.data(), packets.size(), 0) == (ssize_t)packets.size()
+        && pwrite(fd, packets.data(), packets.size(), (off_t)uTailOffset) == (ssize_t)packets.size();
+
+    close(fd);
+
+    if (!fResult)
+        unlink(szFileName.c_str());
+
+    return fResult;
+}
+
+//
+// CheckMultiTBFile
+//
+// Checks size, reading and sync search in a file over 4 TB.
+static int CheckMultiTBFile(const std::string& szFileName)
+{
+    const uint64_t uTailOffset = (4ull << 40) + 1000;
+    const uint64_t uSize = uTailOffset + PACKETS_COUNT * CPacket::PACKET_SIZE;
+
+    if (!CreateSparseFile(szFileName, uSize, uTailOffset))
+        return SKIPPED;
+
+    CTSFile file;
+    CHECK(file.Open(szFileName));
+    CHECK(file.GetSize() == uSize);
+    if (sizeof(void*) == 8)
+        CHECK(file.IsMapped());
+
+    uint8_t bPacket[CPacket::PACKET_SIZE];
+    size_t uRead = sizeof(bPacket);
+    const uint8_t* pb = file.Read(uTailOffset, uRead, bPacket);
+    CHECK(pb != NULL && uRead == sizeof(bPacket) && pb[0] == CPacket::SYNC_BYTE);
+
+    // the last packet ends at the end of file
+    uRead = sizeof(bPacket);
+    pb = file.Read(uSize - CPacket::PACKET_SIZE, uRead, bPacket);
+    CHECK(pb != NULL && uRead == sizeof(bPacket) && pb[0] == CPacket::SYNC_BYTE);
+
+    // the first packet after the hole is found at its 64-bit offset
+    std::vector<uint8_t> buffer;
+    CHECK(CTSSync::Find(file, CPacket::PACKET_SIZE, uTailOffset - CTSSync::WINDOW_SIZE, uSize, buffer) == uTailOffset);
+
+    CTransportStream TS;
+    TS.SetIndexCache(false);
+    CHECK(TS.Open(szFileName, false));
+    CHECK(TS.GetFileSize() == uSize);
+
+    unlink(szFileName.c_str());
+    return 0;
+}
+
+//
+// CheckIndexedFile
+//
+// Indexes a file over 4 GB and checks the packets and PM Sections after the
+// hole.
+static int CheckIndexedFile(const std::string& szFileName)
+{
+    const uint64_t uTailOffset = (4ull << 30) + 1000;
+    const uint64_t uSize = uTailOffset + PACKETS_COUNT * CPacket::PACKET_SIZE;
+
+    if (!CreateSparseFile(szFileName, uSize, uTailOffset))
+        return SKIPPED;
+
+    CTransportStream TS;
+    TS.SetIndexCache(false);
+    CHECK(TS.Open(szFileName));
+    CHECK(TS.IsMPEG2TS() && TS.IsIndexComplete());
+    CHECK(TS.GetFileSize() == uSize);
+    CHECK(TS.GetPacketsCount() == 2 * PACKETS_COUNT);
+    CHECK(TS.GetIndex().GetSyncLossCount() == 1);
+
+    const uint64_t uPMSCount = 2 * PACKETS_COUNT / TABLES_PERIOD;
+    CHECK(TS.GetPMSCount() == uPMSCount);
+
+    // the second half of PM Sections is after the hole
+    PMS_INDEX_ENTRY entry;
+    CHECK(TS.GetIndex().GetPMSection(uPMSCount / 2, &entry));
+    CHECK(entry.uOffset == uTailOffset + CPacket::PACKET_SIZE);
+    CHECK(entry.uPacketNum == PACKETS_COUNT + 1);
+
+    PM_SECTION PMS;
+    uint64_t uPMSNum = 0;
+    uint64_t uPacketNum = TS.GetLastPMSection(&PMS, &uPMSNum);
+    CHECK(uPacketNum == PACKETS_COUNT + (PACKETS_COUNT - TABLES_PERIOD + 1) + 1);
+    CHECK(uPMSNum == uPMSCount);
+    CHECK(PMS.program_number == PROGRAM_NUMBER && PMS.PCR_PID == PCR_PID);
+
+    // packets after the hole are found by their numbers
+    CHECK(TS.GoToPacket(PACKETS_COUNT + 5, &PMS, &uPMSNum) != 0);
+    CHECK(uPMSNum == uPMSCount / 2 + 1);
+
+    unlink(szFileName.c_str());
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string szDir = (argc > 1) ? argv[1] : ".";
+
+    int iResult = CheckMultiTBFile(szDir + "/sparse_4tb.ts");
+    if (iResult == SKIPPED) {
+        printf("the file system can't hold a sparse file over 4 TB, skipped\n");
+        return SKIPPED;
+    }
+
+    if (CheckIndexedFile(szDir + "/sparse_4gb.ts") == SKIPPED) {
+        printf("the file system can't hold a sparse file over 4 GB, skipped\n");
+        return SKIPPED;
+    }
+
+    if (s_iFailed != 0) {
+        printf("%d checks failed\n", s_iFailed);
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}